@@ -1,8 +1,11 @@
 #include <butil/macros.h>
+#include <atomic>
+#include <functional>
 #include <string>
 #include <vector>
 #include <memory>
 #include <unordered_map>
+#include <utility>
 
 #include "status.h"
 #include "kv.h"
@@ -13,14 +16,23 @@
 
 namespace brpc {
     class Channel;
-    class ChannelOptions;
+}
+
+namespace bthread {
+    class Mutex;
 }
 
 namespace azino {
     class TxIdentifier;
     class TxWriteBuffer;
+    class Value;
+    class AsyncCommitInfo;
+    class TimestampClient;
+
+    // Called with the result of an async operation, in a bthread.
+    typedef std::function<void(Status)> StatusCallback;
 
-    // not thread safe, and it is not reusable.
+    // Reusable by Reset. Reads of a started tx may run concurrently, other operations may not overlap with anything.
     class Transaction {
     public:
         Transaction(const Options& options, const std::string& txplanner_addr);
@@ -30,27 +42,144 @@ namespace azino {
         // tx operations
         Status Begin();
         Status Commit();
+        // Cleans all the locks and intents of a started tx.
+        Status Abort();
+        // Makes a finished, or started but unwritten, tx ready to Begin again, keeping its channels and buffers.
+        Status Reset();
 
         // kv operations, fail when tx has not started
         Status Put(const WriteOptions& options, const UserKey& key, const UserValue& value);
+        // Moves "value" into the write buffer instead of copying it.
+        Status Put(const WriteOptions& options, const UserKey& key, UserValue&& value);
+        // Puts "value" only if the value this tx sees is "expected", or fails with ConditionFailed.
+        Status PutIf(const WriteOptions& options, const UserKey& key, const UserValue& value, const UserValue& expected);
         Status Get(const ReadOptions& options, const UserKey& key, UserValue& value);
         Status Delete(const WriteOptions& options, const UserKey& key);
-        
+        // Folds "operand" onto the value of "key" by the merge operator "op", see azino/merge.h.
+        Status Merge(const WriteOptions& options, const UserKey& key, const std::string& op, const UserValue& operand);
+        // Reads all the "keys" at once, returns the first failed status other than NotFound.
+        Status MultiGet(const ReadOptions& options, const std::vector<UserKey>& keys,
+                        std::vector<UserValue>& values, std::vector<Status>& stss);
+        // Reads at most "limit" (0 for all) keys in ["start", "end") in key order, an empty "end" means no upper bound.
+        Status Scan(const ReadOptions& options, const UserKey& start, const UserKey& end, size_t limit,
+                    std::vector<std::pair<UserKey, UserValue>>& kvs);
+
+        // async operations, return at once and call "done" when finished. The tx and "value" should outlive them.
+        void AsyncGet(const ReadOptions& options, const UserKey& key, UserValue* value, StatusCallback done);
+        void AsyncCommit(StatusCallback done);
+        // Starts reading "keys" without waiting, a later Get of them takes the results.
+        Status Prefetch(const ReadOptions& options, const std::vector<UserKey>& keys);
+
     private:
 
-        Status Write(const WriteOptions& options, const UserKey& key, bool is_delete, const UserValue& value = "");
-        Status PreputAll();
+        Status Write(const WriteOptions& options, const UserKey& key, bool is_delete, UserValue value = "");
+        // Fails if the tx could not write now.
+        Status CheckWritable();
+        // Streams the buffered values if "bytes" more of them make them exceed Options::stream_prewrite_bytes.
+        Status CountUnstreamed(size_t bytes);
+        // Reads the value of "key" committed before this tx, leaving out its own writes.
+        Status ReadCommitted(const UserKey& key, UserValue& value);
+        // Fills "value" and "sts" from the read cache, returns false if it does not have "key".
+        bool ReadCached(const UserKey& key, UserValue& value, Status& sts);
+        struct ReadCall;
+        // Reads a key from its txindex, then from storage if the txindex has nothing visible,
+        // moved along by the done closures of the rpcs till FinishRead calls back.
+        void IssueRead(ReadCall* call, bool resolve_async_commit);
+        void OnRead(ReadCall* call);
+        void OnStorageRead(ReadCall* call);
+        void FinishRead(ReadCall* call, Status sts);
+        // Fills "value" and "sts" from the prefetched reads of "key", returns false if they could not tell.
+        bool ReadPrefetched(const UserKey& key, UserValue& value, Status& sts);
+        struct CommitCall;
+        // Checks whether the tx could commit and gets it ready, "proceed" is false if it is done with "Status" then.
+        Status BeginCommit(CommitCall* call, bool& proceed);
+        // Takes the commit_ts got from txplanner, and decides how to commit.
+        Status CommitTxResult(CommitCall* call);
+        // Commits all the writes in one rpc, when they all live on one txindex. "async" calls OnOnePhaseCommit
+        // when it is done, otherwise it waits, and OnePhaseCommitResult tells how it went.
+        void IssueOnePhaseCommit(CommitCall* call, bool async);
+        Status OnePhaseCommitResult(CommitCall* call);
+        void OnCommitTx(CommitCall* call);
+        void OnOnePhaseCommit(CommitCall* call);
+        void EndAsyncCommit(CommitCall* call, Status sts);
+        // Ends the commit according to how the writes are preput, or committed in one phase.
+        Status FinishCommit(CommitCall* call, Status preput_sts);
+        Status PreputAll(bool async_commit);
         Status CommitAll();
         Status AbortAll();
+        // Waits the pipelined lock on "key" if any, and returns its result.
+        // Only reads the pending locks, so it is safe to call from concurrent Gets.
+        Status WaitLock(const UserKey& key);
+        // Waits all the pipelined locks, and drops the writes whose lock failed.
+        Status WaitLocks();
+        // Resolves the intents of async-commit tx "holder": decides it on its primary key first if it is undecided,
+        // committing it there if all of its intents are written, then commits or cleans the others as decided.
+        Status ResolveAsyncCommit(const TxIdentifier& holder, const AsyncCommitInfo& info);
+        // Writes the intents of the values buffered since the last call in background,
+        // after the previous ones are written. See Options::stream_prewrite_bytes.
+        Status StreamPrewrite();
+        // Waits the intents being streamed, and returns the first failure of streaming so far.
+        Status WaitStream();
+        // The value buffered for "key", nullptr if it is not written or its intent is streamed.
+        // Safe to call from concurrent reads, as the two below.
+        std::shared_ptr<Value> FindWritten(const UserKey& key);
+        // Whether "key" is written, buffered or streamed.
+        bool HasWritten(const UserKey& key);
+        // Counts an rpc of this tx that sent and received "bytes", safe to call from concurrent Gets.
+        void CountRpc(int64_t bytes);
+        // Records the rpcs counted into the per-tx bvars, and starts counting again.
+        void RecordTxStats();
         std::unique_ptr<Options> _options;
-        std::unique_ptr<brpc::ChannelOptions> _channel_options;
-        std::unique_ptr<brpc::Channel> _txplanner;
-        std::unique_ptr<brpc::Channel> _storage;
-        std::vector<std::unique_ptr<brpc::Channel>> _txindexs;
+        // channels are shared with other transactions and async commits in background
+        std::shared_ptr<brpc::Channel> _txplanner;
+        std::shared_ptr<brpc::Channel> _storage;
+        TimestampClient* _timestamp_client; // process-wide, never freed
+        std::vector<std::shared_ptr<brpc::Channel>> _txindexs;
         std::unique_ptr<TxIdentifier> _txid;
         std::unique_ptr<TxWriteBuffer> _txwritebuffer;
+        struct PendingLock;
+        std::unordered_map<UserKey, std::unique_ptr<PendingLock>> _pending_locks;
+        struct StreamBatch;
+        std::shared_ptr<StreamBatch> _stream; // intents being streamed, at most one batch in flight
+        size_t _unstreamed_bytes;
+        bool _streamed;
+        Status _stream_sts;
+        bool _merged; // some key is merged, which has no async commit info to resolve the tx by
+        UserKey _primary; // the primary key of an async-commit tx, which decides whether it commits
+        struct PrefetchBatch;
+        std::vector<std::unique_ptr<PrefetchBatch>> _prefetches; // kept till Reset, along with their results
+        std::unordered_map<UserKey, std::pair<PrefetchBatch*, size_t>> _prefetched; // where each key is in them
+        // Guards the write buffer, the streamed intents and the prefetches against concurrent reads,
+        // held briefly by reads, and by WaitStream which they may call, though not while it waits the rpcs.
+        std::unique_ptr<bthread::Mutex> _read_mutex;
+        std::atomic<int64_t> _rpc_count;
+        std::atomic<int64_t> _rpc_bytes;
     };
 
+    // The body of a tx, which is begun before and committed after it.
+    typedef std::function<Status(Transaction&)> TxFunction;
+
+    // Runs "func" in a tx and commits it, running it again on write conflicts, or aborts it if "func" fails.
+    Status RunInTransaction(const Options& options, const std::string& txplanner_addr,
+                            const TxFunction& func, const RetryOptions& retry_options = RetryOptions());
+
+    // One write of a tx committed by CommitBatch, deleting "key" if "is_delete".
+    struct BatchWrite {
+        BatchWrite(const UserKey& k, const UserValue& v, bool d = false) : key(k), value(v), is_delete(d) {}
+        UserKey key;
+        UserValue value;
+        bool is_delete;
+    };
+
+    // Commits many independent write-only txs in a few rpcs, "stss" gets the status of each. Returns the first failure.
+    Status CommitBatch(const std::string& txplanner_addr, const std::vector<std::vector<BatchWrite>>& txs,
+                       std::vector<Status>& stss);
+
+    // Deletes every key in ["start", "end") in a tx of its own, an empty "end" means no upper bound.
+    // The parts on the txindexes are not atomic together, those blocked by writers are retried per "retry_options".
+    Status DeleteRange(const std::string& txplanner_addr, const UserKey& start, const UserKey& end,
+                       const RetryOptions& retry_options = RetryOptions());
+
 
 }
 
@@ -0,0 +1,118 @@
+#ifndef AZINO_INCLUDE_MERGE_H
+#define AZINO_INCLUDE_MERGE_H
+
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace azino {
+    // Folds a merge operand onto the value it applies to in place, or only checks the operand if "value" is nullptr.
+    // Returns false if either of them is not valid for the operator, leaving "value" unchanged.
+    typedef std::function<bool(std::string* value, const std::string& operand)> MergeOperator;
+
+    // Named merge operators, "add" and "max" on decimal int64s and "append" are built in.
+    // An operator should be associative, so that operands could be folded together before the value they
+    // apply to is known. A key without value takes the first operand as its value.
+    // The sdk and every txindex should register the same operators, before any tx uses them.
+    // Thread safe, operators found stay valid as they are never removed.
+    class MergeOperators {
+    public:
+        // Returns false if "name" is registered already.
+        static bool Register(const std::string& name, const MergeOperator& op) {
+            std::lock_guard<std::mutex> lck(mutex());
+            return registry().insert(std::make_pair(name, op)).second;
+        }
+
+        // Returns nullptr if "name" is not registered.
+        static const MergeOperator* Find(const std::string& name) {
+            std::lock_guard<std::mutex> lck(mutex());
+            auto& ops = registry();
+            auto iter = ops.find(name);
+            return iter == ops.end() ? nullptr : &iter->second;
+        }
+
+    private:
+        // The whole of "s" should be a decimal int64.
+        static bool parseInt64(const std::string& s, long long& n) {
+            if (s.empty()) {
+                return false;
+            }
+            char* end = nullptr;
+            errno = 0;
+            n = std::strtoll(s.c_str(), &end, 10);
+            return errno == 0 && *end == '\0';
+        }
+
+        static std::mutex& mutex() {
+            static std::mutex m;
+            return m;
+        }
+
+        static std::unordered_map<std::string, MergeOperator>& registry() {
+            static std::unordered_map<std::string, MergeOperator> ops = {
+                {"add", [](std::string* value, const std::string& operand) {
+                    long long a = 0, b = 0;
+                    if (!parseInt64(operand, b) || (value != nullptr && !parseInt64(*value, a))) {
+                        return false;
+                    }
+                    if ((b > 0 && a > LLONG_MAX - b) || (b < 0 && a < LLONG_MIN - b)) {
+                        return false;
+                    }
+                    if (value != nullptr) {
+                        *value = std::to_string(a + b);
+                    }
+                    return true;
+                }},
+                {"max", [](std::string* value, const std::string& operand) {
+                    long long a = 0, b = 0;
+                    if (!parseInt64(operand, b) || (value != nullptr && !parseInt64(*value, a))) {
+                        return false;
+                    }
+                    if (value != nullptr && b > a) {
+                        *value = operand;
+                    }
+                    return true;
+                }},
+                {"append", [](std::string* value, const std::string& operand) {
+                    if (value != nullptr) {
+                        value->append(operand);
+                    }
+                    return true;
+                }},
+            };
+            return ops;
+        }
+    };
+
+    // Whether "name" is a known merge operator and "operand" is valid for it.
+    inline bool ValidOperand(const std::string& name, const std::string& operand) {
+        const MergeOperator* op = MergeOperators::Find(name);
+        return op != nullptr && (*op)(nullptr, operand);
+    }
+
+    // Folds the merge operand "operand" onto "value" in place, both of them Values.
+    // An operand "value" combines with "operand" into one operand, only if they use the same operator.
+    // A deleted "value" is taken as no value.
+    // Returns false if they could not be folded, leaving "value" unchanged. Templated so that this header does not need the protos.
+    template <typename V>
+    bool FoldMerge(V& value, const V& operand) {
+        const MergeOperator* op = MergeOperators::Find(operand.merge_op());
+        if (op == nullptr || (value.has_merge_op() && value.merge_op() != operand.merge_op())) {
+            return false;
+        }
+        if (value.is_delete()) {
+            if (!(*op)(nullptr, operand.content())) {
+                return false;
+            }
+            value.set_is_delete(false);
+            value.set_content(operand.content());
+            return true;
+        }
+        return (*op)(value.mutable_content(), operand.content());
+    }
+}
+#endif // AZINO_INCLUDE_MERGE_H
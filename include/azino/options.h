@@ -1,9 +1,29 @@
 #ifndef AZINO_INCLUDE_OPTIONS_H
 #define AZINO_INCLUDE_OPTIONS_H
 
+#include <cstddef>
+
 namespace azino {
     struct Options {
+        // Commit returns once all the intents are written, and commits them in background.
+        bool async_commit = false;
+        // Pessimistic Put and Delete lock in background, a failed lock fails the next Get of the key or Commit.
+        bool pipelined_lock = false;
+        // Reads only at start_ts, writes fail and Commit asks no commit_ts.
+        bool read_only = false;
+        // Writes the buffered intents in background once they exceed this many bytes, 0 disables it.
+        size_t stream_prewrite_bytes = 0;
+        // Gets may hit a process-wide read cache, which needs txindexes run with --change_log_size>0.
+        bool read_cache = false;
+    };
 
+    // How RunInTransaction and DeleteRange retry on write conflicts.
+    struct RetryOptions {
+        // attempts in total, including the first one
+        int max_attempts = 10;
+        // the n-th retry waits a random time below min(max_backoff_ms, base_backoff_ms * 2^n)
+        int base_backoff_ms = 2;
+        int max_backoff_ms = 500;
     };
 
     struct ReadOptions {
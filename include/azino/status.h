@@ -29,6 +29,14 @@ namespace azino {
         Status static StorageErr(const std::string& s = "") {
             return Status(kStorageErr, s);
         }
+        // The tx met a newer version or another tx's lock or intent, it could succeed if retried.
+        Status static ConflictErr(const std::string& s = "") {
+            return Status(kConflictErr, s);
+        }
+        // The value PutIf expects is not the one the tx sees.
+        Status static ConditionFailed(const std::string& s = "") {
+            return Status(kConditionFailed, s);
+        }
         bool IsOk() {
             return _error_code == kOk;
         }
@@ -50,6 +58,12 @@ namespace azino {
         bool IsStorageErr() {
             return _error_code == kStorageErr;
         }
+        bool IsConflictErr() {
+            return _error_code == kConflictErr;
+        }
+        bool IsConditionFailed() {
+            return _error_code == kConditionFailed;
+        }
         std::string ToString() {
             std::stringstream ss;
             std::string code_message;
@@ -75,6 +89,12 @@ namespace azino {
                 case kStorageErr:
                     code_message = "StorageError. ";
                     break;
+                case kConflictErr:
+                    code_message = "ConflictError. ";
+                    break;
+                case kConditionFailed:
+                    code_message = "ConditionFailed. ";
+                    break;
             }
             ss << code_message << _error_message;
             return ss.str();
@@ -87,7 +107,9 @@ namespace azino {
             kIllegalTxOp = 3,
             kTxIndexErr = 4,
             kStorageErr = 5,
-            kNotSupportedErr = 6
+            kNotSupportedErr = 6,
+            kConflictErr = 7,
+            kConditionFailed = 8
         };
         Status(Code c, const std::string& s)
         : _error_code(c),
@@ -0,0 +1,36 @@
+#ifndef AZINO_SDK_INCLUDE_CHANNELCACHE_H
+#define AZINO_SDK_INCLUDE_CHANNELCACHE_H
+
+#include <bthread/mutex.h>
+#include <butil/macros.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+namespace brpc {
+    class Channel;
+}
+
+namespace azino {
+    // Channels to txplanner, txindexes and storage, keyed by address and shared by all the transactions of a process.
+    // Thread safe.
+    class ChannelCache {
+    public:
+        // return the process-wide cache
+        static ChannelCache* Global();
+
+        ChannelCache() = default;
+        DISALLOW_COPY_AND_ASSIGN(ChannelCache);
+        ~ChannelCache() = default;
+
+        // Returns the channel to "addr", initializing it on the first call.
+        // A channel failed to initialize is returned as well but not cached, so that later calls retry.
+        std::shared_ptr<brpc::Channel> Get(const std::string& addr);
+
+    private:
+        bthread::Mutex _mutex;
+        std::unordered_map<std::string, std::shared_ptr<brpc::Channel>> _channels;
+    };
+}
+
+#endif // AZINO_SDK_INCLUDE_CHANNELCACHE_H
@@ -0,0 +1,35 @@
+#ifndef AZINO_SDK_INCLUDE_CONTENTIONTRACKER_H
+#define AZINO_SDK_INCLUDE_CONTENTIONTRACKER_H
+
+#include <bthread/mutex.h>
+#include <butil/macros.h>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+namespace azino {
+    // Keys that txindexes report as contended, shared by all the transactions of a process,
+    // so that kAutomatic writes lock hot keys pessimistically and keep cold keys optimistic.
+    // Thread safe.
+    class ContentionTracker {
+    public:
+        // return the process-wide tracker
+        static ContentionTracker* Global();
+
+        ContentionTracker() = default;
+        DISALLOW_COPY_AND_ASSIGN(ContentionTracker);
+        ~ContentionTracker() = default;
+
+        // Updates "key" with the recent write conflicts and the waiters that a txindex reports on it.
+        void Report(const std::string& key, uint32_t conflicts, uint32_t waiters);
+
+        // Whether "key" has been reported hot within FLAGS_hot_key_ttl_ms.
+        bool IsHot(const std::string& key);
+
+    private:
+        bthread::Mutex _mutex;
+        std::unordered_map<std::string, int64_t> _hot_keys; // key -> when it turns cold, in ms
+    };
+}
+
+#endif // AZINO_SDK_INCLUDE_CONTENTIONTRACKER_H
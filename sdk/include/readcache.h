@@ -0,0 +1,61 @@
+#ifndef AZINO_SDK_INCLUDE_READCACHE_H
+#define AZINO_SDK_INCLUDE_READCACHE_H
+
+#include <bthread/mutex.h>
+#include <butil/macros.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "azino/kv.h"
+
+namespace brpc {
+    class Channel;
+}
+
+namespace azino {
+    class Value;
+
+    // Values read by the transactions of a process, shared by those using Options::read_cache.
+    // An entry is what a tx read at its start_ts, and the txindex vouched as the latest version of the key
+    // as of some change number. It is dropped once the txindex reports the key changed after that number.
+    // A tx only uses an entry after a Changes rpc started after the tx began, so it sees every change
+    // that it could have seen by reading the txindex, and it never uses an entry read after it began.
+    // Concurrent lookups share one Changes rpc per txindex.
+    // Each txindex keeps at most FLAGS_read_cache_capacity keys, the least recently used one is evicted for a new one.
+    // A txindex keeping no change log is never cached for, once it tells so.
+    // Thread safe.
+    class ReadCache {
+    public:
+        // return the process-wide cache
+        static ReadCache* Global();
+
+        ReadCache() = default;
+        DISALLOW_COPY_AND_ASSIGN(ReadCache);
+        ~ReadCache() = default;
+
+        // Fills "value" with what a tx started at "start_ts" reads for "key" on "txindex".
+        // Returns false if it is not cached, or if the changes could not be fetched.
+        bool Get(brpc::Channel* txindex, const std::string& key, TimeStamp start_ts, Value& value);
+
+        // Caches "value" read at "read_ts" for "key" on "txindex", latest as of change "since".
+        void Put(brpc::Channel* txindex, const std::string& key, TimeStamp read_ts, uint64_t since, const Value& value);
+
+        // Returns false once "txindex" is known to keep no change log, so reads need not ask to cache.
+        bool Enabled(brpc::Channel* txindex);
+
+        // Stops caching for "txindex", which keeps no change log.
+        void Disable(brpc::Channel* txindex);
+
+    private:
+        struct Entry;
+        struct Shard;
+        Shard* shard(brpc::Channel* txindex);
+        bool sync(brpc::Channel* txindex, Shard* s, TimeStamp start_ts);
+
+        bthread::Mutex _mutex;
+        std::unordered_map<brpc::Channel*, std::unique_ptr<Shard>> _shards; // one for each txindex
+    };
+}
+
+#endif // AZINO_SDK_INCLUDE_READCACHE_H
@@ -0,0 +1,50 @@
+#ifndef AZINO_SDK_INCLUDE_TIMESTAMPCLIENT_H
+#define AZINO_SDK_INCLUDE_TIMESTAMPCLIENT_H
+
+#include <bthread/condition_variable.h>
+#include <bthread/mutex.h>
+#include <butil/macros.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "azino/status.h"
+
+namespace brpc {
+    class Channel;
+}
+
+namespace azino {
+namespace txplanner {
+    class BeginTxResponse;
+}
+
+    // Begins txs on one txplanner, merging concurrent BeginTx calls of a process into one BatchBeginTx rpc.
+    // Only one rpc is in flight at a time, calls arriving meanwhile are sent together once it returns,
+    // so every start_ts is still allocated after its BeginTx call begins.
+    // Thread safe.
+    class TimestampClient {
+    public:
+        // return the process-wide client of txplanner "addr"
+        static TimestampClient* Global(const std::string& addr);
+
+        TimestampClient(const std::string& addr);
+        DISALLOW_COPY_AND_ASSIGN(TimestampClient);
+        ~TimestampClient() = default;
+
+        // Fills "resp" as BeginTx rpc does.
+        Status BeginTx(txplanner::BeginTxResponse& resp);
+
+    private:
+        struct Waiter;
+        void batchBeginTx(const std::vector<Waiter*>& batch);
+
+        std::shared_ptr<brpc::Channel> _txplanner;
+        bthread::Mutex _mutex;
+        bthread::ConditionVariable _cond;
+        std::vector<Waiter*> _pending;
+        bool _in_flight;
+    };
+}
+
+#endif // AZINO_SDK_INCLUDE_TIMESTAMPCLIENT_H
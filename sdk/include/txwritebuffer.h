@@ -5,47 +5,203 @@
 #include "service/kv.pb.h"
 #include "azino/options.h"
 
+#include <butil/arena.h>
+#include <butil/hash.h>
 #include <butil/macros.h>
-#include <unordered_map>
+#include <butil/strings/string_piece.h>
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <vector>
 
 namespace azino {
+   // Hands out memory of an arena, which is released all at once by the arena rather than one by one.
+   template <typename T>
+   class ArenaAllocator {
+   public:
+       typedef T value_type;
+
+       explicit ArenaAllocator(butil::Arena* arena) : _arena(arena) {}
+       template <typename U>
+       ArenaAllocator(const ArenaAllocator<U>& other) : _arena(other._arena) {}
+
+       T* allocate(size_t n) {
+           return static_cast<T*>(_arena->allocate_aligned(n * sizeof(T)));
+       }
+       void deallocate(T*, size_t) {}
+
+       template <typename U>
+       bool operator==(const ArenaAllocator<U>& other) const { return _arena == other._arena; }
+       template <typename U>
+       bool operator!=(const ArenaAllocator<U>& other) const { return _arena != other._arena; }
+
+   private:
+       template <typename U> friend class ArenaAllocator;
+       butil::Arena* _arena;
+   };
+
+   // Writes of a tx grouped by the txindex each key lives on, and sorted by key in each group,
+   // so that they are sent to the txindexes group by group in the order txindexes latch keys.
+   // Keys and map nodes live in an arena until Clear.
    class TxWriteBuffer {
    public:
        typedef struct Write {
            WriteOptions options;
-           std::shared_ptr<Value> value = nullptr;
-           bool preput = false;
+           std::shared_ptr<Value> value = nullptr; // nullptr once streamed, the intent on the txindex holds it then
+           bool preput = false; // the intent of the latest value is written
+           bool streamed = false; // some intent is written by streaming prewrite or PutIf, to be cleaned on abort
+           bool unstreamed = false; // the key is kept for TakeUnstreamed
        } TxWrite;
+       typedef std::map<butil::StringPiece, TxWrite, std::less<butil::StringPiece>,
+                        ArenaAllocator<std::pair<const butil::StringPiece, TxWrite>>> Shard;
 
-       TxWriteBuffer() = default;
+       // "track_unstreamed" keeps the keys written for TakeUnstreamed.
+       explicit TxWriteBuffer(bool track_unstreamed = false) : _track_unstreamed(track_unstreamed) {}
        DISALLOW_COPY_AND_ASSIGN(TxWriteBuffer);
-       ~TxWriteBuffer() = default;
+       ~TxWriteBuffer() {
+           Clear();
+       }
+
+       // Routes keys to "shard_num" txindexes, should be called when the buffer is empty.
+       void SetShardNum(size_t shard_num) {
+           assert(_size == 0);
+           _shards.clear();
+           for (size_t i = 0; i < shard_num; i++) {
+               _shards.emplace_back(std::less<butil::StringPiece>(), Shard::allocator_type(&_arena));
+           }
+       }
+
+       size_t ShardNum() const {
+           return _shards.size();
+       }
+
+       // The txindex that "key" lives on.
+       size_t ShardOf(const butil::StringPiece& key) const {
+           return butil::Hash(key.data(), key.size()) % _shards.size();
+       }
+
+       // Writes to be sent to txindex "i", sorted by key.
+       Shard& GetShard(size_t i) {
+           return _shards[i];
+       }
 
-       // WriteBuffer will free value later
-       void Write(const UserKey& key, Value* value, const WriteOptions options) {
-           if (_m.find(key) == _m.end()) {
-               _m.insert(std::make_pair(key, TxWrite()));
+       // Returns an empty value to write, reusing the ones freed by Clear if any.
+       std::shared_ptr<Value> NewValue() {
+           if (_free_values.empty()) {
+               return std::make_shared<Value>();
+           }
+           auto value = std::move(_free_values.back());
+           _free_values.pop_back();
+           return value;
+       }
+
+       void Write(const UserKey& key, std::shared_ptr<Value> value, const WriteOptions options) {
+           auto& shard = _shards[ShardOf(key)];
+           auto iter = shard.find(key);
+           if (iter == shard.end()) {
+               char* data = static_cast<char*>(_arena.allocate(key.size()));
+               memcpy(data, key.data(), key.size());
+               iter = shard.insert(std::make_pair(butil::StringPiece(data, key.size()), TxWrite())).first;
+               _size++;
+           }
+           recycle(iter->second.value);
+           iter->second.value = std::move(value);
+           iter->second.preput = false;
+           if (_track_unstreamed && !iter->second.unstreamed) {
+               // a key written many times is kept once
+               iter->second.unstreamed = true;
+               _unstreamed.push_back(iter->first);
            }
-           _m[key].value.reset(value);
            // if op1 write key1 pessimistic, then op2 write key1 optimistic
            // key1 is still write pessimistic
-           _m[key].options.type = std::max(_m[key].options.type, options.type);
+           iter->second.options.type = std::max(iter->second.options.type, options.type);
+       }
+
+       size_t size() const {
+           return _size;
        }
 
-       std::__detail::_Node_iterator<std::pair<const std::basic_string<char>, TxWrite>, false, true> begin() {
-           return _m.begin();
+       // Returns nullptr if "key" is not written.
+       TxWrite* Find(const UserKey& key) {
+           if (_shards.empty()) {
+               return nullptr;
+           }
+           auto& shard = _shards[ShardOf(key)];
+           auto iter = shard.find(key);
+           return iter == shard.end() ? nullptr : &iter->second;
        }
 
-       std::__detail::_Node_iterator<std::pair<const std::basic_string<char>, TxWrite>, false, true> end() {
-           return _m.end();
+       // The memory of "key" is kept until Clear.
+       void Erase(const UserKey& key) {
+           if (_shards.empty()) {
+               return;
+           }
+           auto& shard = _shards[ShardOf(key)];
+           auto iter = shard.find(key);
+           if (iter != shard.end()) {
+               recycle(iter->second.value);
+               shard.erase(iter);
+               _size--;
+           }
        }
 
-       std::__detail::_Node_iterator<std::pair<const std::basic_string<char>, TxWrite>, false, true> find(const UserKey& key) {
-           return _m.find(key);
+       // Returns the keys written since the last call in order, without repeats.
+       // Some of them may have been erased since.
+       std::vector<butil::StringPiece> TakeUnstreamed() {
+           std::vector<butil::StringPiece> keys;
+           keys.swap(_unstreamed);
+           for (auto& key : keys) {
+               auto& shard = _shards[ShardOf(key)];
+               auto iter = shard.find(key);
+               if (iter != shard.end()) {
+                   iter->second.unstreamed = false;
+               }
+           }
+           std::sort(keys.begin(), keys.end());
+           keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+           return keys;
+       }
+
+       // Frees the value of a streamed "write", which is read from its intent later.
+       // It is not kept for later writes, so that streaming bounds the memory of values.
+       void DropValue(TxWrite& write) {
+           write.value.reset();
+       }
+
+       // Removes all the writes, keeping the values for later writes.
+       void Clear() {
+           for (auto& shard : _shards) {
+               for (auto& it : shard) {
+                   recycle(it.second.value);
+               }
+               shard.clear();
+           }
+           _size = 0;
+           _unstreamed.clear();
+           _arena.clear();
        }
 
    private:
-       std::unordered_map<UserKey, TxWrite> _m;
+       void recycle(std::shared_ptr<Value>& value) {
+           // values still referenced by others are left to them
+           if (value && value.use_count() == 1 && _free_values.size() < kMaxFreeValues) {
+               value->Clear();
+               _free_values.push_back(std::move(value));
+           }
+           value.reset();
+       }
+
+       static const size_t kMaxFreeValues = 1024;
+
+       butil::Arena _arena;
+       std::vector<Shard> _shards;
+       size_t _size = 0;
+       bool _track_unstreamed;
+       std::vector<butil::StringPiece> _unstreamed; // point to the arena
+       std::vector<std::shared_ptr<Value>> _free_values;
    };
 }
 #endif // AZINO_SDK_INCLUDE_TXWRITEBUFFER_H
@@ -0,0 +1,42 @@
+#include <brpc/channel.h>
+#include <gflags/gflags.h>
+
+#include "channelcache.h"
+
+namespace azino {
+
+DEFINE_int32(timeout_ms, -1, "RPC timeout in milliseconds");
+DEFINE_int32(max_retry, 2, "Max retries(not including the first RPC)");
+DEFINE_string(connection_type, "single", "Connection type of the channels shared by transactions: single, pooled or short");
+
+    ChannelCache* ChannelCache::Global() {
+        static ChannelCache* cache = new ChannelCache;
+        return cache;
+    }
+
+    std::shared_ptr<brpc::Channel> ChannelCache::Get(const std::string& addr) {
+        {
+            std::lock_guard<bthread::Mutex> lck(_mutex);
+            auto iter = _channels.find(addr);
+            if (iter != _channels.end()) {
+                return iter->second;
+            }
+        }
+
+        // init outside the lock, as it may resolve addresses
+        brpc::ChannelOptions options;
+        options.timeout_ms = FLAGS_timeout_ms;
+        options.max_retry = FLAGS_max_retry;
+        options.connection_type = FLAGS_connection_type;
+        std::shared_ptr<brpc::Channel> channel(new brpc::Channel());
+        if (channel->Init(addr.c_str(), &options) != 0) {
+            LOG(ERROR) << "Fail to initialize channel: " << addr;
+            return channel;
+        }
+        LOG(INFO) << "Initialize channel: " << addr << " connection type: " << FLAGS_connection_type;
+
+        std::lock_guard<bthread::Mutex> lck(_mutex);
+        // keep the one inited by others if any, so that all the transactions share one channel
+        return _channels.insert(std::make_pair(addr, channel)).first->second;
+    }
+}
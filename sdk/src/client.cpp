@@ -1,7 +1,21 @@
 #include <brpc/channel.h>
+#include <brpc/callback.h>
+#include <bthread/bthread.h>
+#include <bthread/countdown_event.h>
+#include <bthread/mutex.h>
+#include <butil/fast_rand.h>
 #include <butil/hash.h>
+#include <butil/time.h>
+#include <bvar/bvar.h>
+#include <atomic>
+#include <map>
 
 #include "azino/client.h"
+#include "azino/merge.h"
+#include "channelcache.h"
+#include "contentiontracker.h"
+#include "readcache.h"
+#include "timestampclient.h"
 #include "txwritebuffer.h"
 #include "service/tx.pb.h"
 #include "service/txplanner/txplanner.pb.h"
@@ -10,46 +24,531 @@
 
 namespace azino {
 
-DEFINE_int32(timeout_ms, -1, "RPC timeout in milliseconds");
-DEFINE_int32(max_retry, 2, "Max retries(not including the first RPC)");
+DEFINE_int32(async_commit_max_keys, 256, "Max keys of a tx to commit in async-commit mode");
+DEFINE_int32(scan_batch_size, 1024, "Max keys read from each server in one round of Scan");
+DEFINE_int32(commit_batch_size, 1024, "Max keys committed or cleaned in one rpc to a txindex when a tx finishes its intents");
+
+namespace {
+    // exported by RunInTransaction
+    bvar::Adder<int64_t> g_retries("azino_tx_retry_count");
+    bvar::Adder<int64_t> g_conflict_aborts("azino_tx_conflict_abort_count");
+
+    // Where txs spend their time, by phase and by server, so that a slow tx could be told apart by what it waits for.
+    // A LatencyRecorder "x" is exported as x_latency, x_latency_99, x_qps, x_count and so on.
+    bvar::LatencyRecorder g_begin_latency("azino_tx_begin");
+    bvar::LatencyRecorder g_read_latency("azino_tx_read"); // Get, MultiGet and Scan
+    bvar::LatencyRecorder g_lock_latency("azino_tx_lock"); // pessimistic locks, waited at once or when pipelined
+    bvar::LatencyRecorder g_prewrite_latency("azino_tx_prewrite"); // writing intents, at commit or streamed
+    bvar::LatencyRecorder g_commit_latency("azino_tx_commit"); // the whole Commit, prewrite included
+    bvar::LatencyRecorder g_abort_latency("azino_tx_abort"); // cleaning intents and locks
+    bvar::LatencyRecorder g_batch_commit_latency("azino_tx_batch_commit"); // the whole CommitBatch
+    // recorded once a tx is reset or destroyed
+    bvar::IntRecorder g_tx_rpcs("azino_tx_rpc_count_per_tx");
+    bvar::IntRecorder g_tx_rpc_bytes("azino_tx_rpc_bytes_per_tx");
+
+    struct RpcRecorder {
+        explicit RpcRecorder(const std::string& prefix) : latency(prefix), bytes(prefix + "_bytes") {}
+        bvar::LatencyRecorder latency;
+        bvar::Adder<int64_t> bytes; // sent and received, attachments included
+    };
+    RpcRecorder g_txplanner_rpc("azino_tx_txplanner_rpc");
+    RpcRecorder g_txindex_rpc("azino_tx_txindex_rpc");
+    RpcRecorder g_storage_rpc("azino_tx_storage_rpc");
+
+    // Records an rpc that has finished, and returns the bytes it sent and received.
+    int64_t RecordRpc(RpcRecorder& server, const brpc::Controller& cntl,
+                      const google::protobuf::Message& req, const google::protobuf::Message& resp) {
+        int64_t bytes = req.ByteSizeLong() + resp.ByteSizeLong()
+                + cntl.request_attachment().size() + cntl.response_attachment().size();
+        server.latency << cntl.latency_us();
+        server.bytes << bytes;
+        return bytes;
+    }
+
+    // Records the time till the end of the scope as the latency of a phase.
+    struct PhaseTimer {
+        explicit PhaseTimer(bvar::LatencyRecorder& r) : recorder(r) {
+            timer.start();
+        }
+        ~PhaseTimer() {
+            timer.stop();
+            recorder << timer.u_elapsed();
+        }
+        bvar::LatencyRecorder& recorder;
+        butil::Timer timer;
+    };
+
+    // A BatchWriteIntent rpc issued by Transaction::PreputAll to one txindex, alive until its done closure has run.
+    struct PreputCall {
+        std::vector<std::shared_ptr<Value>> values; // the values sent in the same order, outliving cntl
+        brpc::Controller cntl;
+        azino::txindex::BatchWriteIntentRequest req;
+        azino::txindex::BatchWriteIntentResponse resp;
+        std::vector<TxWriteBuffer::TxWrite*> writes; // in the same order as req.datas
+    };
+
+    // A MultiTxFinish rpc issued by Transaction::CommitAll or AbortAll, finishing a batch of the keys on one txindex.
+    struct FinishKeysCall {
+        brpc::Controller cntl;
+        azino::txindex::MultiTxFinishRequest req;
+        azino::txindex::MultiTxFinishResponse resp;
+        size_t txindex_num;
+        std::vector<TxWriteBuffer::TxWrite*> writes; // in the same order as req.cleans
+    };
+
+    // A BatchRead rpc issued by Transaction::MultiGet to one txindex.
+    struct BatchReadCall {
+        brpc::Controller cntl;
+        azino::txindex::BatchReadRequest req;
+        azino::txindex::BatchReadResponse resp;
+        std::vector<size_t> idxs; // where req.keys are in MultiGet's keys
+    };
+
+    struct ScanCall {
+        brpc::Controller cntl;
+        azino::txindex::ScanRequest req;
+        azino::txindex::ScanResponse resp;
+    };
+
+    // The state of one key met by Scan, later sources override earlier ones.
+    struct ScanEntry {
+        enum { Live, Deleted, Blocked } state;
+        UserValue value;
+    };
+
+    // The contents lent to rpc attachments are kept by the calls sending them, see FillIntentData.
+    void KeepLentValue(void*) {}
+
+    // Fills "data" with "key" and "value", whose content is referred by "attachment" rather than copied.
+    // "value" is added to "values", which should be kept till the controller owning "attachment" is destroyed.
+    void FillIntentData(const butil::StringPiece& key, const std::shared_ptr<Value>& value,
+                        azino::txindex::IntentData* data, butil::IOBuf& attachment,
+                        std::vector<std::shared_ptr<Value>>& values) {
+        values.push_back(value);
+        data->set_key(key.data(), key.size());
+        data->mutable_value()->set_is_delete(value->is_delete());
+        if (value->has_merge_op()) {
+            data->mutable_value()->set_merge_op(value->merge_op());
+        }
+        const auto& content = value->content();
+        if (content.empty()) {
+            return;
+        }
+        data->set_attachment_size(content.size());
+        attachment.append_user_data(const_cast<char*>(content.data()), content.size(), KeepLentValue);
+    }
+
+    // Reads the value merge operands of "key" fold onto, which storage has at "ts".
+    // A key storage does not have is read as a deleted value.
+    Status ReadMergeBase(brpc::Channel* storage, const UserKey& key, TimeStamp ts, Value& base) {
+        std::stringstream ss;
+        azino::storage::StorageService_Stub stub(storage);
+        brpc::Controller cntl;
+        azino::storage::MVCCGetRequest req;
+        req.set_key(key);
+        req.set_ts(ts);
+        azino::storage::MVCCGetResponse resp;
+        stub.MVCCGet(&cntl, &req, &resp, nullptr);
+        RecordRpc(g_storage_rpc, cntl, req, resp);
+        if (cntl.Failed()) {
+            ss << "Controller failed error code: " << cntl.ErrorCode() << " error text: " << cntl.ErrorText();
+            LOG(WARNING) << ss.str();
+            return Status::NetworkErr(ss.str());
+        }
+        ss << "sdk: " << cntl.local_side() << " Read merge base from storage: " << cntl.remote_side() << std::endl
+           << "request: " << req.ShortDebugString() << std::endl
+           << "response: " << resp.ShortDebugString() << std::endl
+           << "latency=" << cntl.latency_us() << "us";
+        switch (resp.status().error_code()) {
+            case storage::StorageStatus_Code_Ok:
+                ss << " success. ";
+                LOG(INFO) << ss.str();
+                base.set_content(std::move(*resp.mutable_value()));
+                return Status::Ok(ss.str());
+            case storage::StorageStatus_Code_NotFound:
+                ss << " success. ";
+                LOG(INFO) << ss.str();
+                base.set_is_delete(true);
+                return Status::Ok(ss.str());
+            default:
+                ss << " fail. ";
+                LOG(ERROR) << ss.str();
+                return Status::StorageErr(ss.str());
+        }
+    }
+
+    void ReportContention(const azino::txindex::KeyContention& contention) {
+        ContentionTracker::Global()->Report(contention.key(), contention.conflicts(), contention.waiters());
+    }
+
+    Status WriteLockResult(brpc::Controller& cntl, const azino::txindex::WriteLockRequest& req,
+                           const azino::txindex::WriteLockResponse& resp) {
+        std::stringstream ss;
+        if (cntl.Failed()) {
+            ss << "Controller failed error code: " << cntl.ErrorCode() << " error text: " << cntl.ErrorText();
+            LOG(WARNING) << ss.str();
+            return Status::NetworkErr(ss.str());
+        }
+        if (resp.has_contention()) {
+            ReportContention(resp.contention());
+        }
+        ss << "sdk: " << cntl.local_side() << " WriteLock from txindex: " << cntl.remote_side() << std::endl
+           << "request: " << req.ShortDebugString() << std::endl
+           << "response: " << resp.ShortDebugString() << std::endl
+           << "latency=" << cntl.latency_us() << "us";
+        switch (resp.tx_op_status().error_code()) {
+            case TxOpStatus_Code_Ok:
+                ss << " success. ";
+                LOG(INFO) << ss.str();
+                return Status::Ok(ss.str());
+            case TxOpStatus_Code_WriteTooLate:
+                // todo: fail to lock, may use some optimistic approach
+                ss << " fail. ";
+                LOG(INFO) << ss.str();
+                return Status::ConflictErr(ss.str());
+            default:
+                ss << " fail. ";
+                LOG(ERROR) << ss.str();
+                return Status::TxIndexErr(ss.str());
+        }
+    }
+
+    void* RunFunction(void* arg) {
+        std::unique_ptr<std::function<void()>> func(static_cast<std::function<void()>*>(arg));
+        (*func)();
+        return nullptr;
+    }
+
+    // Runs "func" in a background bthread, or in place if no bthread could be started.
+    void StartBackground(std::function<void()> func) {
+        auto* arg = new std::function<void()>(std::move(func));
+        bthread_t tid;
+        if (bthread_start_background(&tid, nullptr, RunFunction, arg) != 0) {
+            LOG(WARNING) << "Fail to start bthread, run in place.";
+            RunFunction(arg);
+        }
+    }
+
+    void SignalEvent(bthread::CountdownEvent* event) {
+        event->signal();
+    }
+
+    // Sleeps before the "attempt"-th retry, with full jitter on an exponentially growing cap.
+    void Backoff(const RetryOptions& retry_options, int attempt) {
+        int64_t cap_ms = retry_options.max_backoff_ms;
+        if (attempt < 31 && ((int64_t)retry_options.base_backoff_ms << (attempt - 1)) < cap_ms) {
+            cap_ms = (int64_t)retry_options.base_backoff_ms << (attempt - 1);
+        }
+        bthread_usleep(butil::fast_rand_less_than(cap_ms * 1000 + 1));
+    }
+
+    // Commits, or cleans if not "committed", the intents of "keys" written by async-commit tx "txid",
+    // once the tx is decided on its primary key. Intents missing are resolved by someone else already then,
+    // as the primary is decided only after all of them are written.
+    Status ResolveIntents(const TxIdentifier& txid, const std::vector<std::shared_ptr<brpc::Channel>>& txindexs,
+                          const std::vector<UserKey>& keys, bool committed) {
+        struct ResolveCall {
+            brpc::Controller cntl;
+            azino::txindex::CommitRequest commit_req;
+            azino::txindex::CommitResponse commit_resp;
+            azino::txindex::CleanRequest clean_req;
+            azino::txindex::CleanResponse clean_resp;
+            const google::protobuf::Message* req; // the one sent of the two above
+            const google::protobuf::Message* resp;
+        };
+        std::vector<std::unique_ptr<ResolveCall>> calls;
+        bthread::CountdownEvent event(keys.size());
+        for (auto& key : keys) {
+            auto txindex_num = butil::Hash(key) % txindexs.size();
+            azino::txindex::TxOpService_Stub stub(txindexs[txindex_num].get());
+            auto* call = new ResolveCall;
+            calls.emplace_back(call);
+            if (committed) {
+                call->commit_req.set_allocated_txid(new TxIdentifier(txid));
+                call->commit_req.set_key(key);
+                call->req = &call->commit_req;
+                call->resp = &call->commit_resp;
+                stub.Commit(&call->cntl, &call->commit_req, &call->commit_resp, brpc::NewCallback(SignalEvent, &event));
+            } else {
+                call->clean_req.set_allocated_txid(new TxIdentifier(txid));
+                call->clean_req.set_key(key);
+                call->req = &call->clean_req;
+                call->resp = &call->clean_resp;
+                stub.Clean(&call->cntl, &call->clean_req, &call->clean_resp, brpc::NewCallback(SignalEvent, &event));
+            }
+        }
+        event.wait();
+
+        Status sts = Status::Ok();
+        for (auto& call : calls) {
+            RecordRpc(g_txindex_rpc, call->cntl, *call->req, *call->resp);
+            std::stringstream ss;
+            if (call->cntl.Failed()) {
+                ss << "Controller failed error code: " << call->cntl.ErrorCode() << " error text: " << call->cntl.ErrorText();
+                LOG(WARNING) << ss.str();
+                if (sts.IsOk()) {
+                    sts = Status::NetworkErr(ss.str());
+                }
+                continue;
+            }
+            ss << "sdk: " << call->cntl.local_side() << (committed ? " Commit" : " Clean") << " from txindex: " << call->cntl.remote_side() << std::endl
+               << "request: " << call->req->ShortDebugString() << std::endl
+               << "response: " << call->resp->ShortDebugString() << std::endl
+               << "latency=" << call->cntl.latency_us() << "us";
+            auto code = committed ? call->commit_resp.tx_op_status().error_code() : call->clean_resp.tx_op_status().error_code();
+            switch (code) {
+                case TxOpStatus_Code_Ok:
+                    ss << " success. ";
+                    LOG(INFO) << ss.str();
+                    break;
+                case TxOpStatus_Code_CommitNotExist:
+                case TxOpStatus_Code_CleanNotExist:
+                    ss << " skip. ";
+                    LOG(INFO) << ss.str();
+                    break;
+                default:
+                    ss << " fail. ";
+                    LOG(ERROR) << ss.str();
+                    if (sts.IsOk()) {
+                        sts = Status::TxIndexErr(ss.str());
+                    }
+            }
+        }
+        return sts;
+    }
+
+    // Decides async-commit tx "txid" on its primary key "primary", by committing its primary intent,
+    // or cleaning it if "abort". "code" gets what the txindex answers: Ok when decided so now or before,
+    // TxAborted or TxCommitted when it has been decided the other way, or CommitNotExist or CleanNotExist
+    // when the primary intent is not there, so the outcome is unknown.
+    Status DecidePrimary(const TxIdentifier& txid, const std::vector<std::shared_ptr<brpc::Channel>>& txindexs,
+                         const UserKey& primary, bool abort, TxOpStatus_Code& code) {
+        std::stringstream ss;
+        azino::txindex::TxOpService_Stub stub(txindexs[butil::Hash(primary) % txindexs.size()].get());
+        brpc::Controller cntl;
+        azino::txindex::CommitRequest commit_req;
+        azino::txindex::CommitResponse commit_resp;
+        azino::txindex::CleanRequest clean_req;
+        azino::txindex::CleanResponse clean_resp;
+        if (abort) {
+            clean_req.set_allocated_txid(new TxIdentifier(txid));
+            clean_req.set_key(primary);
+            stub.Clean(&cntl, &clean_req, &clean_resp, nullptr);
+            RecordRpc(g_txindex_rpc, cntl, clean_req, clean_resp);
+        } else {
+            commit_req.set_allocated_txid(new TxIdentifier(txid));
+            commit_req.set_key(primary);
+            stub.Commit(&cntl, &commit_req, &commit_resp, nullptr);
+            RecordRpc(g_txindex_rpc, cntl, commit_req, commit_resp);
+        }
+        if (cntl.Failed()) {
+            ss << "Controller failed error code: " << cntl.ErrorCode() << " error text: " << cntl.ErrorText();
+            LOG(WARNING) << ss.str();
+            return Status::NetworkErr(ss.str());
+        }
+        code = abort ? clean_resp.tx_op_status().error_code() : commit_resp.tx_op_status().error_code();
+        ss << "sdk: " << cntl.local_side() << (abort ? " Clean" : " Commit") << " primary from txindex: " << cntl.remote_side() << std::endl
+           << "request: " << (abort ? clean_req.ShortDebugString() : commit_req.ShortDebugString()) << std::endl
+           << "response: " << (abort ? clean_resp.ShortDebugString() : commit_resp.ShortDebugString()) << std::endl
+           << "latency=" << cntl.latency_us() << "us";
+        ss << (code == TxOpStatus_Code_Ok ? " success. " : " fail. ");
+        LOG(INFO) << ss.str();
+        return Status::Ok(ss.str());
+    }
+
+    // Drops the outcome kept on primary key "primary" once all the other keys of "txid" are resolved.
+    void ForgetAsyncCommit(const TxIdentifier& txid, const std::vector<std::shared_ptr<brpc::Channel>>& txindexs,
+                           const UserKey& primary) {
+        azino::txindex::TxOpService_Stub stub(txindexs[butil::Hash(primary) % txindexs.size()].get());
+        brpc::Controller cntl;
+        azino::txindex::ForgetAsyncCommitRequest req;
+        req.set_allocated_txid(new TxIdentifier(txid));
+        req.set_key(primary);
+        azino::txindex::ForgetAsyncCommitResponse resp;
+        stub.ForgetAsyncCommit(&cntl, &req, &resp, nullptr);
+        RecordRpc(g_txindex_rpc, cntl, req, resp);
+        if (cntl.Failed()) {
+            // the outcome is left on the primary, which is harmless
+            LOG(WARNING) << "Controller failed error code: " << cntl.ErrorCode() << " error text: " << cntl.ErrorText();
+        }
+    }
+
+    // The second half of an async-commit tx, run in background after Transaction::Commit returned.
+    struct AsyncCommitTask {
+        TxIdentifier txid;
+        std::vector<std::shared_ptr<brpc::Channel>> txindexs;
+        UserKey primary;
+        std::vector<UserKey> keys; // the others
+    };
+
+    void* RunAsyncCommit(void* arg) {
+        std::unique_ptr<AsyncCommitTask> task(static_cast<AsyncCommitTask*>(arg));
+        // the primary goes first, so that readers meeting the others never see the tx undecided after it
+        TxOpStatus_Code code = TxOpStatus_Code_Ok;
+        Status sts = DecidePrimary(task->txid, task->txindexs, task->primary, false, code);
+        if (sts.IsOk() && code != TxOpStatus_Code_Ok) {
+            sts = Status::TxIndexErr("Fail to commit primary key: " + task->primary);
+        }
+        if (sts.IsOk()) {
+            sts = ResolveIntents(task->txid, task->txindexs, task->keys, true);
+        }
+        if (sts.IsOk()) {
+            ForgetAsyncCommit(task->txid, task->txindexs, task->primary);
+        } else {
+            // intents left are committed by the readers meeting them
+            LOG(WARNING) << "Async commit fail. " << task->txid.ShortDebugString() << " " << sts.ToString();
+        }
+        return nullptr;
+    }
+}
+
+    // A read of one key by ReadCommitted or AsyncGet, from its txindex and then from storage if the txindex
+    // has nothing visible, moved along by the done closures of its rpcs. "done" is called with the result.
+    struct Transaction::ReadCall {
+        ReadCall(const UserKey& k, UserValue* v) : key(k), value(v) {}
+        UserKey key;
+        UserValue* value;
+        StatusCallback done;
+        std::unique_ptr<PhaseTimer> timer; // set if it is deleted once done, by AsyncGet
+        brpc::Controller cntl;
+        azino::txindex::ReadRequest req;
+        azino::txindex::ReadResponse resp;
+        brpc::Controller storage_cntl;
+        azino::storage::MVCCGetRequest storage_req;
+        azino::storage::MVCCGetResponse storage_resp;
+        // set if the txindex vouches for what is read, which is then cached
+        bool cacheable = false;
+        uint64_t cache_since = 0;
+    };
+
+    // The rpcs of a Commit or AsyncCommit to get the commit_ts, then to commit in one phase if it could.
+    struct Transaction::CommitCall {
+        std::unique_ptr<PhaseTimer> timer; // of an AsyncCommit, which deletes it once done
+        std::unique_ptr<PhaseTimer> prewrite_timer;
+        StatusCallback done;
+        brpc::Controller cntl;
+        azino::txplanner::CommitTxRequest req;
+        azino::txplanner::CommitTxResponse resp;
+        size_t txindex_num = 0; // the only one written if one_phase
+        bool one_phase = false;
+        bool async_commit = false;
+        std::vector<std::shared_ptr<Value>> one_phase_values; // sent by one_phase_cntl, outliving it
+        brpc::Controller one_phase_cntl;
+        azino::txindex::OnePhaseCommitRequest one_phase_req;
+        azino::txindex::OnePhaseCommitResponse one_phase_resp;
+    };
 
     Transaction::Transaction(const Options& options, const std::string& txplanner_addr)
     : _options(new Options(options)),
-      _channel_options(new brpc::ChannelOptions),
+      _txplanner(ChannelCache::Global()->Get(txplanner_addr)),
+      _timestamp_client(TimestampClient::Global(txplanner_addr)),
       _txid(nullptr),
-      _txwritebuffer(new TxWriteBuffer) {
-        _channel_options->timeout_ms = FLAGS_timeout_ms;
-        _channel_options->max_retry = FLAGS_max_retry;
+      _txwritebuffer(new TxWriteBuffer(options.stream_prewrite_bytes > 0)),
+      _unstreamed_bytes(0),
+      _streamed(false),
+      _stream_sts(Status::Ok()),
+      _merged(false),
+      _read_mutex(new bthread::Mutex),
+      _rpc_count(0),
+      _rpc_bytes(0) {}
+
+    // A WriteLock rpc issued in pipelined lock mode, alive until its done closure has run.
+    struct Transaction::PendingLock {
+        PendingLock() : event(1), recorded(false) {}
+        brpc::Controller cntl;
+        azino::txindex::WriteLockRequest req;
+        azino::txindex::WriteLockResponse resp;
+        bthread::CountdownEvent event;
+        std::atomic<bool> recorded; // by the first WaitLock
+    };
+
+    // The BatchWriteIntent rpcs of one round of streaming prewrite, one for each txindex written.
+    struct Transaction::StreamBatch {
+        explicit StreamBatch(int n) : event(n) {}
+        std::vector<std::unique_ptr<PreputCall>> calls;
+        bthread::CountdownEvent event;
+    };
 
-        auto* channel = new brpc::Channel();
-        if (channel->Init(txplanner_addr.c_str(), _channel_options.get()) != 0) {
-            LOG(ERROR) << "Fail to initialize channel: " << txplanner_addr;
+    // The reads issued by one Prefetch, a BatchRead to each txindex these keys live on, then a MultiGet to storage
+    // of the keys that no txindex has a visible version of.
+    struct Transaction::PrefetchBatch {
+        std::vector<std::unique_ptr<BatchReadCall>> calls;
+        std::vector<std::pair<size_t, int>> positions; // where each key is in calls and their keys
+        std::vector<int> storage_positions; // where each key is in storage_req, -1 if it is not read from storage
+        std::shared_ptr<brpc::Channel> storage;
+        brpc::Controller storage_cntl;
+        azino::storage::MVCCMultiGetRequest storage_req;
+        azino::storage::MVCCMultiGetResponse storage_resp;
+        std::atomic<int> pending{0}; // BatchReads in flight
+        bthread::CountdownEvent event{1}; // signaled once all the reads are done
+        std::atomic<bool> recorded{false}; // once the event is waited
+
+        // The done closure of each BatchRead, the last one reads storage.
+        void OnBatchRead() {
+            if (pending.fetch_sub(1) != 1) {
+                return;
+            }
+            for (auto& pos : positions) {
+                auto* call = calls[pos.first].get();
+                bool not_exist = !call->cntl.Failed() && call->resp.tx_op_statuses_size() == call->req.keys_size()
+                        && call->resp.tx_op_statuses(pos.second).error_code() == TxOpStatus_Code_ReadNotExist;
+                storage_positions.push_back(not_exist ? storage_req.keys_size() : -1);
+                if (not_exist) {
+                    storage_req.add_keys(call->req.keys(pos.second));
+                }
+            }
+            if (storage_req.keys_size() == 0) {
+                event.signal();
+                return;
+            }
+            azino::storage::StorageService_Stub storage_stub(storage.get());
+            storage_stub.MVCCMultiGet(&storage_cntl, &storage_req, &storage_resp, brpc::NewCallback(SignalEvent, &event));
         }
-        _txplanner.reset(channel);
-    }
 
-    Transaction::~Transaction() = default;
+        // Waits all the reads, and records them into "tx" the first time.
+        void Wait(Transaction* tx) {
+            event.wait();
+            if (recorded.exchange(true)) {
+                return;
+            }
+            for (auto& call : calls) {
+                if (call) {
+                    tx->CountRpc(RecordRpc(g_txindex_rpc, call->cntl, call->req, call->resp));
+                }
+            }
+            if (storage_req.keys_size() > 0) {
+                tx->CountRpc(RecordRpc(g_storage_rpc, storage_cntl, storage_req, storage_resp));
+            }
+        }
+    };
+
+    Transaction::~Transaction() {
+        for (auto& it : _pending_locks) {
+            it.second->event.wait();
+        }
+        if (_stream) {
+            _stream->event.wait();
+        }
+        for (auto& batch : _prefetches) {
+            batch->Wait(this);
+        }
+        RecordTxStats();
+    }
 
     Status Transaction::Begin() {
+        PhaseTimer timer(g_begin_latency);
         std::stringstream ss;
         if (_txid) {
             ss << "Transaction has already began. " << _txid->ShortDebugString();
             return Status::IllegalTxOp(ss.str());
         }
-        azino::txplanner::TxService_Stub stub(_txplanner.get());
-        brpc::Controller cntl;
-        azino::txplanner::BeginTxRequest req;
+        // concurrent Begins of this process share one rpc
         azino::txplanner::BeginTxResponse resp;
-        stub.BeginTx(&cntl, &req, &resp, nullptr);
-        if (cntl.Failed()) {
-            ss << "Controller failed error code: " << cntl.ErrorCode() << " error text: " << cntl.ErrorText();
-            LOG(WARNING) << ss.str();
-            return Status::NetworkErr(ss.str());
+        Status sts = _timestamp_client->BeginTx(resp);
+        if (!sts.IsOk()) {
+            return sts;
         }
-        ss << "sdk: " << cntl.local_side() << " BeginTx from txplanner: " << cntl.remote_side() << std::endl
-           << "request: " << req.ShortDebugString() << std::endl
-           << "response: " << resp.ShortDebugString() << std::endl
-           << "latency=" << cntl.latency_us() << "us";
+        ss << "sdk: BeginTx response: " << resp.ShortDebugString();
         if (!resp.has_storage_addr() || resp.txindex_addrs_size() == 0) {
             ss << " fail. ";
             LOG(WARNING) << ss.str();
@@ -61,25 +560,19 @@ DEFINE_int32(max_retry, 2, "Max retries(not including the first RPC)");
         _txid.reset(resp.release_txid());
         assert(_txid->status().status_code() == TxStatus_Code_Started);
 
-        auto* channel = new brpc::Channel();
-        if (channel->Init(resp.storage_addr().c_str(), _channel_options.get()) != 0) {
-            LOG(ERROR) << "Fail to initialize channel: " << resp.storage_addr();
-        }
-        _storage.reset(channel);
-
+        _storage = ChannelCache::Global()->Get(resp.storage_addr());
+        _txindexs.clear();
         for (int i = 0; i < resp.txindex_addrs_size(); i++) {
-            auto* txindex_channel = new brpc::Channel();
-            if (txindex_channel->Init(resp.txindex_addrs(i).c_str(), _channel_options.get()) != 0) {
-                LOG(ERROR) << "Fail to initialize channel: " << resp.txindex_addrs(i);
-            }
-            _txindexs.emplace_back(txindex_channel);
+            _txindexs.push_back(ChannelCache::Global()->Get(resp.txindex_addrs(i)));
         }
+        _txwritebuffer->SetShardNum(_txindexs.size());
 
         return Status::Ok(ss.str());
     }
 
-    Status Transaction::Commit() {
+    Status Transaction::BeginCommit(CommitCall* call, bool& proceed) {
         std::stringstream ss;
+        proceed = false;
         if (!_txid) {
             ss << "Transaction has not began. ";
             return Status::IllegalTxOp(ss.str());
@@ -89,30 +582,202 @@ DEFINE_int32(max_retry, 2, "Max retries(not including the first RPC)");
             return Status::IllegalTxOp(ss.str());
         }
 
-        azino::txplanner::TxService_Stub stub(_txplanner.get());
-        brpc::Controller cntl;
-        azino::txplanner::CommitTxRequest req;
-        req.set_allocated_txid(new TxIdentifier(*_txid));
-        azino::txplanner::CommitTxResponse resp;
-        stub.CommitTx(&cntl, &req, &resp, nullptr);
-        if (cntl.Failed()) {
-            ss << "Controller failed error code: " << cntl.ErrorCode() << " error text: " << cntl.ErrorText();
+        // a read-only tx has nothing to commit, its reads are all at start_ts
+        if (_options->read_only) {
+            _txid->mutable_status()->set_status_code(TxStatus_Code_Committed);
+            ss << "Read-only transaction committed. " << _txid->ShortDebugString();
+            return Status::Ok(ss.str());
+        }
+
+        // all the streamed intents should be written and the pipelined locks held before committing
+        Status stream_sts = WaitStream();
+        Status lock_sts = WaitLocks();
+        if (!stream_sts.IsOk()) {
+            lock_sts = stream_sts;
+        }
+        if (!lock_sts.IsOk()) {
+            auto* txid_sts = _txid->mutable_status();
+            txid_sts->set_status_code(TxStatus_Code_Aborting);
+            Status abort_sts = AbortAll();
+            if (abort_sts.IsOk()) {
+                txid_sts->set_status_code(TxStatus_Code_Aborted);
+                txid_sts->set_status_message(lock_sts.ToString());
+                return lock_sts;
+            } else {
+                txid_sts->set_status_code(TxStatus_Code_Abnormal);
+                txid_sts->set_status_message(abort_sts.ToString());
+                return abort_sts;
+            }
+        }
+
+        call->req.set_allocated_txid(new TxIdentifier(*_txid));
+        proceed = true;
+        return Status::Ok();
+    }
+
+    Status Transaction::CommitTxResult(CommitCall* call) {
+        std::stringstream ss;
+        CountRpc(RecordRpc(g_txplanner_rpc, call->cntl, call->req, call->resp));
+        if (call->cntl.Failed()) {
+            ss << "Controller failed error code: " << call->cntl.ErrorCode() << " error text: " << call->cntl.ErrorText();
             LOG(WARNING) << ss.str();
             return Status::NetworkErr(ss.str());
         }
-        ss << "sdk: " << cntl.local_side() << " CommitTx from txplanner: " << cntl.remote_side() << std::endl
-           << "request: " << req.ShortDebugString() << std::endl
-           << "response: " << resp.ShortDebugString() << std::endl
-           << "latency=" << cntl.latency_us() << "us";
+        ss << "sdk: " << call->cntl.local_side() << " CommitTx from txplanner: " << call->cntl.remote_side() << std::endl
+           << "request: " << call->req.ShortDebugString() << std::endl
+           << "response: " << call->resp.ShortDebugString() << std::endl
+           << "latency=" << call->cntl.latency_us() << "us";
         ss << " success. ";
         LOG(INFO) << ss.str();
 
-        _txid.reset(resp.release_txid());
-        auto* txid_sts = _txid->release_status();
-        _txid->set_allocated_status(txid_sts);
+        _txid.reset(call->resp.release_txid());
+
+        // A tx whose keys all live on one txindex is committed by that txindex in one rpc.
+        size_t written_txindexs = 0;
+        for (size_t i = 0; i < _txwritebuffer->ShardNum(); i++) {
+            if (!_txwritebuffer->GetShard(i).empty()) {
+                call->txindex_num = i;
+                written_txindexs++;
+            }
+        }
+        // Streamed intents are left on the txindexes, so they have to be committed in two phases.
+        // Intents of PutIf keep their values here, and are replaced by the one phase commit as any value of the tx.
+        call->one_phase = !_streamed && written_txindexs == 1;
+        // In async-commit mode the tx is committed once all its intents are written.
+        call->async_commit = !call->one_phase && !_streamed && !_merged && _options->async_commit && _txwritebuffer->size() > 0
+                && _txwritebuffer->size() <= (size_t)FLAGS_async_commit_max_keys;
+        return Status::Ok(ss.str());
+    }
+
+    Status Transaction::Commit() {
+        PhaseTimer timer(g_commit_latency);
+        CommitCall call;
+        bool proceed = false;
+        Status sts = BeginCommit(&call, proceed);
+        if (!proceed) {
+            return sts;
+        }
+        azino::txplanner::TxService_Stub stub(_txplanner.get());
+        stub.CommitTx(&call.cntl, &call.req, &call.resp, nullptr);
+        sts = CommitTxResult(&call);
+        if (!sts.IsOk()) {
+            return sts;
+        }
+        if (call.one_phase) {
+            IssueOnePhaseCommit(&call, false);
+            return FinishCommit(&call, OnePhaseCommitResult(&call));
+        }
+        return FinishCommit(&call, PreputAll(call.async_commit));
+    }
+
+    void Transaction::AsyncCommit(StatusCallback done) {
+        // Waiting for the pipelined locks or the streamed intents blocks, so such a commit begins in background.
+        // The rest is moved along by the done closures of the rpcs, which hand any waiting phase to background.
+        auto* call = new CommitCall;
+        call->timer.reset(new PhaseTimer(g_commit_latency));
+        call->done = std::move(done);
+        bool proceed = false;
+        Status sts = Status::Ok();
+        if (_pending_locks.empty() && !_streamed) {
+            sts = BeginCommit(call, proceed);
+        } else {
+            StartBackground([this, call]() {
+                bool proceed = false;
+                Status sts = BeginCommit(call, proceed);
+                if (proceed) {
+                    azino::txplanner::TxService_Stub stub(_txplanner.get());
+                    stub.CommitTx(&call->cntl, &call->req, &call->resp, brpc::NewCallback(this, &Transaction::OnCommitTx, call));
+                    return;
+                }
+                EndAsyncCommit(call, sts);
+            });
+            return;
+        }
+        if (!proceed) {
+            StartBackground([this, call, sts]() {
+                EndAsyncCommit(call, sts);
+            });
+            return;
+        }
+        azino::txplanner::TxService_Stub stub(_txplanner.get());
+        stub.CommitTx(&call->cntl, &call->req, &call->resp, brpc::NewCallback(this, &Transaction::OnCommitTx, call));
+    }
+
+    void Transaction::OnCommitTx(CommitCall* call) {
+        Status sts = CommitTxResult(call);
+        if (!sts.IsOk()) {
+            EndAsyncCommit(call, sts);
+            return;
+        }
+        if (call->one_phase) {
+            IssueOnePhaseCommit(call, true);
+            return;
+        }
+        // preput and commit wait for the rpcs to all the txindexes written
+        StartBackground([this, call]() {
+            EndAsyncCommit(call, FinishCommit(call, PreputAll(call->async_commit)));
+        });
+    }
 
-        Status preput_sts = PreputAll();
-        if (preput_sts.IsOk()) {
+    void Transaction::OnOnePhaseCommit(CommitCall* call) {
+        Status sts = OnePhaseCommitResult(call);
+        if (sts.IsOk() || sts.IsNetWorkErr()) {
+            EndAsyncCommit(call, FinishCommit(call, sts));
+            return;
+        }
+        // aborting waits for the clean rpcs
+        StartBackground([this, call, sts]() {
+            EndAsyncCommit(call, FinishCommit(call, sts));
+        });
+    }
+
+    void Transaction::EndAsyncCommit(CommitCall* call, Status sts) {
+        StatusCallback done = std::move(call->done);
+        delete call;
+        done(sts);
+    }
+
+    Status Transaction::FinishCommit(CommitCall* call, Status preput_sts) {
+        auto* txid_sts = _txid->mutable_status();
+        bool one_phase = call->one_phase;
+        bool async_commit = call->async_commit;
+        if (async_commit && !preput_sts.IsOk()) {
+            // Aborts the tx on its primary first, unless a reader finding all the intents has committed it there.
+            TxOpStatus_Code code = TxOpStatus_Code_Ok;
+            if (DecidePrimary(*_txid, _txindexs, _primary, true, code).IsOk() && code == TxOpStatus_Code_TxCommitted) {
+                preput_sts = Status::Ok("Committed by a reader. ");
+            }
+        }
+        if (one_phase && preput_sts.IsOk()) {
+            txid_sts->set_status_code(TxStatus_Code_Committed);
+            txid_sts->set_status_message(preput_sts.ToString());
+            return preput_sts;
+        } else if (one_phase && preput_sts.IsNetWorkErr()) {
+            // not sure whether the txindex has committed it or not
+            txid_sts->set_status_code(TxStatus_Code_Abnormal);
+            txid_sts->set_status_message(preput_sts.ToString());
+            return preput_sts;
+        } else if (preput_sts.IsOk() && async_commit) {
+            txid_sts->set_status_code(TxStatus_Code_Committed);
+            txid_sts->set_status_message(preput_sts.ToString());
+            auto* task = new AsyncCommitTask;
+            task->txid = *_txid;
+            task->txindexs = _txindexs;
+            task->primary = _primary;
+            for (size_t i = 0; i < _txwritebuffer->ShardNum(); i++) {
+                for (auto& it : _txwritebuffer->GetShard(i)) {
+                    if (it.first != _primary) {
+                        task->keys.push_back(it.first.as_string());
+                    }
+                }
+            }
+            bthread_t tid;
+            if (bthread_start_background(&tid, nullptr, RunAsyncCommit, task) != 0) {
+                LOG(WARNING) << "Fail to start async commit, commit in place. " << _txid->ShortDebugString();
+                RunAsyncCommit(task);
+            }
+            return preput_sts;
+        } else if (preput_sts.IsOk()) {
             txid_sts->set_status_code(TxStatus_Code_Committing);
             Status commit_sts = CommitAll();
             if (commit_sts.IsOk()) {
@@ -128,6 +793,9 @@ DEFINE_int32(max_retry, 2, "Max retries(not including the first RPC)");
             txid_sts->set_status_code(TxStatus_Code_Aborting);
             Status abort_sts =  AbortAll();
             if (abort_sts.IsOk()) {
+                if (async_commit) {
+                    ForgetAsyncCommit(*_txid, _txindexs, _primary);
+                }
                 txid_sts->set_status_code(TxStatus_Code_Aborted);
                 txid_sts->set_status_message(preput_sts.ToString());
                 return preput_sts;
@@ -139,285 +807,2032 @@ DEFINE_int32(max_retry, 2, "Max retries(not including the first RPC)");
         }
     }
 
-    Status Transaction::PreputAll() {
-        assert(_txid->status().status_code() == TxStatus_Code_Preputting);
+    Status Transaction::Abort() {
         std::stringstream ss;
-        for (auto iter = _txwritebuffer->begin(); iter != _txwritebuffer->end(); iter++) {
-            assert(!iter->second.preput);
-            ss = std::stringstream();
-            auto txindex_num = butil::Hash(iter->first) % _txindexs.size();
-            azino::txindex::TxOpService_Stub stub(_txindexs[txindex_num].get());
-            brpc::Controller cntl;
-            azino::txindex::WriteIntentRequest req;
-            req.set_allocated_txid(new TxIdentifier(*_txid));
-            req.set_key(iter->first);
-            req.set_allocated_value(iter->second.value.get());
-            azino::txindex::WriteIntentResponse resp;
-            stub.WriteIntent(&cntl, &req, &resp, nullptr);
-            if (cntl.Failed()) {
-                ss << "Controller failed error code: " << cntl.ErrorCode() << " error text: " << cntl.ErrorText();
-                LOG(WARNING) << ss.str();
-                req.release_value();
-                return Status::NetworkErr(ss.str());
-            }
-            ss << "sdk: " << cntl.local_side() << " WriteIntent from txindex: " << cntl.remote_side() << std::endl
-               << "request: " << req.ShortDebugString() << std::endl
-               << "response: " << resp.ShortDebugString() << std::endl
-               << "latency=" << cntl.latency_us() << "us";
-            req.release_value();
-            switch (resp.tx_op_status().error_code()) {
-                case TxOpStatus_Code_Ok:
-                    ss << " success. ";
-                    LOG(INFO) << ss.str();
-                    iter->second.preput = true;
-                    break;
-                case TxOpStatus_Code_WriteTooLate:
-                case TxOpStatus_Code_WriteConflicts:
-                    ss << " fail. ";
-                    LOG(INFO) << ss.str();
-                    return Status::TxIndexErr(ss.str());
-                default:
-                    ss << " fail. ";
-                    LOG(ERROR) << ss.str();
-                    return Status::TxIndexErr(ss.str());
-            }
+        if (!_txid) {
+            ss << "Transaction has not began. ";
+            return Status::IllegalTxOp(ss.str());
         }
-        return Status::Ok(); // todo: add some error message
+        if (_txid->status().status_code() != TxStatus_Code_Started) {
+            ss << "Transaction is not allowed to abort. " << _txid->ShortDebugString();
+            return Status::IllegalTxOp(ss.str());
+        }
+
+        // failed locks are dropped, there is nothing to clean for them
+        WaitStream();
+        WaitLocks();
+        auto* txid_sts = _txid->mutable_status();
+        txid_sts->set_status_code(TxStatus_Code_Aborting);
+        Status abort_sts = AbortAll();
+        if (abort_sts.IsOk()) {
+            txid_sts->set_status_code(TxStatus_Code_Aborted);
+            txid_sts->set_status_message("Aborted by user. ");
+        } else {
+            txid_sts->set_status_code(TxStatus_Code_Abnormal);
+            txid_sts->set_status_message(abort_sts.ToString());
+        }
+        return abort_sts;
     }
 
-    Status Transaction::CommitAll() {
-        assert(_txid->status().status_code() == TxStatus_Code_Committing);
+    Status Transaction::Reset() {
         std::stringstream ss;
+        if (_txid) {
+            auto code = _txid->status().status_code();
+            bool finished = code == TxStatus_Code_Committed || code == TxStatus_Code_Aborted || code == TxStatus_Code_Abnormal;
+            bool unused = code == TxStatus_Code_Started && _txwritebuffer->size() == 0;
+            if (!finished && !unused) {
+                ss << "Transaction is not allowed to reset. " << _txid->ShortDebugString();
+                return Status::IllegalTxOp(ss.str());
+            }
+        }
+        for (auto& batch : _prefetches) {
+            batch->Wait(this);
+        }
+        RecordTxStats();
+        _prefetches.clear();
+        _prefetched.clear();
+        _txid.reset(nullptr);
+        _txwritebuffer->Clear();
+        _unstreamed_bytes = 0;
+        _streamed = false;
+        _stream_sts = Status::Ok();
+        _merged = false;
+        _primary.clear();
+        return Status::Ok();
+    }
 
-        for (auto iter = _txwritebuffer->begin(); iter != _txwritebuffer->end(); iter++) {
-            assert(iter->second.preput);
-            ss = std::stringstream();
-            auto txindex_num = butil::Hash(iter->first) % _txindexs.size();
-            azino::txindex::TxOpService_Stub stub(_txindexs[txindex_num].get());
-            brpc::Controller cntl;
-            azino::txindex::CommitRequest req;
-            req.set_allocated_txid(new TxIdentifier(*_txid));
-            req.set_key(iter->first);
-            azino::txindex::CommitResponse resp;
-            stub.Commit(&cntl, &req, &resp, nullptr);
-            if (cntl.Failed()) {
-                ss << "Controller failed error code: " << cntl.ErrorCode() << " error text: " << cntl.ErrorText();
+    Status Transaction::PreputAll(bool async_commit) {
+        PhaseTimer timer(g_prewrite_latency);
+        assert(_txid->status().status_code() == TxStatus_Code_Preputting);
+        // one BatchWriteIntent for each txindex that this tx writes to
+        std::vector<std::unique_ptr<PreputCall>> calls(_txindexs.size());
+        int call_num = 0;
+        size_t primary_num = calls.size();
+        for (size_t i = 0; i < calls.size(); i++) {
+            auto& call = calls[i];
+            for (auto& it : _txwritebuffer->GetShard(i)) {
+                if (!call) {
+                    call.reset(new PreputCall);
+                    call->req.set_allocated_txid(new TxIdentifier(*_txid));
+                    call_num++;
+                    if (primary_num == calls.size()) {
+                        primary_num = i;
+                    }
+                }
+                if (it.second.preput) {
+                    // streamed already, only the commit_ts is given to its intent, see TxIndex::BatchWriteIntent
+                    auto* data = call->req.add_datas();
+                    data->set_key(it.first.data(), it.first.size());
+                    data->set_stamp(true);
+                    call->values.push_back(nullptr);
+                } else {
+                    FillIntentData(it.first, it.second.value, call->req.add_datas(), call->cntl.request_attachment(), call->values);
+                }
+                call->writes.push_back(&it.second);
+            }
+        }
+        if (async_commit) {
+            // The first key is the primary, whose intent records all the keys of this tx,
+            // other intents only record the primary key.
+            auto* primary_info = calls[primary_num]->req.mutable_async_commit();
+            primary_info->set_primary_key(calls[primary_num]->req.datas(0).key());
+            _primary = primary_info->primary_key();
+            for (auto& call : calls) {
+                if (call) {
+                    call->req.mutable_async_commit()->set_primary_key(primary_info->primary_key());
+                    for (auto& data : call->req.datas()) {
+                        primary_info->add_keys(data.key());
+                    }
+                }
+            }
+        }
+
+        // Issue the rpcs of all txindexes at once, so that preput costs one round trip.
+        // All of them are waited even if one fails, so every key's intent state is known before AbortAll.
+        bthread::CountdownEvent event(call_num);
+        for (size_t i = 0; i < calls.size(); i++) {
+            auto* call = calls[i].get();
+            if (!call) {
+                continue;
+            }
+            azino::txindex::TxOpService_Stub stub(_txindexs[i].get());
+            stub.BatchWriteIntent(&call->cntl, &call->req, &call->resp, brpc::NewCallback(SignalEvent, &event));
+        }
+        event.wait();
+
+        Status sts = Status::Ok();
+        for (auto& c : calls) {
+            auto* call = c.get();
+            if (!call) {
+                continue;
+            }
+            CountRpc(RecordRpc(g_txindex_rpc, call->cntl, call->req, call->resp));
+            std::stringstream ss;
+            if (call->cntl.Failed()) {
+                ss << "Controller failed error code: " << call->cntl.ErrorCode() << " error text: " << call->cntl.ErrorText();
                 LOG(WARNING) << ss.str();
-                return Status::NetworkErr(ss.str());
+                if (sts.IsOk()) {
+                    sts = Status::NetworkErr(ss.str());
+                }
+                continue;
             }
-            ss << "sdk: " << cntl.local_side() << " Commit from txindex: " << cntl.remote_side() << std::endl
-               << "request: " << req.ShortDebugString() << std::endl
-               << "response: " << resp.ShortDebugString() << std::endl
-               << "latency=" << cntl.latency_us() << "us";
-            switch (resp.tx_op_status().error_code()) {
+            ss << "sdk: " << call->cntl.local_side() << " BatchWriteIntent from txindex: " << call->cntl.remote_side() << std::endl
+               << "request: " << call->req.ShortDebugString() << std::endl
+               << "response: " << call->resp.ShortDebugString() << std::endl
+               << "latency=" << call->cntl.latency_us() << "us";
+            for (auto& contention : call->resp.contentions()) {
+                ReportContention(contention);
+            }
+            for (int j = 0; j < call->resp.tx_op_statuses_size() && j < (int)call->writes.size(); j++) {
+                if (call->resp.tx_op_statuses(j).error_code() == TxOpStatus_Code_Ok) {
+                    call->writes[j]->preput = true;
+                }
+            }
+            switch (call->resp.tx_op_status().error_code()) {
                 case TxOpStatus_Code_Ok:
                     ss << " success. ";
                     LOG(INFO) << ss.str();
                     break;
+                case TxOpStatus_Code_WriteTooLate:
+                case TxOpStatus_Code_WriteConflicts:
+                    ss << " fail. ";
+                    LOG(INFO) << ss.str();
+                    if (sts.IsOk()) {
+                        sts = Status::ConflictErr(ss.str());
+                    }
+                    break;
                 default:
                     ss << " fail. ";
                     LOG(ERROR) << ss.str();
-                    return Status::TxIndexErr(ss.str());
+                    if (sts.IsOk()) {
+                        sts = Status::TxIndexErr(ss.str());
+                    }
             }
         }
-        return Status::Ok(); // todo: add some error message
+        return sts;
     }
 
-    Status Transaction::AbortAll() {
-        assert(_txid->status().status_code() == TxStatus_Code_Aborting);
+    void Transaction::IssueOnePhaseCommit(CommitCall* call, bool async) {
+        assert(_txid->status().status_code() == TxStatus_Code_Preputting);
+        call->prewrite_timer.reset(new PhaseTimer(g_prewrite_latency));
+        azino::txindex::TxOpService_Stub stub(_txindexs[call->txindex_num].get());
+        call->one_phase_req.set_allocated_txid(new TxIdentifier(*_txid));
+        for (auto& it : _txwritebuffer->GetShard(call->txindex_num)) {
+            FillIntentData(it.first, it.second.value, call->one_phase_req.add_datas(), call->one_phase_cntl.request_attachment(),
+                           call->one_phase_values);
+        }
+        stub.OnePhaseCommit(&call->one_phase_cntl, &call->one_phase_req, &call->one_phase_resp,
+                            async ? brpc::NewCallback(this, &Transaction::OnOnePhaseCommit, call) : nullptr);
+    }
+
+    Status Transaction::OnePhaseCommitResult(CommitCall* call) {
+        call->prewrite_timer.reset();
         std::stringstream ss;
+        auto& cntl = call->one_phase_cntl;
+        auto& req = call->one_phase_req;
+        auto& resp = call->one_phase_resp;
+        CountRpc(RecordRpc(g_txindex_rpc, cntl, req, resp));
+        if (cntl.Failed()) {
+            ss << "Controller failed error code: " << cntl.ErrorCode() << " error text: " << cntl.ErrorText();
+            LOG(WARNING) << ss.str();
+            return Status::NetworkErr(ss.str());
+        }
+        ss << "sdk: " << cntl.local_side() << " OnePhaseCommit from txindex: " << cntl.remote_side() << std::endl
+           << "request: " << req.ShortDebugString() << std::endl
+           << "response: " << resp.ShortDebugString() << std::endl
+           << "latency=" << cntl.latency_us() << "us";
+        for (auto& contention : resp.contentions()) {
+            ReportContention(contention);
+        }
+        switch (resp.tx_op_status().error_code()) {
+            case TxOpStatus_Code_Ok:
+                ss << " success. ";
+                LOG(INFO) << ss.str();
+                return Status::Ok(ss.str());
+            case TxOpStatus_Code_WriteTooLate:
+            case TxOpStatus_Code_WriteConflicts:
+                ss << " fail. ";
+                LOG(INFO) << ss.str();
+                return Status::ConflictErr(ss.str());
+            default:
+                ss << " fail. ";
+                LOG(ERROR) << ss.str();
+                return Status::TxIndexErr(ss.str());
+        }
+    }
 
-        for (auto iter = _txwritebuffer->begin(); iter != _txwritebuffer->end(); iter++) {
-            if (!iter->second.preput && iter->second.options.type == kOptimistic) continue;
-            ss = std::stringstream();
-            auto txindex_num = butil::Hash(iter->first) % _txindexs.size();
-            azino::txindex::TxOpService_Stub stub(_txindexs[txindex_num].get());
-            brpc::Controller cntl;
-            azino::txindex::CleanRequest req;
-            req.set_allocated_txid(new TxIdentifier(*_txid));
-            req.set_key(iter->first);
-            azino::txindex::CleanResponse resp;
-            stub.Clean(&cntl, &req, &resp, nullptr);
-            if (cntl.Failed()) {
-                ss << "Controller failed error code: " << cntl.ErrorCode() << " error text: " << cntl.ErrorText();
+    Status Transaction::CommitAll() {
+        assert(_txid->status().status_code() == TxStatus_Code_Committing);
+        // the keys of each txindex are committed in batches, and the batches of all txindexes at once
+        std::vector<std::unique_ptr<FinishKeysCall>> calls;
+        for (size_t i = 0; i < _txwritebuffer->ShardNum(); i++) {
+            FinishKeysCall* call = nullptr;
+            for (auto& it : _txwritebuffer->GetShard(i)) {
+                assert(it.second.preput);
+                if (!call || call->req.commits_size() >= std::max(FLAGS_commit_batch_size, 1)) {
+                    calls.emplace_back(new FinishKeysCall);
+                    call = calls.back().get();
+                    call->txindex_num = i;
+                }
+                auto* commit = call->req.add_commits();
+                commit->mutable_txid()->CopyFrom(*_txid);
+                commit->set_key(it.first.data(), it.first.size());
+            }
+        }
+        if (calls.empty()) {
+            return Status::Ok();
+        }
+
+        bthread::CountdownEvent event(calls.size());
+        for (auto& call : calls) {
+            azino::txindex::TxOpService_Stub stub(_txindexs[call->txindex_num].get());
+            stub.MultiTxFinish(&call->cntl, &call->req, &call->resp, brpc::NewCallback(SignalEvent, &event));
+        }
+        event.wait();
+
+        Status sts = Status::Ok();
+        for (auto& call : calls) {
+            CountRpc(RecordRpc(g_txindex_rpc, call->cntl, call->req, call->resp));
+            std::stringstream ss;
+            if (call->cntl.Failed()) {
+                ss << "Controller failed error code: " << call->cntl.ErrorCode() << " error text: " << call->cntl.ErrorText();
                 LOG(WARNING) << ss.str();
-                return Status::NetworkErr(ss.str());
+                if (sts.IsOk()) {
+                    sts = Status::NetworkErr(ss.str());
+                }
+                continue;
             }
-            ss << "sdk: " << cntl.local_side() << " Clean from txindex: " << cntl.remote_side() << std::endl
-               << "request: " << req.ShortDebugString() << std::endl
-               << "response: " << resp.ShortDebugString() << std::endl
-               << "latency=" << cntl.latency_us() << "us";
-            switch (resp.tx_op_status().error_code()) {
-                case TxOpStatus_Code_Ok:
-                    ss << " success. ";
-                    LOG(INFO) << ss.str();
-                    iter->second.preput = false;
+            ss << "sdk: " << call->cntl.local_side() << " MultiTxFinish from txindex: " << call->cntl.remote_side() << std::endl
+               << "request commit num: " << call->req.commits_size() << std::endl
+               << "latency=" << call->cntl.latency_us() << "us";
+            bool failed = false;
+            for (int j = 0; j < call->resp.commits_size(); j++) {
+                auto& commit_sts = call->resp.commits(j).tx_op_status();
+                if (commit_sts.error_code() != TxOpStatus_Code_Ok) {
+                    ss << " fail. " << call->req.commits(j).key() << " " << commit_sts.ShortDebugString();
+                    failed = true;
                     break;
-                default:
-                    ss << " fail. ";
-                    LOG(ERROR) << ss.str();
-                    return Status::TxIndexErr(ss.str());
+                }
+            }
+            if (!failed) {
+                ss << " success. ";
+                LOG(INFO) << ss.str();
+                continue;
+            }
+            LOG(ERROR) << ss.str();
+            if (sts.IsOk()) {
+                sts = Status::TxIndexErr(ss.str());
             }
         }
-        return Status::Ok(); // todo: add some error message
+        return sts;
     }
 
-    Status Transaction::Put(const WriteOptions& options, const UserKey& key, const UserValue& value) {
-        return Write(options, key, false, value);
+    Status Transaction::AbortAll() {
+        PhaseTimer timer(g_abort_latency);
+        assert(_txid->status().status_code() == TxStatus_Code_Aborting);
+        // the keys of each txindex are cleaned in batches, and the batches of all txindexes at once
+        std::vector<std::unique_ptr<FinishKeysCall>> calls;
+        for (size_t i = 0; i < _txwritebuffer->ShardNum(); i++) {
+            FinishKeysCall* call = nullptr;
+            for (auto& it : _txwritebuffer->GetShard(i)) {
+                if (!it.second.preput && !it.second.streamed && it.second.options.type == kOptimistic) continue;
+                if (!call || call->req.cleans_size() >= std::max(FLAGS_commit_batch_size, 1)) {
+                    calls.emplace_back(new FinishKeysCall);
+                    call = calls.back().get();
+                    call->txindex_num = i;
+                }
+                auto* clean = call->req.add_cleans();
+                clean->mutable_txid()->CopyFrom(*_txid);
+                clean->set_key(it.first.data(), it.first.size());
+                call->writes.push_back(&it.second);
+            }
+        }
+        if (calls.empty()) {
+            return Status::Ok();
+        }
+
+        bthread::CountdownEvent event(calls.size());
+        for (auto& call : calls) {
+            azino::txindex::TxOpService_Stub stub(_txindexs[call->txindex_num].get());
+            stub.MultiTxFinish(&call->cntl, &call->req, &call->resp, brpc::NewCallback(SignalEvent, &event));
+        }
+        event.wait();
+
+        Status sts = Status::Ok();
+        for (auto& call : calls) {
+            CountRpc(RecordRpc(g_txindex_rpc, call->cntl, call->req, call->resp));
+            std::stringstream ss;
+            if (call->cntl.Failed()) {
+                ss << "Controller failed error code: " << call->cntl.ErrorCode() << " error text: " << call->cntl.ErrorText();
+                LOG(WARNING) << ss.str();
+                if (sts.IsOk()) {
+                    sts = Status::NetworkErr(ss.str());
+                }
+                continue;
+            }
+            ss << "sdk: " << call->cntl.local_side() << " MultiTxFinish from txindex: " << call->cntl.remote_side() << std::endl
+               << "request clean num: " << call->req.cleans_size() << std::endl
+               << "latency=" << call->cntl.latency_us() << "us";
+            bool failed = false;
+            for (int j = 0; j < call->resp.cleans_size() && j < (int)call->writes.size(); j++) {
+                auto& clean_sts = call->resp.cleans(j).tx_op_status();
+                if (clean_sts.error_code() == TxOpStatus_Code_Ok || clean_sts.error_code() == TxOpStatus_Code_CleanNotExist) {
+                    call->writes[j]->preput = false;
+                } else if (!failed) {
+                    ss << " fail. " << call->req.cleans(j).key() << " " << clean_sts.ShortDebugString();
+                    failed = true;
+                }
+            }
+            if (!failed) {
+                ss << " success. ";
+                LOG(INFO) << ss.str();
+                continue;
+            }
+            LOG(ERROR) << ss.str();
+            if (sts.IsOk()) {
+                sts = Status::TxIndexErr(ss.str());
+            }
+        }
+        return sts;
     }
 
-    Status Transaction::Delete(const WriteOptions& options, const UserKey& key) {
-        return Write(options, key, true);
+    Status Transaction::WaitLock(const UserKey& key) {
+        auto iter = _pending_locks.find(key);
+        if (iter == _pending_locks.end()) {
+            return Status::Ok();
+        }
+        auto* lock = iter->second.get();
+        {
+            PhaseTimer timer(g_lock_latency);
+            lock->event.wait();
+        }
+        if (!lock->recorded.exchange(true)) {
+            CountRpc(RecordRpc(g_txindex_rpc, lock->cntl, lock->req, lock->resp));
+        }
+        return WriteLockResult(lock->cntl, lock->req, lock->resp);
     }
 
-    Status Transaction::Write(const WriteOptions& options, const UserKey& key, bool is_delete, const UserValue& value) {
-        std::stringstream ss;
-        if (!_txid) {
-            ss << "Transaction has not began. ";
-            return Status::IllegalTxOp(ss.str());
+    Status Transaction::WaitLocks() {
+        Status sts = Status::Ok();
+        for (auto& it : _pending_locks) {
+            Status lock_sts = WaitLock(it.first);
+            auto* written = _txwritebuffer->Find(it.first);
+            if (!lock_sts.IsOk() && written && !written->streamed) {
+                // nothing to clean for this key
+                _txwritebuffer->Erase(it.first);
+            }
+            if (!lock_sts.IsOk()) {
+                if (sts.IsOk()) {
+                    sts = lock_sts;
+                }
+            }
         }
-        if (_txid->status().status_code() != TxStatus_Code_Started) {
-            ss << "Transaction is not allowed to put. " << _txid->ShortDebugString();
-            return Status::IllegalTxOp(ss.str());
+        _pending_locks.clear();
+        return sts;
+    }
+
+    Status Transaction::StreamPrewrite() {
+        // an intent should not get ahead of the pipelined lock on its key
+        Status sts = WaitLocks();
+        if (!sts.IsOk()) {
+            _stream_sts = sts;
+            return sts;
+        }
+        sts = WaitStream();
+        if (!sts.IsOk()) {
+            return sts;
         }
 
-        std::unique_ptr<Value>saved_value(new Value);
-        if (is_delete) {
-            saved_value->set_is_delete(true);
-        } else {
-            saved_value->set_is_delete(false);
-            saved_value->set_content(value);
+        std::vector<std::unique_ptr<PreputCall>> calls(_txindexs.size());
+        int call_num = 0;
+        for (auto& key : _txwritebuffer->TakeUnstreamed()) {
+            auto txindex_num = _txwritebuffer->ShardOf(key);
+            auto& shard = _txwritebuffer->GetShard(txindex_num);
+            auto iter = shard.find(key);
+            if (iter == shard.end() || iter->second.preput) {
+                continue;
+            }
+            auto& call = calls[txindex_num];
+            if (!call) {
+                call.reset(new PreputCall);
+                call->req.set_allocated_txid(new TxIdentifier(*_txid));
+                call->req.set_streamed(true);
+                call_num++;
+            }
+            FillIntentData(iter->first, iter->second.value, call->req.add_datas(), call->cntl.request_attachment(), call->values);
+            call->writes.push_back(&iter->second);
         }
-        WriteOptions saved_options = options;
-        if (saved_options.type == WriteType::kAutomatic) {
-            // todo: automatic chose type
-            saved_options.type = WriteType::kOptimistic;
+        _unstreamed_bytes = 0;
+        if (call_num == 0) {
+            return Status::Ok();
         }
 
-        if (saved_options.type == kPessimistic
-            && (_txwritebuffer->find(key) == _txwritebuffer->end()
-                || _txwritebuffer->find(key)->second.options.type != kPessimistic)) { // Pessimistic
-            auto txindex_num = butil::Hash(key) % _txindexs.size();
-            azino::txindex::TxOpService_Stub stub(_txindexs[txindex_num].get());
-            brpc::Controller cntl;
-            azino::txindex::WriteLockRequest req;
-            req.set_key(key);
-            req.set_allocated_txid(new TxIdentifier(*_txid));
-            azino::txindex::WriteLockResponse resp;
-            stub.WriteLock(&cntl, &req, &resp, nullptr);
-            if (cntl.Failed()) {
-                ss << "Controller failed error code: " << cntl.ErrorCode() << " error text: " << cntl.ErrorText();
+        _streamed = true;
+        _stream.reset(new StreamBatch(call_num));
+        for (size_t i = 0; i < calls.size(); i++) {
+            if (!calls[i]) {
+                continue;
+            }
+            auto* call = calls[i].get();
+            _stream->calls.push_back(std::move(calls[i]));
+            azino::txindex::TxOpService_Stub stub(_txindexs[i].get());
+            stub.BatchWriteIntent(&call->cntl, &call->req, &call->resp, brpc::NewCallback(SignalEvent, &_stream->event));
+        }
+        return Status::Ok();
+    }
+
+    Status Transaction::WaitStream() {
+        std::shared_ptr<StreamBatch> stream;
+        {
+            std::lock_guard<bthread::Mutex> lck(*_read_mutex);
+            if (!_stream) {
+                return _stream_sts;
+            }
+            stream = _stream;
+        }
+        // waited without the lock, so that concurrent reads are not held up by the rpcs
+        {
+            PhaseTimer timer(g_prewrite_latency);
+            stream->event.wait();
+        }
+        std::lock_guard<bthread::Mutex> lck(*_read_mutex);
+        if (_stream != stream) {
+            // taken by another reader waiting for it too
+            return _stream_sts;
+        }
+        for (auto& c : _stream->calls) {
+            auto* call = c.get();
+            CountRpc(RecordRpc(g_txindex_rpc, call->cntl, call->req, call->resp));
+            std::stringstream ss;
+            if (call->cntl.Failed()) {
+                ss << "Controller failed error code: " << call->cntl.ErrorCode() << " error text: " << call->cntl.ErrorText();
                 LOG(WARNING) << ss.str();
-                return Status::NetworkErr(ss.str());
+                if (_stream_sts.IsOk()) {
+                    _stream_sts = Status::NetworkErr(ss.str());
+                }
+                // not sure which intents are written
+                for (auto* write : call->writes) {
+                    write->streamed = true;
+                }
+                continue;
             }
-            ss << "sdk: " << cntl.local_side() << " WriteLock from txindex: " << cntl.remote_side() << std::endl
-               << "request: " << req.ShortDebugString() << std::endl
-               << "response: " << resp.ShortDebugString() << std::endl
-               << "latency=" << cntl.latency_us() << "us";
-            switch (resp.tx_op_status().error_code()) {
+            ss << "sdk: " << call->cntl.local_side() << " stream BatchWriteIntent from txindex: " << call->cntl.remote_side()
+               << " key num: " << call->req.datas_size() << std::endl
+               << "response: " << call->resp.tx_op_status().ShortDebugString() << std::endl
+               << "latency=" << call->cntl.latency_us() << "us";
+            for (auto& contention : call->resp.contentions()) {
+                ReportContention(contention);
+            }
+            for (int j = 0; j < call->resp.tx_op_statuses_size() && j < (int)call->writes.size(); j++) {
+                if (call->resp.tx_op_statuses(j).error_code() != TxOpStatus_Code_Ok) {
+                    continue;
+                }
+                auto* write = call->writes[j];
+                write->streamed = true;
+                // a key written again meanwhile is streamed again later
+                if (write->value == call->values[j]) {
+                    write->preput = true;
+                    _txwritebuffer->DropValue(*write);
+                }
+            }
+            switch (call->resp.tx_op_status().error_code()) {
                 case TxOpStatus_Code_Ok:
                     ss << " success. ";
                     LOG(INFO) << ss.str();
                     break;
                 case TxOpStatus_Code_WriteTooLate:
-                    // todo: fail to lock, may use some optimistic approach
+                case TxOpStatus_Code_WriteConflicts:
                     ss << " fail. ";
                     LOG(INFO) << ss.str();
-                    return Status::TxIndexErr(ss.str());
+                    if (_stream_sts.IsOk()) {
+                        _stream_sts = Status::ConflictErr(ss.str());
+                    }
+                    break;
                 default:
                     ss << " fail. ";
                     LOG(ERROR) << ss.str();
-                    return Status::TxIndexErr(ss.str());
+                    if (_stream_sts.IsOk()) {
+                        _stream_sts = Status::TxIndexErr(ss.str());
+                    }
             }
         }
+        _stream.reset();
+        return _stream_sts;
+    }
 
-        ss << "Write in TxWriteBuffer key: " << key << " Value: " << saved_value->ShortDebugString();
-        _txwritebuffer->Write(key, saved_value.release(), saved_options);
-        return Status::Ok(ss.str());
+    std::shared_ptr<Value> Transaction::FindWritten(const UserKey& key) {
+        std::lock_guard<bthread::Mutex> lck(*_read_mutex);
+        auto* written = _txwritebuffer->Find(key);
+        return written ? written->value : nullptr;
     }
 
-    Status Transaction::Get(const ReadOptions& options, const UserKey& key, UserValue& value) {
+    bool Transaction::HasWritten(const UserKey& key) {
+        std::lock_guard<bthread::Mutex> lck(*_read_mutex);
+        return _txwritebuffer->Find(key) != nullptr;
+    }
+
+    void Transaction::CountRpc(int64_t bytes) {
+        _rpc_count++;
+        _rpc_bytes += bytes;
+    }
+
+    void Transaction::RecordTxStats() {
+        if (_txid) {
+            g_tx_rpcs << _rpc_count.load();
+            g_tx_rpc_bytes << _rpc_bytes.load();
+        }
+        _rpc_count = 0;
+        _rpc_bytes = 0;
+    }
+
+    Status Transaction::ResolveAsyncCommit(const TxIdentifier& holder, const AsyncCommitInfo& info) {
         std::stringstream ss;
-        auto iter = _txwritebuffer->find(key);
-        if (iter != _txwritebuffer->end()) {
-            auto v = iter->second.value;
-            ss << "Find in TxWriteBuffer Key: " << key << " Value: " << v->ShortDebugString();
-            if (v->is_delete()) {
-                return Status::NotFound(ss.str());
-            } else {
-                value = v->content();
-                return Status::Ok(ss.str());
+        const UserKey& primary = info.primary_key();
+        std::vector<UserKey> keys(info.keys().begin(), info.keys().end());
+        // Ok while the tx is undecided, TxCommitted or TxAborted once it is decided on the primary
+        TxOpStatus_Code decided = TxOpStatus_Code_Ok;
+        if (keys.empty()) {
+            // only the primary knows all the keys of the tx, and whether it is decided
+            auto txindex_num = butil::Hash(primary) % _txindexs.size();
+            azino::txindex::TxOpService_Stub stub(_txindexs[txindex_num].get());
+            brpc::Controller cntl;
+            azino::txindex::QueryIntentRequest req;
+            req.set_allocated_txid(new TxIdentifier(holder));
+            req.add_keys(primary);
+            azino::txindex::QueryIntentResponse resp;
+            stub.QueryIntent(&cntl, &req, &resp, nullptr);
+            CountRpc(RecordRpc(g_txindex_rpc, cntl, req, resp));
+            if (cntl.Failed()) {
+                ss << "Controller failed error code: " << cntl.ErrorCode() << " error text: " << cntl.ErrorText();
+                LOG(WARNING) << ss.str();
+                return Status::NetworkErr(ss.str());
             }
-        }
-        auto txindex_num = butil::Hash(key) % _txindexs.size();
-        azino::txindex::TxOpService_Stub stub(_txindexs[txindex_num].get());
-        brpc::Controller cntl;
-        azino::txindex::ReadRequest req;
-        req.set_key(key);
-        req.set_allocated_txid(new TxIdentifier(*_txid));
-        azino::txindex::ReadResponse resp;
-        stub.Read(&cntl, &req, &resp, nullptr);
-        if (cntl.Failed()) {
-            ss << "Controller failed error code: " << cntl.ErrorCode() << " error text: " << cntl.ErrorText();
-            LOG(WARNING) << ss.str();
-            return Status::NetworkErr(ss.str());
-        }
-        ss << "sdk: " << cntl.local_side() << " Read from txindex: " << cntl.remote_side() << std::endl
-           << "request: " << req.ShortDebugString() << std::endl
-           << "response: " << resp.ShortDebugString() << std::endl
-           << "latency=" << cntl.latency_us() << "us";
-        switch (resp.tx_op_status().error_code()) {
-            case TxOpStatus_Code_Ok:
-                ss << " success. ";
-                LOG(INFO) << ss.str();
-                if (resp.value().is_delete()) {
-                    return Status::NotFound(ss.str());
-                } else {
-                    value = resp.value().content();
-                    return Status::Ok(ss.str());
-                }
-            case TxOpStatus_Code_ReadNotExist:
+            ss << "sdk: " << cntl.local_side() << " QueryIntent from txindex: " << cntl.remote_side() << std::endl
+               << "request: " << req.ShortDebugString() << std::endl
+               << "response: " << resp.ShortDebugString() << std::endl
+               << "latency=" << cntl.latency_us() << "us";
+            decided = resp.tx_op_statuses_size() == 1 ? resp.tx_op_statuses(0).error_code() : TxOpStatus_Code_QueryNotExist;
+            bool known = decided == TxOpStatus_Code_Ok || decided == TxOpStatus_Code_TxCommitted || decided == TxOpStatus_Code_TxAborted;
+            if (!known || resp.async_commits_size() != 1 || resp.async_commits(0).keys_size() == 0) {
+                // the primary is not written yet, or all the keys have been resolved
                 ss << " fail. ";
                 LOG(INFO) << ss.str();
-                goto readStorage;
-            default:
+                return Status::TxIndexErr(ss.str());
+            }
+            ss << " success. ";
+            LOG(INFO) << ss.str();
+            keys.assign(resp.async_commits(0).keys().begin(), resp.async_commits(0).keys().end());
+        }
+
+        std::vector<std::unique_ptr<azino::txindex::QueryIntentRequest>> reqs(_txindexs.size());
+        for (size_t i = 0; i < keys.size() && decided == TxOpStatus_Code_Ok; i++) {
+            auto& req = reqs[butil::Hash(keys[i]) % _txindexs.size()];
+            if (!req) {
+                req.reset(new azino::txindex::QueryIntentRequest);
+                req->set_allocated_txid(new TxIdentifier(holder));
+            }
+            req->add_keys(keys[i]);
+        }
+        for (size_t i = 0; i < reqs.size(); i++) {
+            if (!reqs[i]) {
+                continue;
+            }
+            ss = std::stringstream();
+            azino::txindex::TxOpService_Stub stub(_txindexs[i].get());
+            brpc::Controller cntl;
+            azino::txindex::QueryIntentResponse resp;
+            stub.QueryIntent(&cntl, reqs[i].get(), &resp, nullptr);
+            CountRpc(RecordRpc(g_txindex_rpc, cntl, *reqs[i], resp));
+            if (cntl.Failed()) {
+                ss << "Controller failed error code: " << cntl.ErrorCode() << " error text: " << cntl.ErrorText();
+                LOG(WARNING) << ss.str();
+                return Status::NetworkErr(ss.str());
+            }
+            ss << "sdk: " << cntl.local_side() << " QueryIntent from txindex: " << cntl.remote_side() << std::endl
+               << "request: " << reqs[i]->ShortDebugString() << std::endl
+               << "response: " << resp.ShortDebugString() << std::endl
+               << "latency=" << cntl.latency_us() << "us";
+            if (resp.tx_op_statuses_size() != reqs[i]->keys_size()) {
                 ss << " fail. ";
                 LOG(ERROR) << ss.str();
                 return Status::TxIndexErr(ss.str());
-        }
-        
-        readStorage:
-        azino::storage::StorageService_Stub storage_stub(_storage.get());
-        brpc::Controller storage_cntl;
-        azino::storage::MVCCGetRequest storage_req;
-        storage_req.set_key(key);
-        storage_req.set_ts(_txid->start_ts());
-        azino::storage::MVCCGetResponse storage_resp;
-        storage_stub.MVCCGet(&storage_cntl, &storage_req, &storage_resp, nullptr);
-        std::stringstream storage_ss;
-        if (storage_cntl.Failed()) {
-            storage_ss << "Controller failed error code: " << storage_cntl.ErrorCode() << " error text: " << storage_cntl.ErrorText();
-            LOG(WARNING) << storage_ss.str();
-            return Status::NetworkErr(storage_ss.str());
-        }
-        storage_ss << "sdk: " << storage_cntl.local_side() << " Read from storage: " << storage_cntl.remote_side() << std::endl
-           << "request: " << storage_req.ShortDebugString() << std::endl
-           << "response: " << storage_resp.ShortDebugString() << std::endl
-           << "latency=" << storage_cntl.latency_us() << "us";
-        switch (storage_resp.status().error_code()) {
+            }
+            for (int j = 0; j < resp.tx_op_statuses_size(); j++) {
+                if (resp.tx_op_statuses(j).error_code() != TxOpStatus_Code_Ok) {
+                    // the tx is still preputting, or is decided meanwhile, which the commit below tells
+                    ss << " fail. ";
+                    LOG(INFO) << ss.str();
+                    return Status::TxIndexErr(ss.str());
+                }
+            }
+            ss << " success. ";
+            LOG(INFO) << ss.str();
+        }
+
+        if (decided == TxOpStatus_Code_Ok) {
+            // All the intents are written, so the tx commits, unless the writer has aborted it on the primary,
+            // which is told by the commit there. Whoever comes first decides.
+            TxOpStatus_Code code = TxOpStatus_Code_Ok;
+            Status sts = DecidePrimary(holder, _txindexs, primary, false, code);
+            if (!sts.IsOk()) {
+                return sts;
+            }
+            if (code == TxOpStatus_Code_Ok) {
+                decided = TxOpStatus_Code_TxCommitted;
+            } else if (code == TxOpStatus_Code_TxAborted) {
+                decided = TxOpStatus_Code_TxAborted;
+            } else {
+                // the primary intent is gone, its outcome is unknown
+                return Status::TxIndexErr("Fail to commit primary key: " + primary);
+            }
+        }
+
+        std::vector<UserKey> others;
+        for (auto& key : keys) {
+            if (key != primary) {
+                others.push_back(key);
+            }
+        }
+        Status sts = ResolveIntents(holder, _txindexs, others, decided == TxOpStatus_Code_TxCommitted);
+        if (sts.IsOk()) {
+            ForgetAsyncCommit(holder, _txindexs, primary);
+        }
+        return sts;
+    }
+
+    void Transaction::AsyncGet(const ReadOptions& options, const UserKey& key, UserValue* value, StatusCallback done) {
+        // A key this tx wrote, or prefetched, may have to wait for its pipelined lock, streamed intent or prefetch,
+        // so it is read in background. Others are moved along by the done closures of their rpcs.
+        bool waits = !_options->read_only && HasWritten(key);
+        if (!waits) {
+            std::lock_guard<bthread::Mutex> lck(*_read_mutex);
+            waits = _prefetched.count(key) > 0;
+        }
+        Status sts = Status::Ok();
+        if (waits || ReadCached(key, *value, sts)) {
+            StartBackground([this, options, key, value, done, waits, sts]() {
+                done(waits ? Get(options, key, *value) : sts);
+            });
+            return;
+        }
+        auto* call = new ReadCall(key, value);
+        call->timer.reset(new PhaseTimer(g_read_latency));
+        call->done = std::move(done);
+        IssueRead(call, true);
+    }
+
+    Status Transaction::Put(const WriteOptions& options, const UserKey& key, const UserValue& value) {
+        return Write(options, key, false, value);
+    }
+
+    Status Transaction::Put(const WriteOptions& options, const UserKey& key, UserValue&& value) {
+        return Write(options, key, false, std::move(value));
+    }
+
+    Status Transaction::Delete(const WriteOptions& options, const UserKey& key) {
+        return Write(options, key, true);
+    }
+
+    Status Transaction::CheckWritable() {
+        std::stringstream ss;
+        if (!_txid) {
+            ss << "Transaction has not began. ";
+            return Status::IllegalTxOp(ss.str());
+        }
+        if (_txid->status().status_code() != TxStatus_Code_Started) {
+            ss << "Transaction is not allowed to put. " << _txid->ShortDebugString();
+            return Status::IllegalTxOp(ss.str());
+        }
+        if (_options->read_only) {
+            ss << "Read-only transaction is not allowed to put. " << _txid->ShortDebugString();
+            return Status::IllegalTxOp(ss.str());
+        }
+        return _stream_sts;
+    }
+
+    Status Transaction::PutIf(const WriteOptions& options, const UserKey& key, const UserValue& value, const UserValue& expected) {
+        Status sts = CheckWritable();
+        if (!sts.IsOk()) {
+            return sts;
+        }
+        sts = WaitLock(key);
+        if (!sts.IsOk()) {
+            return sts;
+        }
+        std::stringstream ss;
+        // checks the value this tx reads, when the txindex alone could not tell it
+        auto put_if_read = [&]() -> Status {
+            UserValue current;
+            Status get_sts = Get(ReadOptions(), key, current);
+            if (get_sts.IsNotFound() || (get_sts.IsOk() && current != expected)) {
+                return Status::ConditionFailed(get_sts.ToString());
+            }
+            if (!get_sts.IsOk()) {
+                return get_sts;
+            }
+            return Write(options, key, false, value);
+        };
+        // this tx's own write is checked here, a streamed one is checked by the txindex holding its intent
+        auto* written = _txwritebuffer->Find(key);
+        if (written && written->value && written->value->has_merge_op()) {
+            return put_if_read();
+        }
+        if (written && written->value) {
+            if (written->value->is_delete() || written->value->content() != expected) {
+                ss << "Find in TxWriteBuffer Key: " << key << " Value: " << written->value->ShortDebugString();
+                return Status::ConditionFailed(ss.str());
+            }
+            return Write(options, key, false, value);
+        }
+
+        auto txindex_num = butil::Hash(key) % _txindexs.size();
+        azino::txindex::TxOpService_Stub stub(_txindexs[txindex_num].get());
+        // lent to the attachment as FillIntentData does, and buffered once the intent is written
+        auto saved_value = _txwritebuffer->NewValue();
+        saved_value->set_is_delete(false);
+        saved_value->set_content(value);
+        brpc::Controller cntl;
+        azino::txindex::ConditionalWriteIntentRequest req;
+        req.set_allocated_txid(new TxIdentifier(*_txid));
+        req.set_key(key);
+        req.mutable_value()->set_is_delete(false);
+        req.set_attachment_size(value.size());
+        if (!value.empty()) {
+            cntl.request_attachment().append_user_data(const_cast<char*>(saved_value->content().data()), value.size(), KeepLentValue);
+        }
+        req.mutable_expected()->set_content(expected);
+        azino::txindex::ConditionalWriteIntentResponse resp;
+        stub.ConditionalWriteIntent(&cntl, &req, &resp, nullptr);
+        CountRpc(RecordRpc(g_txindex_rpc, cntl, req, resp));
+        if (cntl.Failed()) {
+            ss << "Controller failed error code: " << cntl.ErrorCode() << " error text: " << cntl.ErrorText();
+            LOG(WARNING) << ss.str();
+            return Status::NetworkErr(ss.str());
+        }
+        ss << "sdk: " << cntl.local_side() << " ConditionalWriteIntent from txindex: " << cntl.remote_side() << std::endl
+           << "request: " << req.ShortDebugString() << std::endl
+           << "response: " << resp.ShortDebugString() << std::endl
+           << "latency=" << cntl.latency_us() << "us";
+        if (resp.has_contention()) {
+            ReportContention(resp.contention());
+        }
+        switch (resp.tx_op_status().error_code()) {
+            case TxOpStatus_Code_Ok: {
+                ss << " success. ";
+                LOG(INFO) << ss.str();
+                // the intent is written already, Commit only commits it
+                WriteOptions saved_options;
+                saved_options.type = kPessimistic;
+                _txwritebuffer->Write(key, std::move(saved_value), saved_options);
+                written = _txwritebuffer->Find(key);
+                written->preput = true;
+                written->streamed = true;
+                return Status::Ok(ss.str());
+            }
+            case TxOpStatus_Code_ConditionFailed:
+                ss << " fail. ";
+                LOG(INFO) << ss.str();
+                return Status::ConditionFailed(ss.str());
+            case TxOpStatus_Code_ConditionUnknown: {
+                ss << " fail. ";
+                LOG(INFO) << ss.str();
+                // the value is only in storage or merged, check it here instead
+                return put_if_read();
+            }
+            case TxOpStatus_Code_WriteTooLate:
+            case TxOpStatus_Code_WriteConflicts:
+                ss << " fail. ";
+                LOG(INFO) << ss.str();
+                return Status::ConflictErr(ss.str());
+            default:
+                ss << " fail. ";
+                LOG(ERROR) << ss.str();
+                return Status::TxIndexErr(ss.str());
+        }
+    }
+
+    Status Transaction::Write(const WriteOptions& options, const UserKey& key, bool is_delete, UserValue value) {
+        std::stringstream ss;
+        Status writable_sts = CheckWritable();
+        if (!writable_sts.IsOk()) {
+            return writable_sts;
+        }
+        size_t write_bytes = key.size() + value.size();
+
+        auto saved_value = _txwritebuffer->NewValue();
+        if (is_delete) {
+            saved_value->set_is_delete(true);
+        } else {
+            saved_value->set_is_delete(false);
+            saved_value->set_content(std::move(value));
+        }
+        WriteOptions saved_options = options;
+        if (saved_options.type == WriteType::kAutomatic) {
+            // hot keys are locked at once rather than aborting at commit again and again
+            saved_options.type = ContentionTracker::Global()->IsHot(key) ? kPessimistic : kOptimistic;
+        }
+
+        auto* written = _txwritebuffer->Find(key);
+        if (saved_options.type == kPessimistic
+            && (!written || written->options.type != kPessimistic)) { // Pessimistic
+            auto txindex_num = butil::Hash(key) % _txindexs.size();
+            azino::txindex::TxOpService_Stub stub(_txindexs[txindex_num].get());
+            if (_options->pipelined_lock) {
+                // checked by the next Get on this key or Commit
+                auto* lock = new PendingLock;
+                lock->req.set_key(key);
+                lock->req.set_allocated_txid(new TxIdentifier(*_txid));
+                _pending_locks[key].reset(lock);
+                stub.WriteLock(&lock->cntl, &lock->req, &lock->resp, brpc::NewCallback(SignalEvent, &lock->event));
+            } else {
+                PhaseTimer timer(g_lock_latency);
+                brpc::Controller cntl;
+                azino::txindex::WriteLockRequest req;
+                req.set_key(key);
+                req.set_allocated_txid(new TxIdentifier(*_txid));
+                azino::txindex::WriteLockResponse resp;
+                stub.WriteLock(&cntl, &req, &resp, nullptr);
+                CountRpc(RecordRpc(g_txindex_rpc, cntl, req, resp));
+                Status lock_sts = WriteLockResult(cntl, req, resp);
+                if (!lock_sts.IsOk()) {
+                    return lock_sts;
+                }
+            }
+        }
+
+        ss << "Write in TxWriteBuffer key: " << key << " Value: " << saved_value->ShortDebugString();
+        _txwritebuffer->Write(key, std::move(saved_value), saved_options);
+        Status stream_sts = CountUnstreamed(write_bytes);
+        if (!stream_sts.IsOk()) {
+            return stream_sts;
+        }
+        return Status::Ok(ss.str());
+    }
+
+    Status Transaction::Merge(const WriteOptions& options, const UserKey& key, const std::string& op, const UserValue& operand) {
+        std::stringstream ss;
+        Status sts = CheckWritable();
+        if (!sts.IsOk()) {
+            return sts;
+        }
+        if (!ValidOperand(op, operand)) {
+            ss << "Unknown merge operator: " << op << " or invalid operand: " << operand;
+            return Status::IllegalTxOp(ss.str());
+        }
+
+        auto* written = _txwritebuffer->Find(key);
+        if (written && written->value && written->value->has_merge_op() && _stream) {
+            // the operand buffered may be on its way to the txindex, combining with it would send it twice
+            sts = WaitStream();
+            if (!sts.IsOk()) {
+                return sts;
+            }
+            written = _txwritebuffer->Find(key);
+        }
+        auto saved_value = _txwritebuffer->NewValue();
+        saved_value->set_merge_op(op);
+        saved_value->set_content(operand);
+        if (written && written->value) {
+            // folded into this tx's own write, which is sent as one value
+            auto folded = _txwritebuffer->NewValue();
+            folded->CopyFrom(*written->value);
+            if (!FoldMerge(*folded, *saved_value)) {
+                ss << "Could not merge by " << op << " into TxWriteBuffer Key: " << key
+                   << " Value: " << written->value->ShortDebugString();
+                return Status::IllegalTxOp(ss.str());
+            }
+            saved_value = std::move(folded);
+        }
+        // operands do not conflict with each other, there is nothing to lock for them
+        WriteOptions saved_options = options;
+        saved_options.type = kOptimistic;
+
+        ss << "Merge in TxWriteBuffer key: " << key << " Value: " << saved_value->ShortDebugString();
+        if (saved_value->has_merge_op()) {
+            _merged = true;
+        }
+        _txwritebuffer->Write(key, std::move(saved_value), saved_options);
+        sts = CountUnstreamed(key.size() + operand.size());
+        if (!sts.IsOk()) {
+            return sts;
+        }
+        return Status::Ok(ss.str());
+    }
+
+    Status Transaction::CountUnstreamed(size_t bytes) {
+        if (_options->stream_prewrite_bytes == 0) {
+            return Status::Ok();
+        }
+        _unstreamed_bytes += bytes;
+        if (_unstreamed_bytes >= _options->stream_prewrite_bytes) {
+            return StreamPrewrite();
+        }
+        return Status::Ok();
+    }
+
+    Status Transaction::Get(const ReadOptions& options, const UserKey& key, UserValue& value) {
+        PhaseTimer timer(g_read_latency);
+        std::stringstream ss;
+        if (!_options->read_only) {
+            Status lock_sts = WaitLock(key);
+            if (!lock_sts.IsOk()) {
+                return lock_sts;
+            }
+            // the value of a streamed write is read from its intent
+            std::shared_ptr<Value> written = FindWritten(key);
+            bool streaming = false;
+            {
+                std::lock_guard<bthread::Mutex> lck(*_read_mutex);
+                streaming = _stream != nullptr;
+            }
+            if (written && written->has_merge_op() && streaming) {
+                // the txindex may have the operand already, which should not be folded twice
+                Status stream_sts = WaitStream();
+                if (!stream_sts.IsOk()) {
+                    return stream_sts;
+                }
+                written = FindWritten(key);
+            }
+            if (written && written->has_merge_op()) {
+                // this tx's own operand is folded onto what it reads without it
+                auto operand = written;
+                UserValue committed;
+                Status sts = ReadCommitted(key, committed);
+                if (!sts.IsOk() && !sts.IsNotFound()) {
+                    return sts;
+                }
+                Value folded;
+                if (sts.IsOk()) {
+                    folded.set_content(std::move(committed));
+                } else {
+                    folded.set_is_delete(true);
+                }
+                if (!FoldMerge(folded, *operand)) {
+                    ss << "Could not fold TxWriteBuffer Key: " << key << " Value: " << operand->ShortDebugString();
+                    return Status::TxIndexErr(ss.str());
+                }
+                value.swap(*folded.mutable_content());
+                return Status::Ok(sts.ToString());
+            }
+            if (written) {
+                auto v = written;
+                ss << "Find in TxWriteBuffer Key: " << key << " Value: " << v->ShortDebugString();
+                if (v->is_delete()) {
+                    return Status::NotFound(ss.str());
+                } else {
+                    value = v->content();
+                    return Status::Ok(ss.str());
+                }
+            }
+        }
+        return ReadCommitted(key, value);
+    }
+
+    Status Transaction::Prefetch(const ReadOptions& options, const std::vector<UserKey>& keys) {
+        std::stringstream ss;
+        if (!_txid) {
+            ss << "Transaction has not began. ";
+            return Status::IllegalTxOp(ss.str());
+        }
+        if (_txid->status().status_code() != TxStatus_Code_Started) {
+            ss << "Transaction is not allowed to prefetch. " << _txid->ShortDebugString();
+            return Status::IllegalTxOp(ss.str());
+        }
+
+        std::unique_ptr<PrefetchBatch> batch(new PrefetchBatch);
+        batch->calls.resize(_txindexs.size());
+        int call_num = 0;
+        std::lock_guard<bthread::Mutex> lck(*_read_mutex);
+        for (auto& key : keys) {
+            if (_prefetched.count(key) > 0 || _txwritebuffer->Find(key) != nullptr) {
+                continue;
+            }
+            auto txindex_num = butil::Hash(key) % _txindexs.size();
+            auto& call = batch->calls[txindex_num];
+            if (!call) {
+                call.reset(new BatchReadCall);
+                call->req.set_allocated_txid(new TxIdentifier(*_txid));
+                call_num++;
+            }
+            _prefetched[key] = std::make_pair(batch.get(), batch->positions.size());
+            batch->positions.push_back(std::make_pair(txindex_num, call->req.keys_size()));
+            call->req.add_keys(key);
+        }
+        if (call_num == 0) {
+            return Status::Ok();
+        }
+
+        // Storage is read only after the txindexes, since a version persisted and truncated in between
+        // would be missed by a storage read issued along with them.
+        batch->storage = _storage;
+        batch->storage_req.set_ts(_txid->start_ts());
+        batch->pending = call_num;
+        for (size_t i = 0; i < batch->calls.size(); i++) {
+            if (!batch->calls[i]) {
+                continue;
+            }
+            auto* call = batch->calls[i].get();
+            azino::txindex::TxOpService_Stub stub(_txindexs[i].get());
+            stub.BatchRead(&call->cntl, &call->req, &call->resp, brpc::NewCallback(batch.get(), &PrefetchBatch::OnBatchRead));
+        }
+        ss << "sdk: Prefetch key num: " << batch->positions.size();
+        _prefetches.push_back(std::move(batch));
+        return Status::Ok(ss.str());
+    }
+
+    bool Transaction::ReadPrefetched(const UserKey& key, UserValue& value, Status& sts) {
+        PrefetchBatch* batch = nullptr;
+        size_t i = 0;
+        {
+            std::lock_guard<bthread::Mutex> lck(*_read_mutex);
+            auto iter = _prefetched.find(key);
+            if (iter == _prefetched.end()) {
+                return false;
+            }
+            batch = iter->second.first;
+            i = iter->second.second;
+        }
+        batch->Wait(this);
+        auto* call = batch->calls[batch->positions[i].first].get();
+        auto j = batch->positions[i].second;
+        if (call->cntl.Failed() || call->resp.tx_op_statuses_size() != call->req.keys_size()
+            || call->resp.values_size() != call->req.keys_size()) {
+            return false;
+        }
+        std::stringstream ss;
+        ss << "Prefetched Key: " << key << " from txindex: " << call->resp.tx_op_statuses(j).ShortDebugString();
+        switch (call->resp.tx_op_statuses(j).error_code()) {
+            case TxOpStatus_Code_Ok:
+                if (call->resp.values(j).is_delete()) {
+                    sts = Status::NotFound(ss.str());
+                } else {
+                    value = call->resp.values(j).content();
+                    sts = Status::Ok(ss.str());
+                }
+                return true;
+            case TxOpStatus_Code_ReadNotExist:
+                break;
+            default:
+                // blocked or merged, read again to wait for or fold it
+                return false;
+        }
+
+        int k = batch->storage_positions[i];
+        if (k < 0 || batch->storage_cntl.Failed() || batch->storage_resp.results_size() != batch->storage_req.keys_size()) {
+            return false;
+        }
+        auto& result = batch->storage_resp.results(k);
+        ss << " from storage: " << result.status().ShortDebugString();
+        switch (result.status().error_code()) {
+            case storage::StorageStatus_Code_Ok:
+                value = result.value();
+                sts = Status::Ok(ss.str());
+                return true;
+            case storage::StorageStatus_Code_NotFound:
+                sts = Status::NotFound(ss.str());
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    bool Transaction::ReadCached(const UserKey& key, UserValue& value, Status& sts) {
+        // a key this tx wrote is read from its intent, which the cache knows nothing of
+        if (!_options->read_cache || HasWritten(key)) {
+            return false;
+        }
+        auto* txindex = _txindexs[butil::Hash(key) % _txindexs.size()].get();
+        Value cached;
+        if (!ReadCache::Global()->Get(txindex, key, _txid->start_ts(), cached)) {
+            return false;
+        }
+        std::stringstream ss;
+        ss << "Find in ReadCache Key: " << key << " Value: " << cached.ShortDebugString();
+        if (cached.is_delete()) {
+            sts = Status::NotFound(ss.str());
+        } else {
+            value.swap(*cached.mutable_content());
+            sts = Status::Ok(ss.str());
+        }
+        return true;
+    }
+
+    Status Transaction::ReadCommitted(const UserKey& key, UserValue& value) {
+        Status sts = Status::Ok();
+        if (ReadCached(key, value, sts) || ReadPrefetched(key, value, sts)) {
+            return sts;
+        }
+        ReadCall call(key, &value);
+        bthread::CountdownEvent event(1);
+        call.done = [&sts, &event](Status read_sts) {
+            sts = read_sts;
+            event.signal();
+        };
+        IssueRead(&call, true);
+        event.wait();
+        return sts;
+    }
+
+    void Transaction::IssueRead(ReadCall* call, bool resolve_async_commit) {
+        auto* txindex = _txindexs[butil::Hash(call->key) % _txindexs.size()].get();
+        azino::txindex::TxOpService_Stub stub(txindex);
+        call->cntl.Reset();
+        call->req.set_key(call->key);
+        call->req.set_allocated_txid(new TxIdentifier(*_txid));
+        call->req.set_resolve_async_commit(resolve_async_commit);
+        call->req.set_cache(_options->read_cache && ReadCache::Global()->Enabled(txindex));
+        call->resp.Clear();
+        stub.Read(&call->cntl, &call->req, &call->resp, brpc::NewCallback(this, &Transaction::OnRead, call));
+    }
+
+    void Transaction::OnRead(ReadCall* call) {
+        std::stringstream ss;
+        auto* txindex = _txindexs[butil::Hash(call->key) % _txindexs.size()].get();
+        auto& cntl = call->cntl;
+        auto& req = call->req;
+        auto& resp = call->resp;
+        CountRpc(RecordRpc(g_txindex_rpc, cntl, req, resp));
+        if (cntl.Failed()) {
+            ss << "Controller failed error code: " << cntl.ErrorCode() << " error text: " << cntl.ErrorText();
+            LOG(WARNING) << ss.str();
+            return FinishRead(call, Status::NetworkErr(ss.str()));
+        }
+        ss << "sdk: " << cntl.local_side() << " Read from txindex: " << cntl.remote_side() << std::endl
+           << "request: " << req.ShortDebugString() << std::endl
+           << "response: " << resp.ShortDebugString() << std::endl
+           << "latency=" << cntl.latency_us() << "us";
+        if (resp.has_contention()) {
+            ReportContention(resp.contention());
+        }
+        if (resp.no_change_log()) {
+            ReadCache::Global()->Disable(txindex);
+        }
+        call->cacheable = resp.has_cache_since();
+        call->cache_since = resp.cache_since();
+        switch (resp.tx_op_status().error_code()) {
+            case TxOpStatus_Code_Ok:
+                ss << " success. ";
+                LOG(INFO) << ss.str();
+                if (call->cacheable) {
+                    ReadCache::Global()->Put(txindex, call->key, _txid->start_ts(), call->cache_since, resp.value());
+                }
+                if (resp.value().is_delete()) {
+                    return FinishRead(call, Status::NotFound(ss.str()));
+                }
+                call->value->swap(*resp.mutable_value()->mutable_content());
+                return FinishRead(call, Status::Ok(ss.str()));
+            case TxOpStatus_Code_ReadNotExist: {
+                ss << " fail. ";
+                LOG(INFO) << ss.str();
+                // Storage is read only after the txindex has nothing visible, as a version persisted and truncated
+                // while both are read would be missed by a storage read issued before.
+                azino::storage::StorageService_Stub storage_stub(_storage.get());
+                call->storage_req.set_key(call->key);
+                call->storage_req.set_ts(_txid->start_ts());
+                storage_stub.MVCCGet(&call->storage_cntl, &call->storage_req, &call->storage_resp,
+                                     brpc::NewCallback(this, &Transaction::OnStorageRead, call));
+                return;
+            }
+            case TxOpStatus_Code_ReadAsyncIntent:
+                // Resolve the async-commit tx holding this key at most once, then just wait for it.
+                ss << " fail. ";
+                LOG(INFO) << ss.str();
+                ResolveAsyncCommit(resp.holder(), resp.async_commit());
+                return IssueRead(call, false);
+            case TxOpStatus_Code_ReadNeedBase: {
+                ss << " success. ";
+                LOG(INFO) << ss.str();
+                Value folded;
+                Status base_sts = ReadMergeBase(_storage.get(), call->key, resp.value().merge_base_ts(), folded);
+                if (!base_sts.IsOk()) {
+                    return FinishRead(call, base_sts);
+                }
+                if (!FoldMerge(folded, resp.value())) {
+                    ss << " Could not fold base: " << folded.ShortDebugString();
+                    LOG(ERROR) << ss.str();
+                    return FinishRead(call, Status::TxIndexErr(ss.str()));
+                }
+                call->value->swap(*folded.mutable_content());
+                return FinishRead(call, Status::Ok(ss.str()));
+            }
+            default:
+                ss << " fail. ";
+                LOG(ERROR) << ss.str();
+                return FinishRead(call, Status::TxIndexErr(ss.str()));
+        }
+    }
+
+    void Transaction::OnStorageRead(ReadCall* call) {
+        std::stringstream ss;
+        auto* txindex = _txindexs[butil::Hash(call->key) % _txindexs.size()].get();
+        auto& cntl = call->storage_cntl;
+        auto& resp = call->storage_resp;
+        CountRpc(RecordRpc(g_storage_rpc, cntl, call->storage_req, resp));
+        if (cntl.Failed()) {
+            ss << "Controller failed error code: " << cntl.ErrorCode() << " error text: " << cntl.ErrorText();
+            LOG(WARNING) << ss.str();
+            return FinishRead(call, Status::NetworkErr(ss.str()));
+        }
+        ss << "sdk: " << cntl.local_side() << " Read from storage: " << cntl.remote_side() << std::endl
+           << "request: " << call->storage_req.ShortDebugString() << std::endl
+           << "response: " << resp.ShortDebugString() << std::endl
+           << "latency=" << cntl.latency_us() << "us";
+        switch (resp.status().error_code()) {
             case storage::StorageStatus_Code_Ok:
-                storage_ss << " success. ";
-                LOG(INFO) << storage_ss.str();
-                value = storage_resp.value();
-                return Status::Ok(storage_ss.str());
+                ss << " success. ";
+                LOG(INFO) << ss.str();
+                if (call->cacheable) {
+                    Value v;
+                    v.set_content(resp.value());
+                    ReadCache::Global()->Put(txindex, call->key, _txid->start_ts(), call->cache_since, v);
+                }
+                call->value->swap(*resp.mutable_value());
+                return FinishRead(call, Status::Ok(ss.str()));
             case storage::StorageStatus_Code_NotFound:
-                storage_ss << " fail. ";
-                LOG(INFO) << storage_ss.str();
-                return Status::NotFound(storage_ss.str());
+                ss << " fail. ";
+                LOG(INFO) << ss.str();
+                if (call->cacheable) {
+                    Value v;
+                    v.set_is_delete(true);
+                    ReadCache::Global()->Put(txindex, call->key, _txid->start_ts(), call->cache_since, v);
+                }
+                return FinishRead(call, Status::NotFound(ss.str()));
             default:
-                storage_ss << " fail. ";
-                LOG(ERROR) << storage_ss.str();
-                return Status::StorageErr(storage_ss.str());
+                ss << " fail. ";
+                LOG(ERROR) << ss.str();
+                return FinishRead(call, Status::StorageErr(ss.str()));
+        }
+    }
+
+    void Transaction::FinishRead(ReadCall* call, Status sts) {
+        StatusCallback done = std::move(call->done);
+        if (call->timer) {
+            delete call;
+        }
+        done(sts);
+    }
+
+    Status Transaction::MultiGet(const ReadOptions& options, const std::vector<UserKey>& keys,
+                                 std::vector<UserValue>& values, std::vector<Status>& stss) {
+        PhaseTimer timer(g_read_latency);
+        values.assign(keys.size(), UserValue());
+        stss.assign(keys.size(), Status::Ok());
+        // one BatchRead for each txindex that these keys live on
+        std::vector<std::unique_ptr<BatchReadCall>> calls(_txindexs.size());
+        int call_num = 0;
+        std::vector<size_t> blocked_idxs; // keys blocked by intents or having operands to fold
+        for (size_t i = 0; i < keys.size(); i++) {
+            Status lock_sts = WaitLock(keys[i]);
+            if (!lock_sts.IsOk()) {
+                stss[i] = lock_sts;
+                continue;
+            }
+            auto written = FindWritten(keys[i]);
+            if (written && written->has_merge_op()) {
+                // read by Get, which folds the operand
+                blocked_idxs.push_back(i);
+                continue;
+            }
+            if (written) {
+                std::stringstream ss;
+                auto v = written;
+                ss << "Find in TxWriteBuffer Key: " << keys[i] << " Value: " << v->ShortDebugString();
+                if (v->is_delete()) {
+                    stss[i] = Status::NotFound(ss.str());
+                } else {
+                    values[i] = v->content();
+                    stss[i] = Status::Ok(ss.str());
+                }
+                continue;
+            }
+            auto txindex_num = butil::Hash(keys[i]) % _txindexs.size();
+            auto& call = calls[txindex_num];
+            if (!call) {
+                call.reset(new BatchReadCall);
+                call->req.set_allocated_txid(new TxIdentifier(*_txid));
+                call_num++;
+            }
+            call->req.add_keys(keys[i]);
+            call->idxs.push_back(i);
+        }
+
+        bthread::CountdownEvent event(call_num);
+        for (size_t i = 0; i < calls.size(); i++) {
+            if (!calls[i]) {
+                continue;
+            }
+            azino::txindex::TxOpService_Stub stub(_txindexs[i].get());
+            stub.BatchRead(&calls[i]->cntl, &calls[i]->req, &calls[i]->resp, brpc::NewCallback(SignalEvent, &event));
+        }
+        event.wait();
+        for (auto& call : calls) {
+            if (call) {
+                CountRpc(RecordRpc(g_txindex_rpc, call->cntl, call->req, call->resp));
+            }
+        }
+
+        std::vector<size_t> storage_idxs; // keys that txindexes do not have
+        for (auto& call : calls) {
+            if (!call) {
+                continue;
+            }
+            std::stringstream ss;
+            if (call->cntl.Failed()) {
+                ss << "Controller failed error code: " << call->cntl.ErrorCode() << " error text: " << call->cntl.ErrorText();
+                LOG(WARNING) << ss.str();
+                for (auto idx : call->idxs) {
+                    stss[idx] = Status::NetworkErr(ss.str());
+                }
+                continue;
+            }
+            ss << "sdk: " << call->cntl.local_side() << " BatchRead from txindex: " << call->cntl.remote_side() << std::endl
+               << "request: " << call->req.ShortDebugString() << std::endl
+               << "response: " << call->resp.ShortDebugString() << std::endl
+               << "latency=" << call->cntl.latency_us() << "us";
+            if (call->resp.tx_op_statuses_size() != (int)call->idxs.size()
+                || call->resp.values_size() != (int)call->idxs.size()) {
+                ss << " fail. ";
+                LOG(ERROR) << ss.str();
+                for (auto idx : call->idxs) {
+                    stss[idx] = Status::TxIndexErr(ss.str());
+                }
+                continue;
+            }
+            ss << " success. ";
+            LOG(INFO) << ss.str();
+            for (size_t j = 0; j < call->idxs.size(); j++) {
+                auto idx = call->idxs[j];
+                auto& sts = call->resp.tx_op_statuses(j);
+                switch (sts.error_code()) {
+                    case TxOpStatus_Code_Ok:
+                        if (call->resp.values(j).is_delete()) {
+                            stss[idx] = Status::NotFound(sts.error_message());
+                        } else {
+                            values[idx].swap(*call->resp.mutable_values(j)->mutable_content());
+                            stss[idx] = Status::Ok(sts.error_message());
+                        }
+                        break;
+                    case TxOpStatus_Code_ReadNotExist:
+                        storage_idxs.push_back(idx);
+                        break;
+                    case TxOpStatus_Code_ReadBlock:
+                    case TxOpStatus_Code_ReadNeedBase:
+                        blocked_idxs.push_back(idx);
+                        break;
+                    default:
+                        stss[idx] = Status::TxIndexErr(sts.error_message());
+                }
+            }
+        }
+
+        // one storage read for all the keys that txindexes do not have
+        if (!storage_idxs.empty()) {
+            azino::storage::StorageService_Stub storage_stub(_storage.get());
+            brpc::Controller storage_cntl;
+            azino::storage::MVCCMultiGetRequest storage_req;
+            storage_req.set_ts(_txid->start_ts());
+            for (auto idx : storage_idxs) {
+                storage_req.add_keys(keys[idx]);
+            }
+            azino::storage::MVCCMultiGetResponse storage_resp;
+            storage_stub.MVCCMultiGet(&storage_cntl, &storage_req, &storage_resp, nullptr);
+            CountRpc(RecordRpc(g_storage_rpc, storage_cntl, storage_req, storage_resp));
+            std::stringstream storage_ss;
+            if (storage_cntl.Failed()) {
+                storage_ss << "Controller failed error code: " << storage_cntl.ErrorCode() << " error text: " << storage_cntl.ErrorText();
+                LOG(WARNING) << storage_ss.str();
+                for (auto idx : storage_idxs) {
+                    stss[idx] = Status::NetworkErr(storage_ss.str());
+                }
+            } else {
+                storage_ss << "sdk: " << storage_cntl.local_side() << " MultiGet from storage: " << storage_cntl.remote_side() << std::endl
+                   << "request: " << storage_req.ShortDebugString() << std::endl
+                   << "response: " << storage_resp.ShortDebugString() << std::endl
+                   << "latency=" << storage_cntl.latency_us() << "us";
+                if (storage_resp.results_size() != (int)storage_idxs.size()) {
+                    storage_ss << " fail. ";
+                    LOG(ERROR) << storage_ss.str();
+                    for (auto idx : storage_idxs) {
+                        stss[idx] = Status::StorageErr(storage_ss.str());
+                    }
+                } else {
+                    storage_ss << " success. ";
+                    LOG(INFO) << storage_ss.str();
+                    for (size_t j = 0; j < storage_idxs.size(); j++) {
+                        auto idx = storage_idxs[j];
+                        auto& result = storage_resp.results(j);
+                        switch (result.status().error_code()) {
+                            case storage::StorageStatus_Code_Ok:
+                                values[idx].swap(*storage_resp.mutable_results(j)->mutable_value());
+                                stss[idx] = Status::Ok(result.status().error_message());
+                                break;
+                            case storage::StorageStatus_Code_NotFound:
+                                stss[idx] = Status::NotFound(result.status().error_message());
+                                break;
+                            default:
+                                stss[idx] = Status::StorageErr(result.status().error_message());
+                        }
+                    }
+                }
+            }
+        }
+
+        // keys blocked by intents are read one by one, waiting for or resolving those intents
+        for (auto idx : blocked_idxs) {
+            stss[idx] = Get(options, keys[idx], values[idx]);
+        }
+
+        for (auto& sts : stss) {
+            if (!sts.IsOk() && !sts.IsNotFound()) {
+                return sts;
+            }
+        }
+        return Status::Ok();
+    }
+
+    Status Transaction::Scan(const ReadOptions& options, const UserKey& start, const UserKey& end, size_t limit,
+                             std::vector<std::pair<UserKey, UserValue>>& kvs) {
+        PhaseTimer timer(g_read_latency);
+        kvs.clear();
+        // Every round reads a batch from each txindex and storage. Keys up to the smallest last key of a full batch
+        // are complete in all of them, so they are merged and returned, and the next round starts after that key.
+        // Storage is read only after the txindexes, so that a version persisted and truncated in between is not missed.
+        UserKey cursor = start;
+        while (true) {
+            uint32_t batch = FLAGS_scan_batch_size;
+            if (limit != 0 && limit - kvs.size() < batch) {
+                batch = limit - kvs.size();
+            }
+
+            std::vector<std::unique_ptr<ScanCall>> calls(_txindexs.size());
+            bthread::CountdownEvent event(calls.size());
+            for (size_t i = 0; i < calls.size(); i++) {
+                calls[i].reset(new ScanCall);
+                calls[i]->req.set_allocated_txid(new TxIdentifier(*_txid));
+                calls[i]->req.set_start(cursor);
+                calls[i]->req.set_end(end);
+                calls[i]->req.set_limit(batch);
+                azino::txindex::TxOpService_Stub stub(_txindexs[i].get());
+                stub.Scan(&calls[i]->cntl, &calls[i]->req, &calls[i]->resp, brpc::NewCallback(SignalEvent, &event));
+            }
+            event.wait();
+            for (auto& call : calls) {
+                CountRpc(RecordRpc(g_txindex_rpc, call->cntl, call->req, call->resp));
+            }
+
+            brpc::Controller storage_cntl;
+            azino::storage::MVCCScanRequest storage_req;
+            azino::storage::MVCCScanResponse storage_resp;
+            storage_req.set_start(cursor);
+            storage_req.set_end(end);
+            storage_req.set_ts(_txid->start_ts());
+            storage_req.set_limit(batch);
+            azino::storage::StorageService_Stub storage_stub(_storage.get());
+            storage_stub.MVCCScan(&storage_cntl, &storage_req, &storage_resp, nullptr);
+            CountRpc(RecordRpc(g_storage_rpc, storage_cntl, storage_req, storage_resp));
+
+            std::map<UserKey, ScanEntry> entries;
+            bool complete = true; // no batch is full, so everything till "end" is read
+            UserKey bound;
+            auto shrink_bound = [&](const UserKey& last) {
+                if (complete || last < bound) {
+                    bound = last;
+                }
+                complete = false;
+            };
+
+            std::stringstream ss;
+            if (storage_cntl.Failed()) {
+                ss << "Controller failed error code: " << storage_cntl.ErrorCode() << " error text: " << storage_cntl.ErrorText();
+                LOG(WARNING) << ss.str();
+                return Status::NetworkErr(ss.str());
+            }
+            ss << "sdk: " << storage_cntl.local_side() << " Scan from storage: " << storage_cntl.remote_side() << std::endl
+               << "request: " << storage_req.ShortDebugString() << std::endl
+               << "response size: " << storage_resp.datas_size() << std::endl
+               << "latency=" << storage_cntl.latency_us() << "us";
+            if (storage_resp.status().error_code() != storage::StorageStatus_Code_Ok) {
+                ss << " fail. ";
+                LOG(ERROR) << ss.str();
+                return Status::StorageErr(storage_resp.status().error_message());
+            }
+            ss << " success. ";
+            LOG(INFO) << ss.str();
+            // storage versions older than a range deleted by DeleteRange are deleted, till it is applied to storage
+            std::vector<const azino::txindex::RangeTombstone*> ranges;
+            for (auto& call : calls) {
+                if (!call->cntl.Failed()) {
+                    for (auto& range : call->resp.deleted_ranges()) {
+                        ranges.push_back(&range);
+                    }
+                }
+            }
+            for (auto& data : storage_resp.datas()) {
+                bool deleted = false;
+                for (auto range : ranges) {
+                    if (range->ts() > data.ts() && data.key() >= range->start()
+                        && (range->end().empty() || data.key() < range->end())) {
+                        deleted = true;
+                        break;
+                    }
+                }
+                if (!deleted) {
+                    entries[data.key()] = ScanEntry{ScanEntry::Live, data.value().content()};
+                }
+            }
+            if (storage_resp.datas_size() == (int)batch) {
+                shrink_bound(storage_resp.datas(batch - 1).key());
+            }
+
+            // versions in txindexes are newer than the ones persisted to storage
+            for (auto& call : calls) {
+                ss = std::stringstream();
+                if (call->cntl.Failed()) {
+                    ss << "Controller failed error code: " << call->cntl.ErrorCode() << " error text: " << call->cntl.ErrorText();
+                    LOG(WARNING) << ss.str();
+                    return Status::NetworkErr(ss.str());
+                }
+                ss << "sdk: " << call->cntl.local_side() << " Scan from txindex: " << call->cntl.remote_side() << std::endl
+                   << "request: " << call->req.ShortDebugString() << std::endl
+                   << "response size: " << call->resp.datas_size() << std::endl
+                   << "latency=" << call->cntl.latency_us() << "us";
+                if (call->resp.tx_op_status().error_code() != TxOpStatus_Code_Ok) {
+                    ss << " fail. ";
+                    LOG(ERROR) << ss.str();
+                    return Status::TxIndexErr(call->resp.tx_op_status().error_message());
+                }
+                ss << " success. ";
+                LOG(INFO) << ss.str();
+                for (auto& data : call->resp.datas()) {
+                    auto& entry = entries[data.key()];
+                    if (data.tx_op_status().error_code() == TxOpStatus_Code_ReadBlock
+                        || data.tx_op_status().error_code() == TxOpStatus_Code_ReadNeedBase) {
+                        entry.state = ScanEntry::Blocked;
+                    } else if (data.value().is_delete()) {
+                        entry.state = ScanEntry::Deleted;
+                    } else {
+                        entry.state = ScanEntry::Live;
+                        entry.value = data.value().content();
+                    }
+                }
+                if (call->resp.datas_size() == (int)batch) {
+                    shrink_bound(call->resp.datas(batch - 1).key());
+                }
+            }
+
+            // this tx's own writes come last
+            std::vector<std::pair<UserKey, std::shared_ptr<Value>>> writes;
+            {
+                std::lock_guard<bthread::Mutex> lck(*_read_mutex);
+                for (size_t i = 0; i < _txwritebuffer->ShardNum(); i++) {
+                    auto& shard = _txwritebuffer->GetShard(i);
+                    for (auto it = shard.lower_bound(cursor); it != shard.end(); it++) {
+                        if ((!end.empty() && it->first >= end) || (!complete && it->first > bound)) {
+                            break;
+                        }
+                        if (!it->second.value) {
+                            // streamed, and found by the txindexes
+                            continue;
+                        }
+                        writes.push_back(std::make_pair(it->first.as_string(), it->second.value));
+                    }
+                }
+            }
+            for (auto& write : writes) {
+                Status lock_sts = WaitLock(write.first);
+                if (!lock_sts.IsOk()) {
+                    return lock_sts;
+                }
+                auto& entry = entries[write.first];
+                if (write.second->has_merge_op()) {
+                    // folded by Get
+                    entry.state = ScanEntry::Blocked;
+                } else if (write.second->is_delete()) {
+                    entry.state = ScanEntry::Deleted;
+                } else {
+                    entry.state = ScanEntry::Live;
+                    entry.value = write.second->content();
+                }
+            }
+
+            for (auto& it : entries) {
+                if (!complete && it.first > bound) {
+                    break;
+                }
+                if (it.second.state == ScanEntry::Blocked) {
+                    // wait for or resolve the intent as Get does
+                    Status sts = Get(options, it.first, it.second.value);
+                    if (sts.IsNotFound()) {
+                        continue;
+                    } else if (!sts.IsOk()) {
+                        return sts;
+                    }
+                } else if (it.second.state == ScanEntry::Deleted) {
+                    continue;
+                }
+                kvs.push_back(std::make_pair(it.first, std::move(it.second.value)));
+                if (limit != 0 && kvs.size() == limit) {
+                    return Status::Ok();
+                }
+            }
+
+            if (complete) {
+                return Status::Ok();
+            }
+            cursor = bound + '\0';
+        }
+    }
+
+    Status RunInTransaction(const Options& options, const std::string& txplanner_addr,
+                            const TxFunction& func, const RetryOptions& retry_options) {
+        Transaction tx(options, txplanner_addr);
+        for (int attempt = 1; ; attempt++) {
+            Status sts = tx.Begin();
+            if (!sts.IsOk()) {
+                return sts;
+            }
+            sts = func(tx);
+            if (sts.IsOk()) {
+                sts = tx.Commit();
+            } else {
+                Status abort_sts = tx.Abort();
+                if (!abort_sts.IsOk()) {
+                    return abort_sts;
+                }
+            }
+            if (!sts.IsConflictErr()) {
+                return sts;
+            }
+            g_conflict_aborts << 1;
+            if (attempt >= retry_options.max_attempts) {
+                LOG(WARNING) << "Transaction gives up after " << attempt << " attempts. " << sts.ToString();
+                return sts;
+            }
+
+            Backoff(retry_options, attempt);
+            g_retries << 1;
+            tx.Reset();
+        }
+    }
+
+    Status CommitBatch(const std::string& txplanner_addr, const std::vector<std::vector<BatchWrite>>& txs,
+                       std::vector<Status>& stss) {
+        PhaseTimer timer(g_batch_commit_latency);
+        std::stringstream ss;
+        stss.assign(txs.size(), Status::Ok());
+        if (txs.empty()) {
+            return Status::Ok();
+        }
+
+        // the timestamps of all the txs in one rpc
+        auto txplanner = ChannelCache::Global()->Get(txplanner_addr);
+        azino::txplanner::TxService_Stub stub(txplanner.get());
+        brpc::Controller cntl;
+        azino::txplanner::BatchCommitTxRequest req;
+        req.set_count(txs.size());
+        azino::txplanner::BatchCommitTxResponse resp;
+        stub.BatchCommitTx(&cntl, &req, &resp, nullptr);
+        RecordRpc(g_txplanner_rpc, cntl, req, resp);
+        if (cntl.Failed()) {
+            ss << "Controller failed error code: " << cntl.ErrorCode() << " error text: " << cntl.ErrorText();
+            LOG(WARNING) << ss.str();
+            stss.assign(txs.size(), Status::NetworkErr(ss.str()));
+            return stss[0];
+        }
+        ss << "sdk: " << cntl.local_side() << " BatchCommitTx from txplanner: " << cntl.remote_side() << std::endl
+           << "request: " << req.ShortDebugString() << std::endl
+           << "response: " << resp.ShortDebugString() << std::endl
+           << "latency=" << cntl.latency_us() << "us";
+        if (resp.count() != txs.size() || resp.txindex_addrs_size() == 0) {
+            ss << " fail. ";
+            LOG(WARNING) << ss.str();
+            stss.assign(txs.size(), Status::NotSupportedErr(ss.str()));
+            return stss[0];
+        }
+        ss << " success. ";
+        LOG(INFO) << ss.str();
+
+        std::vector<std::shared_ptr<brpc::Channel>> txindexs;
+        for (int i = 0; i < resp.txindex_addrs_size(); i++) {
+            txindexs.push_back(ChannelCache::Global()->Get(resp.txindex_addrs(i)));
+        }
+
+        // A tx whose keys all live on one txindex is committed by it at once, others write intents on each txindex.
+        struct WriteCall {
+            brpc::Controller cntl;
+            azino::txindex::MultiTxWriteRequest req;
+            azino::txindex::MultiTxWriteResponse resp;
+            std::vector<size_t> one_phase; // the txs of req.one_phase
+            std::vector<size_t> intents; // the txs of req.intents
+        };
+        std::vector<WriteCall> writes(txindexs.size());
+        for (size_t i = 0; i < txs.size(); i++) {
+            TxIdentifier txid;
+            txid.set_start_ts(resp.first_start_ts() + i);
+            txid.set_commit_ts(resp.first_commit_ts() + i);
+            txid.mutable_status()->set_status_code(TxStatus_Code_Preputting);
+            std::map<size_t, std::map<UserKey, const BatchWrite*>> shards;
+            for (auto& w : txs[i]) {
+                shards[butil::Hash(w.key) % txindexs.size()][w.key] = &w;
+            }
+            for (auto& shard : shards) {
+                auto& call = writes[shard.first];
+                google::protobuf::RepeatedPtrField<azino::txindex::IntentData>* datas;
+                if (shards.size() == 1) {
+                    auto* tx = call.req.add_one_phase();
+                    tx->mutable_txid()->CopyFrom(txid);
+                    datas = tx->mutable_datas();
+                    call.one_phase.push_back(i);
+                } else {
+                    auto* tx = call.req.add_intents();
+                    tx->mutable_txid()->CopyFrom(txid);
+                    datas = tx->mutable_datas();
+                    call.intents.push_back(i);
+                }
+                for (auto& it : shard.second) {
+                    auto* data = datas->Add();
+                    data->set_key(it.first);
+                    data->mutable_value()->set_is_delete(it.second->is_delete);
+                    if (!it.second->is_delete) {
+                        data->mutable_value()->set_content(it.second->value);
+                    }
+                }
+            }
+        }
+
+        auto op_result = [](const TxOpStatus& sts, const std::string& msg) -> Status {
+            switch (sts.error_code()) {
+                case TxOpStatus_Code_Ok:
+                    return Status::Ok();
+                case TxOpStatus_Code_WriteTooLate:
+                case TxOpStatus_Code_WriteConflicts:
+                    return Status::ConflictErr(msg);
+                default:
+                    return Status::TxIndexErr(msg);
+            }
+        };
+        auto fail = [&stss](size_t i, const Status& sts) {
+            if (stss[i].IsOk()) {
+                stss[i] = sts;
+            }
+        };
+
+        {
+            bthread::CountdownEvent event(writes.size());
+            for (size_t t = 0; t < writes.size(); t++) {
+                auto& call = writes[t];
+                if (call.one_phase.empty() && call.intents.empty()) {
+                    event.signal();
+                    continue;
+                }
+                azino::txindex::TxOpService_Stub txindex_stub(txindexs[t].get());
+                txindex_stub.MultiTxWrite(&call.cntl, &call.req, &call.resp, brpc::NewCallback(SignalEvent, &event));
+            }
+            event.wait();
+        }
+        for (auto& call : writes) {
+            if (call.one_phase.empty() && call.intents.empty()) {
+                continue;
+            }
+            RecordRpc(g_txindex_rpc, call.cntl, call.req, call.resp);
+            ss = std::stringstream();
+            if (call.cntl.Failed()) {
+                // not sure whether the one phase txs are committed or not, intents written are cleaned below
+                ss << "Controller failed error code: " << call.cntl.ErrorCode() << " error text: " << call.cntl.ErrorText();
+                LOG(WARNING) << ss.str();
+                for (auto i : call.one_phase) {
+                    fail(i, Status::NetworkErr(ss.str()));
+                }
+                for (auto i : call.intents) {
+                    fail(i, Status::NetworkErr(ss.str()));
+                }
+                continue;
+            }
+            ss << "sdk: " << call.cntl.local_side() << " MultiTxWrite from txindex: " << call.cntl.remote_side() << std::endl
+               << "request one phase tx num: " << call.req.one_phase_size() << " intent tx num: " << call.req.intents_size() << std::endl
+               << "latency=" << call.cntl.latency_us() << "us";
+            LOG(INFO) << ss.str();
+            for (size_t j = 0; j < call.one_phase.size() && (int)j < call.resp.one_phase_size(); j++) {
+                auto& tx_resp = call.resp.one_phase(j);
+                for (auto& contention : tx_resp.contentions()) {
+                    ReportContention(contention);
+                }
+                fail(call.one_phase[j], op_result(tx_resp.tx_op_status(), tx_resp.ShortDebugString()));
+            }
+            for (size_t j = 0; j < call.intents.size() && (int)j < call.resp.intents_size(); j++) {
+                auto& tx_resp = call.resp.intents(j);
+                for (auto& contention : tx_resp.contentions()) {
+                    ReportContention(contention);
+                }
+                fail(call.intents[j], op_result(tx_resp.tx_op_status(), tx_resp.ShortDebugString()));
+            }
+        }
+
+        // The intents of a tx are committed if they are all written, and cleaned otherwise.
+        struct FinishCall {
+            brpc::Controller cntl;
+            azino::txindex::MultiTxFinishRequest req;
+            azino::txindex::MultiTxFinishResponse resp;
+            std::vector<size_t> commits; // the txs of req.commits
+        };
+        std::vector<FinishCall> finishes(txindexs.size());
+        for (size_t t = 0; t < writes.size(); t++) {
+            auto& call = writes[t];
+            for (size_t j = 0; j < call.intents.size(); j++) {
+                auto i = call.intents[j];
+                auto& tx = call.req.intents(j);
+                for (auto& data : tx.datas()) {
+                    if (stss[i].IsOk()) {
+                        auto* commit = finishes[t].req.add_commits();
+                        commit->mutable_txid()->CopyFrom(tx.txid());
+                        commit->mutable_txid()->mutable_status()->set_status_code(TxStatus_Code_Committing);
+                        commit->set_key(data.key());
+                        finishes[t].commits.push_back(i);
+                    } else {
+                        auto* clean = finishes[t].req.add_cleans();
+                        clean->mutable_txid()->CopyFrom(tx.txid());
+                        clean->mutable_txid()->mutable_status()->set_status_code(TxStatus_Code_Aborting);
+                        clean->set_key(data.key());
+                    }
+                }
+            }
+        }
+        {
+            bthread::CountdownEvent event(finishes.size());
+            for (size_t t = 0; t < finishes.size(); t++) {
+                auto& call = finishes[t];
+                if (call.req.commits_size() == 0 && call.req.cleans_size() == 0) {
+                    event.signal();
+                    continue;
+                }
+                azino::txindex::TxOpService_Stub txindex_stub(txindexs[t].get());
+                txindex_stub.MultiTxFinish(&call.cntl, &call.req, &call.resp, brpc::NewCallback(SignalEvent, &event));
+            }
+            event.wait();
+        }
+        for (auto& call : finishes) {
+            if (call.req.commits_size() == 0 && call.req.cleans_size() == 0) {
+                continue;
+            }
+            RecordRpc(g_txindex_rpc, call.cntl, call.req, call.resp);
+            ss = std::stringstream();
+            if (call.cntl.Failed()) {
+                // some intents of these txs may be committed already
+                ss << "Controller failed error code: " << call.cntl.ErrorCode() << " error text: " << call.cntl.ErrorText();
+                LOG(WARNING) << ss.str();
+                for (auto i : call.commits) {
+                    fail(i, Status::NetworkErr(ss.str()));
+                }
+                continue;
+            }
+            ss << "sdk: " << call.cntl.local_side() << " MultiTxFinish from txindex: " << call.cntl.remote_side() << std::endl
+               << "request commit num: " << call.req.commits_size() << " clean num: " << call.req.cleans_size() << std::endl
+               << "latency=" << call.cntl.latency_us() << "us";
+            LOG(INFO) << ss.str();
+            for (size_t j = 0; j < call.commits.size() && (int)j < call.resp.commits_size(); j++) {
+                auto& sts = call.resp.commits(j).tx_op_status();
+                if (sts.error_code() != TxOpStatus_Code_Ok) {
+                    LOG(ERROR) << "Batch commit fail. " << call.req.commits(j).ShortDebugString() << " " << sts.ShortDebugString();
+                    fail(call.commits[j], Status::TxIndexErr(sts.ShortDebugString()));
+                }
+            }
+            for (int j = 0; j < call.resp.cleans_size(); j++) {
+                auto& sts = call.resp.cleans(j).tx_op_status();
+                if (sts.error_code() != TxOpStatus_Code_Ok && sts.error_code() != TxOpStatus_Code_CleanNotExist) {
+                    LOG(WARNING) << "Batch clean fail. " << call.req.cleans(j).ShortDebugString() << " " << sts.ShortDebugString();
+                }
+            }
+        }
+
+        for (auto& sts : stss) {
+            if (!sts.IsOk()) {
+                return sts;
+            }
+        }
+        return Status::Ok();
+    }
+
+    Status DeleteRange(const std::string& txplanner_addr, const UserKey& start, const UserKey& end,
+                       const RetryOptions& retry_options) {
+        if (!end.empty() && end <= start) {
+            return Status::Ok();
+        }
+
+        // every txindex may hold keys of the range
+        struct DeleteRangeCall {
+            brpc::Controller cntl;
+            azino::txindex::DeleteRangeRequest req;
+            azino::txindex::DeleteRangeResponse resp;
+            std::shared_ptr<brpc::Channel> txindex;
+            bool deleted = false;
+        };
+        std::vector<DeleteRangeCall> calls;
+        auto txplanner = ChannelCache::Global()->Get(txplanner_addr);
+        for (int attempt = 1; ; attempt++) {
+            // Each attempt is a tx of its own, whose timestamps are taken like those of a batch of one,
+            // so that the parts blocked before are deleted above the writers waited for.
+            std::stringstream ss;
+            azino::txplanner::TxService_Stub stub(txplanner.get());
+            brpc::Controller cntl;
+            azino::txplanner::BatchCommitTxRequest req;
+            req.set_count(1);
+            azino::txplanner::BatchCommitTxResponse resp;
+            stub.BatchCommitTx(&cntl, &req, &resp, nullptr);
+            RecordRpc(g_txplanner_rpc, cntl, req, resp);
+            if (cntl.Failed()) {
+                ss << "Controller failed error code: " << cntl.ErrorCode() << " error text: " << cntl.ErrorText();
+                LOG(WARNING) << ss.str();
+                return Status::NetworkErr(ss.str());
+            }
+            ss << "sdk: " << cntl.local_side() << " BatchCommitTx from txplanner: " << cntl.remote_side() << std::endl
+               << "request: " << req.ShortDebugString() << std::endl
+               << "response: " << resp.ShortDebugString() << std::endl
+               << "latency=" << cntl.latency_us() << "us";
+            if (resp.count() != 1 || resp.txindex_addrs_size() == 0
+                || (!calls.empty() && calls.size() != (size_t)resp.txindex_addrs_size())) {
+                ss << " fail. ";
+                LOG(WARNING) << ss.str();
+                return Status::NotSupportedErr(ss.str());
+            }
+            ss << " success. ";
+            LOG(INFO) << ss.str();
+            if (calls.empty()) {
+                calls = std::vector<DeleteRangeCall>(resp.txindex_addrs_size());
+            }
+
+            TxIdentifier txid;
+            txid.set_start_ts(resp.first_start_ts());
+            txid.set_commit_ts(resp.first_commit_ts());
+            txid.mutable_status()->set_status_code(TxStatus_Code_Preputting);
+            {
+                bthread::CountdownEvent event(calls.size());
+                for (size_t i = 0; i < calls.size(); i++) {
+                    auto& call = calls[i];
+                    if (call.deleted) {
+                        event.signal();
+                        continue;
+                    }
+                    call.cntl.Reset();
+                    call.req.mutable_txid()->CopyFrom(txid);
+                    call.req.set_start(start);
+                    call.req.set_end(end);
+                    call.resp.Clear();
+                    call.txindex = ChannelCache::Global()->Get(resp.txindex_addrs(i));
+                    azino::txindex::TxOpService_Stub txindex_stub(call.txindex.get());
+                    txindex_stub.DeleteRange(&call.cntl, &call.req, &call.resp, brpc::NewCallback(SignalEvent, &event));
+                }
+                event.wait();
+            }
+            Status sts = Status::Ok();
+            Status blocked_sts = Status::Ok();
+            for (auto& call : calls) {
+                if (call.deleted) {
+                    continue;
+                }
+                RecordRpc(g_txindex_rpc, call.cntl, call.req, call.resp);
+                ss = std::stringstream();
+                if (call.cntl.Failed()) {
+                    ss << "Controller failed error code: " << call.cntl.ErrorCode() << " error text: " << call.cntl.ErrorText();
+                    LOG(WARNING) << ss.str();
+                    if (sts.IsOk()) {
+                        sts = Status::NetworkErr(ss.str());
+                    }
+                    continue;
+                }
+                ss << "sdk: " << call.cntl.local_side() << " DeleteRange from txindex: " << call.cntl.remote_side() << std::endl
+                   << "request: " << call.req.ShortDebugString() << std::endl
+                   << "response: " << call.resp.ShortDebugString() << std::endl
+                   << "latency=" << call.cntl.latency_us() << "us";
+                switch (call.resp.tx_op_status().error_code()) {
+                    case TxOpStatus_Code_Ok:
+                        ss << " success. ";
+                        LOG(INFO) << ss.str();
+                        call.deleted = true;
+                        break;
+                    case TxOpStatus_Code_WriteBlock:
+                        // a tx is writing some key in the range, this part is deleted again after a while
+                        ss << " blocked. ";
+                        LOG(INFO) << ss.str();
+                        if (blocked_sts.IsOk()) {
+                            blocked_sts = Status::ConflictErr(call.resp.tx_op_status().error_message());
+                        }
+                        break;
+                    default:
+                        ss << " fail. ";
+                        LOG(ERROR) << ss.str();
+                        if (sts.IsOk()) {
+                            sts = Status::TxIndexErr(call.resp.tx_op_status().error_message());
+                        }
+                }
+            }
+            if (!sts.IsOk() || blocked_sts.IsOk()) {
+                return sts;
+            }
+            if (attempt >= retry_options.max_attempts) {
+                LOG(WARNING) << "DeleteRange gives up after " << attempt << " attempts. " << blocked_sts.ToString();
+                return blocked_sts;
+            }
+            Backoff(retry_options, attempt);
         }
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,53 @@
+#include <butil/time.h>
+#include <gflags/gflags.h>
+
+#include "contentiontracker.h"
+
+namespace azino {
+
+DEFINE_int32(hot_key_conflicts, 2, "A key with this many recent write conflicts is locked pessimistically by kAutomatic writes");
+DEFINE_int32(hot_key_waiters, 1, "A key with this many ops waiting on it is locked pessimistically by kAutomatic writes");
+DEFINE_int32(hot_key_ttl_ms, 10000, "How long a key stays hot after it is last reported hot");
+DEFINE_int32(hot_key_capacity, 100000, "Max hot keys tracked by a process");
+
+    ContentionTracker* ContentionTracker::Global() {
+        static ContentionTracker* tracker = new ContentionTracker;
+        return tracker;
+    }
+
+    void ContentionTracker::Report(const std::string& key, uint32_t conflicts, uint32_t waiters) {
+        bool hot = conflicts >= (uint32_t)FLAGS_hot_key_conflicts || waiters >= (uint32_t)FLAGS_hot_key_waiters;
+        auto now = butil::gettimeofday_ms();
+        std::lock_guard<bthread::Mutex> lck(_mutex);
+        if (!hot) {
+            _hot_keys.erase(key);
+            return;
+        }
+        if (_hot_keys.size() >= (size_t)FLAGS_hot_key_capacity && _hot_keys.find(key) == _hot_keys.end()) {
+            for (auto iter = _hot_keys.begin(); iter != _hot_keys.end(); ) {
+                if (iter->second <= now) {
+                    iter = _hot_keys.erase(iter);
+                } else {
+                    iter++;
+                }
+            }
+            if (_hot_keys.size() >= (size_t)FLAGS_hot_key_capacity) {
+                return;
+            }
+        }
+        _hot_keys[key] = now + FLAGS_hot_key_ttl_ms;
+    }
+
+    bool ContentionTracker::IsHot(const std::string& key) {
+        std::lock_guard<bthread::Mutex> lck(_mutex);
+        auto iter = _hot_keys.find(key);
+        if (iter == _hot_keys.end()) {
+            return false;
+        }
+        if (iter->second <= butil::gettimeofday_ms()) {
+            _hot_keys.erase(iter);
+            return false;
+        }
+        return true;
+    }
+}
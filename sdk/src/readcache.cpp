@@ -0,0 +1,168 @@
+#include <brpc/channel.h>
+#include <gflags/gflags.h>
+#include <algorithm>
+#include <list>
+
+#include "readcache.h"
+#include "service/kv.pb.h"
+#include "service/txindex/txindex.pb.h"
+
+namespace azino {
+
+DEFINE_int32(read_cache_capacity, 100000, "Max keys cached by a process for each txindex");
+
+    struct ReadCache::Entry {
+        TimeStamp read_ts; // txs started before it may see an older version
+        Value value;
+        std::list<std::string>::iterator pos; // in Shard::lru
+    };
+
+    struct ReadCache::Shard {
+        Shard() : latest(0), covered_ts(MIN_TIMESTAMP), requested_ts(MIN_TIMESTAMP), disabled(false) {}
+        bthread::Mutex mutex; // guards the members below
+        std::unordered_map<std::string, Entry> entries;
+        std::list<std::string> lru; // the keys of entries, the most recently used first
+        uint64_t latest; // changes up to it are applied to entries
+        TimeStamp covered_ts; // txs started at or before it have seen a Changes rpc started after they began
+        TimeStamp requested_ts; // the largest start_ts looked up, which began before any Changes rpc started later
+        bool disabled; // the txindex keeps no change log
+        bthread::Mutex sync_mutex; // one Changes rpc at a time
+    };
+
+    ReadCache* ReadCache::Global() {
+        static ReadCache* cache = new ReadCache;
+        return cache;
+    }
+
+    ReadCache::Shard* ReadCache::shard(brpc::Channel* txindex) {
+        std::lock_guard<bthread::Mutex> lck(_mutex);
+        auto& s = _shards[txindex];
+        if (!s) {
+            s.reset(new Shard);
+        }
+        return s.get();
+    }
+
+    bool ReadCache::Get(brpc::Channel* txindex, const std::string& key, TimeStamp start_ts, Value& value) {
+        Shard* s = shard(txindex);
+        {
+            std::lock_guard<bthread::Mutex> lck(s->mutex);
+            auto iter = s->entries.find(key);
+            if (s->disabled || iter == s->entries.end() || iter->second.read_ts > start_ts) {
+                return false;
+            }
+            s->requested_ts = std::max(s->requested_ts, start_ts);
+        }
+        if (!sync(txindex, s, start_ts)) {
+            return false;
+        }
+        std::lock_guard<bthread::Mutex> lck(s->mutex);
+        auto iter = s->entries.find(key);
+        if (iter == s->entries.end() || iter->second.read_ts > start_ts) {
+            return false;
+        }
+        s->lru.splice(s->lru.begin(), s->lru, iter->second.pos);
+        value.CopyFrom(iter->second.value);
+        return true;
+    }
+
+    void ReadCache::Put(brpc::Channel* txindex, const std::string& key, TimeStamp read_ts, uint64_t since, const Value& value) {
+        Shard* s = shard(txindex);
+        std::lock_guard<bthread::Mutex> lck(s->mutex);
+        s->requested_ts = std::max(s->requested_ts, read_ts);
+        // changes between "since" and s->latest may have been applied already, without dropping this key
+        if (since < s->latest || s->disabled) {
+            return;
+        }
+        if (FLAGS_read_cache_capacity <= 0) {
+            return;
+        }
+        auto iter = s->entries.find(key);
+        if (iter == s->entries.end()) {
+            // the least recently used one makes room
+            if (s->entries.size() >= (size_t)FLAGS_read_cache_capacity) {
+                s->entries.erase(s->lru.back());
+                s->lru.pop_back();
+            }
+            s->lru.push_front(key);
+            iter = s->entries.insert(std::make_pair(key, Entry())).first;
+            iter->second.pos = s->lru.begin();
+        } else {
+            s->lru.splice(s->lru.begin(), s->lru, iter->second.pos);
+        }
+        auto& entry = iter->second;
+        entry.read_ts = read_ts;
+        entry.value.Clear();
+        entry.value.set_is_delete(value.is_delete());
+        entry.value.set_content(value.content());
+    }
+
+    bool ReadCache::Enabled(brpc::Channel* txindex) {
+        Shard* s = shard(txindex);
+        std::lock_guard<bthread::Mutex> lck(s->mutex);
+        return !s->disabled;
+    }
+
+    void ReadCache::Disable(brpc::Channel* txindex) {
+        Shard* s = shard(txindex);
+        std::lock_guard<bthread::Mutex> lck(s->mutex);
+        if (!s->disabled) {
+            LOG(WARNING) << "Txindex keeps no change log, stop caching reads of it.";
+        }
+        s->disabled = true;
+        s->entries.clear();
+        s->lru.clear();
+    }
+
+    bool ReadCache::sync(brpc::Channel* txindex, Shard* s, TimeStamp start_ts) {
+        std::lock_guard<bthread::Mutex> sync_lck(s->sync_mutex);
+        azino::txindex::ChangesRequest req;
+        TimeStamp cover;
+        {
+            std::lock_guard<bthread::Mutex> lck(s->mutex);
+            if (s->covered_ts >= start_ts) {
+                return true;
+            }
+            req.set_since(s->latest);
+            cover = s->requested_ts;
+        }
+
+        std::stringstream ss;
+        azino::txindex::TxOpService_Stub stub(txindex);
+        brpc::Controller cntl;
+        azino::txindex::ChangesResponse resp;
+        stub.Changes(&cntl, &req, &resp, nullptr);
+        if (cntl.Failed()) {
+            ss << "Controller failed error code: " << cntl.ErrorCode() << " error text: " << cntl.ErrorText();
+            LOG(WARNING) << ss.str();
+            return false;
+        }
+        ss << "sdk: " << cntl.local_side() << " Changes from txindex: " << cntl.remote_side() << std::endl
+           << "request: " << req.ShortDebugString() << std::endl
+           << "response latest: " << resp.latest() << " key num: " << resp.keys_size()
+           << (resp.truncated() ? " truncated" : "") << std::endl
+           << "latency=" << cntl.latency_us() << "us";
+        LOG(INFO) << ss.str();
+        if (resp.no_change_log()) {
+            Disable(txindex);
+            return false;
+        }
+
+        std::lock_guard<bthread::Mutex> lck(s->mutex);
+        if (resp.truncated()) {
+            s->entries.clear();
+            s->lru.clear();
+        } else {
+            for (auto& key : resp.keys()) {
+                auto iter = s->entries.find(key);
+                if (iter != s->entries.end()) {
+                    s->lru.erase(iter->second.pos);
+                    s->entries.erase(iter);
+                }
+            }
+        }
+        s->latest = resp.latest();
+        s->covered_ts = std::max(s->covered_ts, cover);
+        return true;
+    }
+}
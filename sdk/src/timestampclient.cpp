@@ -0,0 +1,97 @@
+#include <brpc/channel.h>
+#include <unordered_map>
+
+#include "timestampclient.h"
+#include "channelcache.h"
+#include "service/tx.pb.h"
+#include "service/txplanner/txplanner.pb.h"
+
+namespace azino {
+
+    struct TimestampClient::Waiter {
+        explicit Waiter(txplanner::BeginTxResponse* r) : resp(r), sts(Status::Ok()), done(false) {}
+        txplanner::BeginTxResponse* resp;
+        Status sts;
+        bool done;
+    };
+
+    TimestampClient* TimestampClient::Global(const std::string& addr) {
+        static bthread::Mutex mutex;
+        static auto* clients = new std::unordered_map<std::string, std::unique_ptr<TimestampClient>>();
+        std::lock_guard<bthread::Mutex> lck(mutex);
+        auto& client = (*clients)[addr];
+        if (!client) {
+            client.reset(new TimestampClient(addr));
+        }
+        return client.get();
+    }
+
+    TimestampClient::TimestampClient(const std::string& addr)
+    : _txplanner(ChannelCache::Global()->Get(addr)),
+      _in_flight(false) {}
+
+    Status TimestampClient::BeginTx(txplanner::BeginTxResponse& resp) {
+        Waiter w(&resp);
+        std::unique_lock<bthread::Mutex> lck(_mutex);
+        _pending.push_back(&w);
+        while (!w.done) {
+            if (_in_flight) {
+                _cond.wait(lck);
+                continue;
+            }
+            // become the leader, and send all the pending calls in one rpc
+            std::vector<Waiter*> batch;
+            batch.swap(_pending);
+            _in_flight = true;
+            lck.unlock();
+            batchBeginTx(batch);
+            lck.lock();
+            for (auto* b : batch) {
+                b->done = true;
+            }
+            _in_flight = false;
+            _cond.notify_all();
+        }
+        return w.sts;
+    }
+
+    void TimestampClient::batchBeginTx(const std::vector<Waiter*>& batch) {
+        std::stringstream ss;
+        azino::txplanner::TxService_Stub stub(_txplanner.get());
+        brpc::Controller cntl;
+        azino::txplanner::BatchBeginTxRequest req;
+        req.set_count(batch.size());
+        azino::txplanner::BatchBeginTxResponse resp;
+        stub.BatchBeginTx(&cntl, &req, &resp, nullptr);
+        if (cntl.Failed()) {
+            ss << "Controller failed error code: " << cntl.ErrorCode() << " error text: " << cntl.ErrorText();
+            LOG(WARNING) << ss.str();
+            for (auto* w : batch) {
+                w->sts = Status::NetworkErr(ss.str());
+            }
+            return;
+        }
+        ss << "sdk: " << cntl.local_side() << " BatchBeginTx from txplanner: " << cntl.remote_side() << std::endl
+           << "request: " << req.ShortDebugString() << std::endl
+           << "response: " << resp.ShortDebugString() << std::endl
+           << "latency=" << cntl.latency_us() << "us";
+        if (resp.count() != batch.size()) {
+            ss << " fail. ";
+            LOG(ERROR) << ss.str();
+            for (auto* w : batch) {
+                w->sts = Status::NotSupportedErr(ss.str());
+            }
+            return;
+        }
+        ss << " success. ";
+        LOG(INFO) << ss.str();
+        for (size_t i = 0; i < batch.size(); i++) {
+            auto* r = batch[i]->resp;
+            r->mutable_txid()->set_start_ts(resp.first_start_ts() + i);
+            r->mutable_txid()->mutable_status()->set_status_code(TxStatus_Code_Started);
+            r->mutable_txindex_addrs()->CopyFrom(resp.txindex_addrs());
+            r->set_storage_addr(resp.storage_addr());
+            batch[i]->sts = Status::Ok(ss.str());
+        }
+    }
+}
@@ -38,11 +38,26 @@ namespace storage {
                              ::azino::storage::MVCCGetResponse* response,
                              ::google::protobuf::Closure* done) override;
 
+        virtual void MVCCMultiGet(::google::protobuf::RpcController* controller,
+                                  const ::azino::storage::MVCCMultiGetRequest* request,
+                                  ::azino::storage::MVCCMultiGetResponse* response,
+                                  ::google::protobuf::Closure* done) override;
+
+        virtual void MVCCScan(::google::protobuf::RpcController* controller,
+                              const ::azino::storage::MVCCScanRequest* request,
+                              ::azino::storage::MVCCScanResponse* response,
+                              ::google::protobuf::Closure* done) override;
+
         virtual void MVCCDelete(::google::protobuf::RpcController* controller,
                                 const ::azino::storage::MVCCDeleteRequest* request,
                                 ::azino::storage::MVCCDeleteResponse* response,
                                 ::google::protobuf::Closure* done) override;
 
+        virtual void MVCCDeleteRange(::google::protobuf::RpcController* controller,
+                                     const ::azino::storage::MVCCDeleteRangeRequest* request,
+                                     ::azino::storage::MVCCDeleteRangeResponse* response,
+                                     ::google::protobuf::Closure* done) override;
+
         virtual void BatchStore(::google::protobuf::RpcController* controller,
                             const ::azino::storage::BatchStoreRequest* request,
                             ::azino::storage::BatchStoreResponse* response,
@@ -1,6 +1,8 @@
 #ifndef AZINO_STORAGE_INCLUDE_STORAGE_H
 #define AZINO_STORAGE_INCLUDE_STORAGE_H
 
+#include <functional>
+#include <map>
 #include <string>
 #include <sstream>
 #include <butil/macros.h>
@@ -52,6 +54,13 @@ namespace storage {
         // May return some other Status on an error.
         virtual StorageStatus Seek(const std::string &key,std::string &found_key,std::string &value) = 0;
 
+        // Call "visitor" on database entries whose keys are equal or bigger than "start" in bitwise order,
+        // until there is no more entry or "visitor" returns false.
+        //
+        // May return some other Status on an error.
+        virtual StorageStatus Iterate(const std::string &start,
+                                      const std::function<bool(const std::string &key, const std::string &value)> &visitor) = 0;
+
         struct Data {
             const std::string key;
             const std::string value;
@@ -129,6 +138,103 @@ namespace storage {
             }
         }
 
+        // Store the newest value whose timestamp is not bigger than "ts" of every user key in ["start", "end") into datas,
+        // in key order and at most "limit" of them. Keys whose newest value is marked deleted are skipped.
+        // An empty "end" means no upper bound, and a zero "limit" means no limit.
+        //
+        // May return some other Status on an error.
+        virtual StorageStatus MVCCScan(const std::string &start, const std::string &end, TimeStamp ts,
+                                       uint32_t limit, std::vector<Data> &datas) {
+            struct Version {
+                std::string value;
+                TimeStamp ts;
+                bool is_delete;
+            };
+            // Versions of a user key may interleave with those of longer keys it prefixes,
+            // so keep the visible version of each key met, and stop once no unseen key can rank within "limit".
+            std::map<std::string, Version> visible;
+            uint32_t live = 0;
+            auto prefix = InternalKey::LowerBound("");
+            auto stop = end.empty() ? std::string() : InternalKey::UpperBound(end);
+
+            StorageStatus ss = Iterate(InternalKey::LowerBound(start),
+                                       [&](const std::string &key, const std::string &value) {
+                if (key.compare(0, prefix.length(), prefix) != 0 || (!stop.empty() && key > stop)) {
+                    return false;
+                }
+                auto internal_key = InternalKey(key);
+                auto user_key = internal_key.UserKey();
+                if (!internal_key.Valid() || internal_key.TS() > ts || user_key < start
+                    || (!end.empty() && user_key >= end) || visible.find(user_key) != visible.end()) {
+                    return true;
+                }
+                if (limit != 0 && live == limit && user_key > visible.rbegin()->first) {
+                    return true;
+                }
+                // the first version met is the newest one not bigger than "ts"
+                visible.insert(std::make_pair(user_key, Version{value, internal_key.TS(), internal_key.IsDelete()}));
+                if (!internal_key.IsDelete()) {
+                    live++;
+                }
+                if (limit != 0 && live > limit) {
+                    // drop the biggest live key and the deleted ones after it
+                    while (live > limit) {
+                        auto last = std::prev(visible.end());
+                        if (!last->second.is_delete) {
+                            live--;
+                        }
+                        visible.erase(last);
+                    }
+                }
+                if (limit != 0 && live == limit) {
+                    while (visible.rbegin()->second.is_delete) {
+                        visible.erase(std::prev(visible.end()));
+                    }
+                    stop = InternalKey::UpperBound(visible.rbegin()->first);
+                }
+                return true;
+            });
+            if (ss.error_code() != StorageStatus::Ok) {
+                return ss;
+            }
+
+            for (auto &it : visible) {
+                if (!it.second.is_delete) {
+                    datas.push_back(Data{it.first, it.second.value, it.second.ts, false});
+                }
+            }
+            return ss;
+        }
+
+        // Mark every user key in ["start", "end") deleted at "ts", skipping keys whose newest value not bigger than
+        // "ts" is marked deleted already, so that it could be applied again. At most "limit" keys are marked
+        // if "limit" is not 0, then "next" is set to the key to go on from, and it is cleared when all are marked.
+        //
+        // May return some other Status on an error.
+        virtual StorageStatus MVCCDeleteRange(const std::string &start, const std::string &end, TimeStamp ts,
+                                              uint32_t limit, std::string &next) {
+            std::vector<Data> live;
+            next.clear();
+            StorageStatus ss = MVCCScan(start, end, ts, limit == 0 ? 0 : limit + 1, live);
+            if (ss.error_code() != StorageStatus::Ok) {
+                return ss;
+            }
+            size_t n = live.size();
+            if (limit != 0 && n > limit) {
+                n = limit;
+                next = live[limit].key;
+            }
+            if (n == 0) {
+                return ss;
+            }
+            std::vector<Data> datas;
+            datas.reserve(n);
+            for (size_t i = 0; i < n; i++) {
+                datas.push_back(Data{live[i].key, "", ts, true});
+            }
+            return BatchStore(datas);
+        }
+
     };
 
 } // namespace storage
@@ -24,6 +24,14 @@ namespace storage {
 
         bool Valid() const;
 
+        // The smallest encoded key of any version of a user key not smaller than "user_key".
+        static std::string LowerBound(const std::string &user_key);
+
+        // The largest encoded key of any version of "user_key" or of a user key that is its prefix.
+        // Encoded keys do not keep the order of user keys when one is a prefix of another,
+        // so a range of user keys ends here rather than at the encoding of its end.
+        static std::string UpperBound(const std::string &user_key);
+
     private:
         void decode(const std::string &internal_key);
         constexpr static const char *format_prefix = "MVCCKEY";
@@ -137,6 +137,26 @@ namespace {
 
         }
 
+        virtual StorageStatus Iterate(const std::string &start,
+                                      const std::function<bool(const std::string &key, const std::string &value)> &visitor) override {
+            if (_leveldbptr == nullptr) {
+                StorageStatus ss;
+                ss.set_error_code(StorageStatus::InvalidArgument);
+                ss.set_error_message("Haven't opened an leveldb");
+                return ss;
+            }
+            leveldb::ReadOptions opt;
+            opt.verify_checksums = true;
+            opt.fill_cache = false;
+            std::unique_ptr<leveldb::Iterator> iter(_leveldbptr->NewIterator(opt));
+            for (iter->Seek(start); iter->Valid(); iter->Next()) {
+                if (!visitor(iter->key().ToString(), iter->value().ToString())) {
+                    break;
+                }
+            }
+            return LevelDBStatus(iter->status());
+        }
+
    private:
         std::unique_ptr<leveldb::DB> _leveldbptr;
     };
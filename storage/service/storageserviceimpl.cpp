@@ -123,6 +123,63 @@ namespace storage {
         }
     }
 
+    void StorageServiceImpl::MVCCMultiGet(::google::protobuf::RpcController *controller,
+                                          const ::azino::storage::MVCCMultiGetRequest *request,
+                                          ::azino::storage::MVCCMultiGetResponse *response,
+                                          ::google::protobuf::Closure *done) {
+        brpc::ClosureGuard done_guard(done);
+        brpc::Controller *cntl = static_cast<brpc::Controller *>(controller);
+
+        for (auto& key : request->keys()) {
+            std::string value;
+            TimeStamp ts;
+            StorageStatus ss = _storage->MVCCGet(key, request->ts(), value, ts);
+            auto* result = response->add_results();
+            if (ss.error_code() == StorageStatus_Code_Ok || ss.error_code() == StorageStatus_Code_NotFound) {
+                LOG(INFO) << cntl->remote_side() << ss.error_message();
+                result->set_ts(ts);
+                if (ss.error_code() == StorageStatus_Code_Ok) result->set_value(value);
+            } else {
+                LOG(WARNING) << cntl->remote_side() << ss.error_message();
+                if (!response->has_status()) {
+                    response->mutable_status()->CopyFrom(ss);
+                }
+            }
+            result->mutable_status()->Swap(&ss);
+        }
+    }
+
+    void StorageServiceImpl::MVCCScan(::google::protobuf::RpcController *controller,
+                                      const ::azino::storage::MVCCScanRequest *request,
+                                      ::azino::storage::MVCCScanResponse *response,
+                                      ::google::protobuf::Closure *done) {
+        brpc::ClosureGuard done_guard(done);
+        brpc::Controller *cntl = static_cast<brpc::Controller *>(controller);
+
+        std::vector<Storage::Data> datas;
+        StorageStatus ss = _storage->MVCCScan(request->start(), request->end(), request->ts(), request->limit(), datas);
+        if (ss.error_code() != StorageStatus::Ok) {
+            LOG(WARNING) << cntl->remote_side() << " Fail to scan mvcc keys from: " << request->start()
+                         << " to: " << request->end()
+                         << " ts: " << request->ts()
+                         << " error code: " << ss.error_code()
+                         << " error message: " << ss.error_message();
+        } else {
+            LOG(INFO) << cntl->remote_side() << " Success to scan mvcc keys from: " << request->start()
+                      << " to: " << request->end()
+                      << " ts: " << request->ts()
+                      << " found: " << datas.size();
+            for (auto &data : datas) {
+                auto* d = response->add_datas();
+                d->set_key(data.key);
+                d->set_ts(data.ts);
+                d->mutable_value()->set_content(data.value);
+                d->mutable_value()->set_is_delete(false);
+            }
+        }
+        response->mutable_status()->Swap(&ss);
+    }
+
     void StorageServiceImpl::MVCCDelete(::google::protobuf::RpcController *controller,
                                         const ::azino::storage::MVCCDeleteRequest *request,
                                         ::azino::storage::MVCCDeleteResponse *response,
@@ -144,6 +201,33 @@ namespace storage {
         }
     }
 
+    void StorageServiceImpl::MVCCDeleteRange(::google::protobuf::RpcController *controller,
+                                             const ::azino::storage::MVCCDeleteRangeRequest *request,
+                                             ::azino::storage::MVCCDeleteRangeResponse *response,
+                                             ::google::protobuf::Closure *done) {
+        brpc::ClosureGuard done_guard(done);
+        brpc::Controller* cntl = static_cast<brpc::Controller*>(controller);
+
+        std::string next;
+        StorageStatus ss = _storage->MVCCDeleteRange(request->start(), request->end(), request->ts(), request->limit(), next);
+        if (ss.error_code() != StorageStatus::Ok) {
+            LOG(WARNING) << cntl->remote_side() << " Fail to delete mvcc keys from: " << request->start()
+                         << " to: " << request->end()
+                         << " ts: " << request->ts()
+                         << " error code: " << ss.error_code()
+                         << " error message: " << ss.error_message();
+        } else {
+            LOG(INFO) << cntl->remote_side() << " Success to delete mvcc keys from: " << request->start()
+                      << " to: " << request->end()
+                      << " ts: " << request->ts()
+                      << " next: " << next;
+            if (!next.empty()) {
+                response->set_next(next);
+            }
+        }
+        response->mutable_status()->Swap(&ss);
+    }
+
     void StorageServiceImpl::BatchStore(::google::protobuf::RpcController* controller,
                                 const ::azino::storage::BatchStoreRequest* request,
                                 ::azino::storage::BatchStoreResponse* response,
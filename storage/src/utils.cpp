@@ -46,6 +46,22 @@ namespace storage {
         return _ts;
     }
 
+    std::string InternalKey::LowerBound(const std::string &user_key) {
+        return format_prefix + user_key;
+    }
+
+    std::string InternalKey::UpperBound(const std::string &user_key) {
+        // every version of "p" sorts before "p" followed by the largest ts and delete tag
+        std::string bound;
+        for (size_t len = 0; len <= user_key.length(); len++) {
+            auto candidate = format_prefix + user_key.substr(0, len) + std::string(ts_length, 'f') + '1';
+            if (candidate > bound) {
+                bound = candidate;
+            }
+        }
+        return bound;
+    }
+
     void InternalKey::decode(const std::string &internal_key) {
         if (internal_key.length() < strlen(format_prefix) + ts_length + delete_tag_length) {
             _valid = false;
@@ -106,3 +106,76 @@ TEST_F(DBImplTest, mvccbatch) {
 
     ASSERT_EQ(storage->MVCCGet("233", 16, seeked_value, ts).error_code(), azino::storage::StorageStatus_Code_NotFound);
 }
+
+TEST_F(DBImplTest, mvccscan) {
+    // "a0" is bigger than "a" but its encoded keys are smaller than those of "a"
+    ASSERT_EQ(storage->MVCCPut("a", 5, "a5").error_code(), azino::storage::StorageStatus_Code_Ok);
+    ASSERT_EQ(storage->MVCCPut("a", 10, "a10").error_code(), azino::storage::StorageStatus_Code_Ok);
+    ASSERT_EQ(storage->MVCCPut("a0", 7, "a07").error_code(), azino::storage::StorageStatus_Code_Ok);
+    ASSERT_EQ(storage->MVCCPut("b", 3, "b3").error_code(), azino::storage::StorageStatus_Code_Ok);
+    ASSERT_EQ(storage->MVCCDelete("b", 8).error_code(), azino::storage::StorageStatus_Code_Ok);
+    ASSERT_EQ(storage->MVCCPut("c", 20, "c20").error_code(), azino::storage::StorageStatus_Code_Ok);
+
+    std::vector<azino::storage::Storage::Data> datas;
+    ASSERT_EQ(storage->MVCCScan("a", "", 9, 0, datas).error_code(), azino::storage::StorageStatus_Code_Ok);
+    ASSERT_EQ(datas.size(), 2);
+    ASSERT_EQ(datas[0].key, "a");
+    ASSERT_EQ(datas[0].value, "a5");
+    ASSERT_EQ(datas[0].ts, 5);
+    ASSERT_EQ(datas[1].key, "a0");
+    ASSERT_EQ(datas[1].value, "a07");
+
+    datas.clear();
+    ASSERT_EQ(storage->MVCCScan("a", "", 9, 1, datas).error_code(), azino::storage::StorageStatus_Code_Ok);
+    ASSERT_EQ(datas.size(), 1);
+    ASSERT_EQ(datas[0].key, "a");
+
+    datas.clear();
+    ASSERT_EQ(storage->MVCCScan("a", "a0", 12, 0, datas).error_code(), azino::storage::StorageStatus_Code_Ok);
+    ASSERT_EQ(datas.size(), 1);
+    ASSERT_EQ(datas[0].value, "a10");
+
+    datas.clear();
+    ASSERT_EQ(storage->MVCCScan("", "", 25, 0, datas).error_code(), azino::storage::StorageStatus_Code_Ok);
+    ASSERT_EQ(datas.size(), 3);
+    ASSERT_EQ(datas[2].key, "c");
+
+    datas.clear();
+    ASSERT_EQ(storage->MVCCScan("", "", 4, 0, datas).error_code(), azino::storage::StorageStatus_Code_Ok);
+    ASSERT_EQ(datas.size(), 1);
+    ASSERT_EQ(datas[0].key, "b");
+    ASSERT_EQ(datas[0].value, "b3");
+}
+
+TEST_F(DBImplTest, mvccdeleterange) {
+    ASSERT_EQ(storage->MVCCPut("a", 5, "a5").error_code(), azino::storage::StorageStatus_Code_Ok);
+    ASSERT_EQ(storage->MVCCPut("b", 3, "b3").error_code(), azino::storage::StorageStatus_Code_Ok);
+    ASSERT_EQ(storage->MVCCDelete("b", 4).error_code(), azino::storage::StorageStatus_Code_Ok);
+    ASSERT_EQ(storage->MVCCPut("c", 6, "c6").error_code(), azino::storage::StorageStatus_Code_Ok);
+    ASSERT_EQ(storage->MVCCPut("c", 20, "c20").error_code(), azino::storage::StorageStatus_Code_Ok);
+    ASSERT_EQ(storage->MVCCPut("d", 20, "d20").error_code(), azino::storage::StorageStatus_Code_Ok);
+    ASSERT_EQ(storage->MVCCPut("e", 5, "e5").error_code(), azino::storage::StorageStatus_Code_Ok);
+
+    std::string next;
+    ASSERT_EQ(storage->MVCCDeleteRange("a", "e", 10, 1, next).error_code(), azino::storage::StorageStatus_Code_Ok);
+    ASSERT_EQ(next, "c");
+    ASSERT_EQ(storage->MVCCDeleteRange(next, "e", 10, 1, next).error_code(), azino::storage::StorageStatus_Code_Ok);
+    ASSERT_TRUE(next.empty());
+
+    std::string value;
+    azino::TimeStamp ts;
+    ASSERT_EQ(storage->MVCCGet("a", 10, value, ts).error_code(), azino::storage::StorageStatus_Code_NotFound);
+    ASSERT_EQ(storage->MVCCGet("a", 9, value, ts).error_code(), azino::storage::StorageStatus_Code_Ok);
+    ASSERT_EQ(value, "a5");
+    ASSERT_EQ(storage->MVCCGet("c", 15, value, ts).error_code(), azino::storage::StorageStatus_Code_NotFound);
+    ASSERT_EQ(storage->MVCCGet("c", 25, value, ts).error_code(), azino::storage::StorageStatus_Code_Ok);
+    ASSERT_EQ(value, "c20");
+    ASSERT_EQ(storage->MVCCGet("d", 25, value, ts).error_code(), azino::storage::StorageStatus_Code_Ok);
+    ASSERT_EQ(storage->MVCCGet("e", 25, value, ts).error_code(), azino::storage::StorageStatus_Code_Ok);
+
+    // applied again, nothing is left to mark
+    std::vector<azino::storage::Storage::Data> datas;
+    ASSERT_EQ(storage->MVCCDeleteRange("a", "e", 10, 0, next).error_code(), azino::storage::StorageStatus_Code_Ok);
+    ASSERT_EQ(storage->MVCCScan("a", "e", 10, 0, datas).error_code(), azino::storage::StorageStatus_Code_Ok);
+    ASSERT_TRUE(datas.empty());
+}
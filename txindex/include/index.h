@@ -7,13 +7,20 @@
 #include "gflags/gflags.h"
 
 #include <functional>
+#include <memory>
 #include <string>
 
 DECLARE_int32(latch_bucket_num);
+DECLARE_int32(change_log_size);
 
 namespace azino {
 namespace txindex {
     struct DataToPersist;
+    struct DataToWrite;
+    struct AsyncIntent;
+    struct ScannedData;
+    struct Contention;
+    struct DeletedRange;
     typedef std::map<TimeStamp, std::shared_ptr<Value>, std::greater<TimeStamp>> MultiVersionValue;
     class TxIndex {
     public:
@@ -35,20 +42,117 @@ namespace txindex {
         // This is an atomic read-write operation for one user_key, used in both pessimistic and optimistic transactions.
         // Success when no newer version of this key, intent or lock exists.
         // Should success if txid already hold this intent or lock, and change lock to intent at the same time.
-        virtual TxOpStatus WriteIntent(const std::string& key, const Value& v, const TxIdentifier& txid) = 0;
+        // A merge operand (see Value::merge_op) is kept aside as a merge intent instead, so that many txs could
+        // merge into one key at the same time. It only conflicts with others' intents and locks and with versions
+        // newer than txid's commit_ts, and is folded into txid's own intent if there is one. It fails with MergeFailed
+        // if its operator is unknown, or differs from the operands since the latest whole value.
+        // Plain intents and locks conflict with and wait for others' merge intents in turn.
+        // "v" is kept by the index rather than copied, and should not be changed afterwards.
+        virtual TxOpStatus WriteIntent(const std::string& key, const std::shared_ptr<Value>& v, const TxIdentifier& txid) = 0;
+
+        // WriteIntent only if the value txid sees is "expected", checked under the same latch acquisition.
+        // A deleted "expected" means the key should have no value.
+        // Fails with ConditionFailed if it is not, or with ConditionUnknown if the value is only in storage or merged,
+        // writing nothing in both cases.
+        virtual TxOpStatus ConditionalWriteIntent(const std::string& key, const std::shared_ptr<Value>& v, const Value& expected, const TxIdentifier& txid) = 0;
+
+        // WriteIntent on every data of one tx, keys in the same latch bucket are written under one latch acquisition.
+        // A streamed data (see DataToWrite) is written before txid takes a commit_ts. Readers pass its intent rather
+        // than wait for the whole tx, so the tx should commit after them: writing the key again, or a data without
+        // value which only gives txid and its commit_ts to the intent, fails with WriteTooLate if a reader started
+        // at or after that commit_ts has passed it.
+        // "stss" is filled with the status of each data in order.
+        // Returns the first failed status, or Ok if every data successes.
+        virtual TxOpStatus BatchWriteIntent(const std::vector<DataToWrite>& datas, const TxIdentifier& txid, std::vector<TxOpStatus>& stss) = 0;
+
+        // This is an atomic read-write operation for all the keys of one tx, used when the tx only writes to this txindex.
+        // Every data is checked as WriteIntent does, then all of them are committed at txid's commit_ts,
+        // or none of them if any check fails. No intent is left in between.
+        // "stss" is filled with the status of each data in order.
+        // Returns the first failed status, or Ok if every data is committed.
+        virtual TxOpStatus OnePhaseCommit(const std::vector<DataToWrite>& datas, const TxIdentifier& txid, std::vector<TxOpStatus>& stss) = 0;
 
         // This is an atomic read-write operation for one user_key, used in both pessimistic and optimistic transactions.
-        // Success when it finds and cleans this tx's intent or lock for this key
+        // Success when it finds and cleans this tx's intent or lock for this key.
+        // Cleaning the primary intent of an async-commit tx aborts the tx, and the outcome is kept on the key
+        // till ForgetAsyncCommit. It fails with TxCommitted if the tx has been committed there instead.
+        // Finding nothing of the tx, it fails with CleanNotExist and fences the key for FLAGS_clean_fence_ms,
+        // so that a delayed intent of the tx is refused with TxAborted, as if the tx was aborted there.
         virtual TxOpStatus Clean(const std::string& key, const TxIdentifier& txid) = 0;
 
         // This is an atomic read-write operation for one user_key, used in both pessimistic and optimistic transactions.
-        // Success when it finds and commit this tx's intent for this key
+        // Success when it finds and commit this tx's intent for this key.
+        // Committing the primary intent of an async-commit tx commits the tx, and the outcome is kept on the key
+        // till ForgetAsyncCommit, so committing it again successes. It fails with TxAborted if the tx has been aborted there.
         virtual TxOpStatus Commit(const std::string& key, const TxIdentifier& txid) = 0;
 
         // Current implementation uses snapshot isolation.
         // read will be blocked if there exists and intent who has a smaller ts than read's ts.
+        // A streamed intent whose tx has no commit_ts yet is passed instead, see BatchWriteIntent.
         // read will bypass any lock, and return the key value pair who has the biggest ts among all that have ts smaller than read's ts.
-        virtual TxOpStatus Read(const std::string& key, Value& v, const TxIdentifier& txid, std::function<void()> callback) = 0;
+        // Merge operands are folded onto the version before them. If that version is not in txindex, it returns ReadNeedBase
+        // with the operands folded together, and the reader should fold them onto storage's value at merge_base_ts.
+        // "v" shares the value kept by the index rather than copying it, and is left nullptr if nothing is read.
+        virtual TxOpStatus Read(const std::string& key, std::shared_ptr<const Value>& v, const TxIdentifier& txid, std::function<void()> callback) = 0;
+
+        // Same as the above, except that it is not blocked by an intent of an async-commit tx.
+        // It returns ReadAsyncIntent and fills "intent" instead, so that the reader can resolve that tx by itself.
+        virtual TxOpStatus Read(const std::string& key, std::shared_ptr<const Value>& v, const TxIdentifier& txid, std::function<void()> callback, AsyncIntent& intent) = 0;
+
+        // Read on every key of one tx without blocking, keys in the same latch bucket are read under one latch acquisition.
+        // A key blocked by an intent gets ReadBlock, and should be read again by Read.
+        // "vs" and "stss" are filled for each key in order.
+        // Returns the first status other than Ok, ReadNotExist, ReadBlock and ReadNeedBase, or Ok if there is none.
+        virtual TxOpStatus BatchRead(const std::vector<std::string>& keys, std::vector<std::shared_ptr<const Value>>& vs, const TxIdentifier& txid, std::vector<TxOpStatus>& stss) = 0;
+
+        // Read on every key in ["start", "end") without blocking, in key order. An empty "end" means no upper bound.
+        // Only keys having a version visible to txid (Ok), blocked by an intent (ReadBlock) or having operands to fold (ReadNeedBase) are filled,
+        // at most "limit" of them if "limit" is not 0. Keys not filled should be read from storage.
+        virtual TxOpStatus Scan(const std::string& start, const std::string& end, uint32_t limit, const TxIdentifier& txid, std::vector<ScannedData>& datas) = 0;
+
+        // This is an atomic read operation for one user_key, used by readers resolving async-commit txs.
+        // Success when txid holds an intent on this key, and fills "info" with the intent's async commit info.
+        // On the primary key of a tx committed or aborted already, it returns TxCommitted or TxAborted
+        // and fills "info" with all the keys of the tx, so that the others could be resolved the same way.
+        virtual TxOpStatus QueryIntent(const std::string& key, const TxIdentifier& txid, AsyncCommitInfo& info) = 0;
+
+        // Drops the outcome of async-commit tx txid kept on its primary key, once all its other keys are resolved.
+        virtual TxOpStatus ForgetAsyncCommit(const std::string& key, const TxIdentifier& txid) = 0;
+
+        // Reports how contended one user_key is, so that clients could lock hot keys pessimistically.
+        virtual TxOpStatus GetContention(const std::string& key, Contention& contention) = 0;
+
+        // Every write that may change what a key reads, an intent or a commit, is numbered and kept in a log of
+        // FLAGS_change_log_size, so that clients caching reads could learn which keys to drop.
+        // The numbers keep growing across restarts. Returns the number of the latest change.
+        virtual uint64_t LatestChange() = 0;
+
+        // Fills "keys" with the keys changed after change "since", and "latest" with LatestChange().
+        // Returns false if those changes are not all in the log any more.
+        virtual bool ChangesSince(uint64_t since, std::vector<std::string>& keys, uint64_t& latest) = 0;
+
+        // Whether a read of key at "ts" that began after change "since" could be cached by the reader, that is,
+        // it saw the latest version of key, no one is writing key, and key has not changed since then.
+        // A key the index holds nothing of only has versions persisted before this index started.
+        virtual bool Cacheable(const std::string& key, TimeStamp ts, uint64_t since) = 0;
+
+        // This is an atomic write for all the keys in ["start", "end") of one tx, committed at txid's commit_ts at once.
+        // An empty "end" means no upper bound. Keys the index holds get a deleted version, and the keys only in storage
+        // are covered by a range tombstone that reads respect, until the persistor has applied it to storage.
+        // It is a blind write ordered with other writes by commit_ts, so txs started before commit_ts fail to write keys
+        // in the range afterwards. It fails with WriteBlock, deleting nothing, while a tx holds a lock or an intent
+        // on a key in the range, and should be retried with a later commit_ts after that tx finishes.
+        virtual TxOpStatus DeleteRange(const std::string& start, const std::string& end, const TxIdentifier& txid) = 0;
+
+        // Fills "ranges" with the range tombstones overlapping ["start", "end") at or before "ts".
+        // Versions in storage of the keys in them older than their ts are deleted.
+        virtual void DeletedRanges(const std::string& start, const std::string& end, TimeStamp ts, std::vector<DeletedRange>& ranges) = 0;
+
+        // Fills "range" with the oldest range tombstone not applied to storage yet, returns false if there is none.
+        virtual bool GetPersistingRange(DeletedRange& range) = 0;
+
+        // Drops a range tombstone applied to storage.
+        virtual void ClearPersistedRange(const DeletedRange& range) = 0;
 
         virtual TxOpStatus GetPersisting(std::vector<DataToPersist> &datas) = 0;
 
@@ -58,6 +162,32 @@ namespace txindex {
         std::string key;
         MultiVersionValue t2vs;
     };
+    struct DataToWrite {
+        const std::string* key;
+        // kept by the index rather than copied, should not be changed afterwards.
+        // nullptr only gives txid to the intent written before, see TxIndex::BatchWriteIntent.
+        std::shared_ptr<Value> value;
+        const AsyncCommitInfo* async_commit; // nullptr if the tx does not commit asynchronously
+        bool streamed; // written before the tx takes its commit_ts, see TxIndex::BatchWriteIntent
+    };
+    struct ScannedData {
+        std::string key;
+        std::shared_ptr<const Value> value; // nullptr if blocked
+        TxOpStatus status;
+    };
+    struct Contention {
+        uint32_t conflicts; // write conflicts met recently, decayed over time
+        uint32_t waiters; // ops blocked on the key right now
+    };
+    struct DeletedRange {
+        std::string start;
+        std::string end; // exclusive, empty means no upper bound
+        TimeStamp ts;
+    };
+    struct AsyncIntent {
+        TxIdentifier holder;
+        AsyncCommitInfo info;
+    };
 } // namespace txindex
 } // namespace azino
 
@@ -34,6 +34,14 @@ namespace txindex {
         //therefore if persist is called, it can make sure to access _txindex's data.
         void persist();
 
+        //Need hold _mutex before call this func.
+        //Applies the range tombstones of _txindex to storage, oldest first.
+        void persistRanges();
+
+        // Folds the merge operands of "data" onto the versions before them, reading storage for the oldest one.
+        // Returns false if some could not be folded.
+        bool foldMerges(DataToPersist& data);
+
         static void *execute(void *args);
 
         std::unique_ptr<storage::StorageService_Stub> _stub;
@@ -1,6 +1,7 @@
 #ifndef AZINO_TXINDEX_INCLUDE_SERVICE_H
 #define AZINO_TXINDEX_INCLUDE_SERVICE_H
 
+#include <butil/iobuf.h>
 #include <butil/macros.h>
 #include <string>
 
@@ -20,6 +21,18 @@ namespace txindex {
                                  const ::azino::txindex::WriteIntentRequest* request,
                                  ::azino::txindex::WriteIntentResponse* response,
                                  ::google::protobuf::Closure* done) override;
+        virtual void ConditionalWriteIntent(::google::protobuf::RpcController* controller,
+                                            const ::azino::txindex::ConditionalWriteIntentRequest* request,
+                                            ::azino::txindex::ConditionalWriteIntentResponse* response,
+                                            ::google::protobuf::Closure* done) override;
+        virtual void BatchWriteIntent(::google::protobuf::RpcController* controller,
+                                      const ::azino::txindex::BatchWriteIntentRequest* request,
+                                      ::azino::txindex::BatchWriteIntentResponse* response,
+                                      ::google::protobuf::Closure* done) override;
+        virtual void OnePhaseCommit(::google::protobuf::RpcController* controller,
+                                    const ::azino::txindex::OnePhaseCommitRequest* request,
+                                    ::azino::txindex::OnePhaseCommitResponse* response,
+                                    ::google::protobuf::Closure* done) override;
         virtual void WriteLock(::google::protobuf::RpcController* controller,
                                const ::azino::txindex::WriteLockRequest* request,
                                ::azino::txindex::WriteLockResponse* response,
@@ -36,8 +49,46 @@ namespace txindex {
                           const ::azino::txindex::ReadRequest* request,
                           ::azino::txindex::ReadResponse* response,
                           ::google::protobuf::Closure* done) override;
+        virtual void BatchRead(::google::protobuf::RpcController* controller,
+                               const ::azino::txindex::BatchReadRequest* request,
+                               ::azino::txindex::BatchReadResponse* response,
+                               ::google::protobuf::Closure* done) override;
+        virtual void Scan(::google::protobuf::RpcController* controller,
+                          const ::azino::txindex::ScanRequest* request,
+                          ::azino::txindex::ScanResponse* response,
+                          ::google::protobuf::Closure* done) override;
+        virtual void QueryIntent(::google::protobuf::RpcController* controller,
+                                 const ::azino::txindex::QueryIntentRequest* request,
+                                 ::azino::txindex::QueryIntentResponse* response,
+                                 ::google::protobuf::Closure* done) override;
+        virtual void ForgetAsyncCommit(::google::protobuf::RpcController* controller,
+                                       const ::azino::txindex::ForgetAsyncCommitRequest* request,
+                                       ::azino::txindex::ForgetAsyncCommitResponse* response,
+                                       ::google::protobuf::Closure* done) override;
+        virtual void Changes(::google::protobuf::RpcController* controller,
+                             const ::azino::txindex::ChangesRequest* request,
+                             ::azino::txindex::ChangesResponse* response,
+                             ::google::protobuf::Closure* done) override;
+        virtual void MultiTxWrite(::google::protobuf::RpcController* controller,
+                                  const ::azino::txindex::MultiTxWriteRequest* request,
+                                  ::azino::txindex::MultiTxWriteResponse* response,
+                                  ::google::protobuf::Closure* done) override;
+        virtual void MultiTxFinish(::google::protobuf::RpcController* controller,
+                                   const ::azino::txindex::MultiTxFinishRequest* request,
+                                   ::azino::txindex::MultiTxFinishResponse* response,
+                                   ::google::protobuf::Closure* done) override;
+        virtual void DeleteRange(::google::protobuf::RpcController* controller,
+                                 const ::azino::txindex::DeleteRangeRequest* request,
+                                 ::azino::txindex::DeleteRangeResponse* response,
+                                 ::google::protobuf::Closure* done) override;
 
     private:
+        void fillContention(const std::string& key, KeyContention* contention);
+        // Fill "response" like the rpcs of the same names, returning false if "attachment" is too short.
+        bool batchWriteIntent(const BatchWriteIntentRequest& request, butil::IOBuf& attachment,
+                              BatchWriteIntentResponse* response);
+        bool onePhaseCommit(const OnePhaseCommitRequest& request, butil::IOBuf& attachment,
+                            OnePhaseCommitResponse* response);
         std::unique_ptr<TxIndex> _index;
     };
 } // namespace txindex
@@ -1,7 +1,9 @@
 #include "persistor.h"
+#include "azino/merge.h"
 #include <gflags/gflags.h>
 
 DEFINE_int32(persist_period, 10000, "Persist period time. Measurement: millisecond.");
+DEFINE_int32(persist_range_batch, 10000, "Max keys marked deleted by one rpc applying a range tombstone to storage");
 
 namespace azino {
 namespace txindex {
@@ -52,6 +54,7 @@ namespace txindex {
                 break;
             }
             p->persist();
+            p->persistRanges();
         }
         return nullptr;
     }
@@ -63,6 +66,17 @@ namespace txindex {
             assert(datas.empty());
         } else {
             assert(!datas.empty());
+            // storage only keeps whole values, keys whose operands could not be folded wait for the next round
+            for (auto iter = datas.begin(); iter != datas.end();) {
+                if (foldMerges(*iter)) {
+                    iter++;
+                } else {
+                    iter = datas.erase(iter);
+                }
+            }
+            if (datas.empty()) {
+                return;
+            }
             brpc::Controller cntl;
             azino::storage::BatchStoreRequest req;
             azino::storage::BatchStoreResponse resp;
@@ -93,5 +107,80 @@ namespace txindex {
             return;
         }
     }
+
+    void Persistor::persistRanges() {
+        DeletedRange range;
+        while (_txindex->GetPersistingRange(range)) {
+            // storage marks a batch of keys at a time, to go on from where the last one stopped
+            std::string next = range.start;
+            do {
+                brpc::Controller cntl;
+                azino::storage::MVCCDeleteRangeRequest req;
+                azino::storage::MVCCDeleteRangeResponse resp;
+                req.set_start(next);
+                req.set_end(range.end);
+                req.set_ts(range.ts);
+                req.set_limit(FLAGS_persist_range_batch);
+                _stub->MVCCDeleteRange(&cntl, &req, &resp, NULL);
+                if (cntl.Failed()) {
+                    LOG(WARNING) << "Controller failed error code: " << cntl.ErrorCode() << " error text: " << cntl.ErrorText();
+                    return;
+                }
+                if (resp.status().error_code() != storage::StorageStatus_Code_Ok) {
+                    LOG(ERROR) << "Fail to delete mvcc range from: " << next << " to: " << range.end
+                               << " ts: " << range.ts << " error code: " << resp.status().error_code()
+                               << " error msg: " << resp.status().error_message();
+                    return;
+                }
+                next = resp.next();
+            } while (!next.empty());
+            _txindex->ClearPersistedRange(range);
+        }
+    }
+
+    bool Persistor::foldMerges(DataToPersist& data) {
+        std::shared_ptr<Value> prev; // the version before, folded already
+        for (auto iter = data.t2vs.rbegin(); iter != data.t2vs.rend(); iter++) {
+            if (!iter->second->has_merge_op()) {
+                prev = iter->second;
+                continue;
+            }
+            auto folded = std::make_shared<Value>();
+            if (prev) {
+                folded->CopyFrom(*prev);
+            } else {
+                // the oldest version in txindex folds onto the latest one persisted
+                brpc::Controller cntl;
+                azino::storage::MVCCGetRequest req;
+                azino::storage::MVCCGetResponse resp;
+                req.set_key(data.key);
+                req.set_ts(iter->first - 1);
+                _stub->MVCCGet(&cntl, &req, &resp, NULL);
+                if (cntl.Failed()) {
+                    LOG(WARNING) << "Controller failed error code: " << cntl.ErrorCode() << " error text: " << cntl.ErrorText();
+                    return false;
+                }
+                if (resp.status().error_code() == storage::StorageStatus_Code_Ok) {
+                    folded->set_content(resp.value());
+                } else if (resp.status().error_code() == storage::StorageStatus_Code_NotFound) {
+                    folded->set_is_delete(true);
+                } else {
+                    LOG(ERROR) << "Fail to get the base of merge operands, key: " << data.key
+                               << " error code: " << resp.status().error_code()
+                               << " error msg: " << resp.status().error_message();
+                    return false;
+                }
+            }
+            if (!FoldMerge(*folded, *iter->second)) {
+                LOG(ERROR) << "Fail to fold merge operand, key: " << data.key << " ts: " << iter->first
+                           << " value: " << iter->second->ShortDebugString();
+                return false;
+            }
+            // only the copy to persist is replaced, txindex keeps the operand
+            iter->second = folded;
+            prev = std::move(folded);
+        }
+        return true;
+    }
 }
 }
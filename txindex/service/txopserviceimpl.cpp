@@ -5,6 +5,29 @@
 
 namespace azino {
 namespace txindex {
+namespace {
+    // Takes "value" of a request for the index, cutting its content from "attachment" if "request" sends it there.
+    // Returns nullptr if "attachment" is too short.
+    template <typename Request>
+    std::shared_ptr<Value> TakeIntentValue(const Request& request, const Value& value, butil::IOBuf& attachment) {
+        std::shared_ptr<Value> v = std::make_shared<Value>();
+        v->set_is_delete(value.is_delete());
+        if (value.has_merge_op()) {
+            v->set_merge_op(value.merge_op());
+        }
+        if (!request.has_attachment_size()) {
+            v->set_content(value.content());
+            return v;
+        }
+        auto* content = v->mutable_content();
+        content->reserve(request.attachment_size());
+        if (attachment.cutn(content, request.attachment_size()) != request.attachment_size()) {
+            return nullptr;
+        }
+        return v;
+    }
+}
+
     TxOpServiceImpl::TxOpServiceImpl(const std::string& storage_addr)
     : _index(TxIndex::DefaultTxIndex(storage_addr)) {}
     TxOpServiceImpl::~TxOpServiceImpl() = default;
@@ -21,8 +44,72 @@ namespace txindex {
            << " key: " << request->key() << " value: " << request->value().ShortDebugString();
         LOG(INFO) << ss.str();
 
-        TxOpStatus* sts = new TxOpStatus(_index->WriteIntent(request->key(), request->value(), request->txid()));
+        auto v = TakeIntentValue(*request, request->value(), cntl->request_attachment());
+        if (!v) {
+            cntl->SetFailed(brpc::EREQUEST, "attachment is shorter than the value");
+            return;
+        }
+        TxOpStatus* sts = new TxOpStatus(_index->WriteIntent(request->key(), v, request->txid()));
+        response->set_allocated_tx_op_status(sts);
+        fillContention(request->key(), response->mutable_contention());
+    }
+
+    void TxOpServiceImpl::ConditionalWriteIntent(::google::protobuf::RpcController* controller,
+                                        const ::azino::txindex::ConditionalWriteIntentRequest* request,
+                                        ::azino::txindex::ConditionalWriteIntentResponse* response,
+                                        ::google::protobuf::Closure* done) {
+        brpc::ClosureGuard done_guard(done);
+        brpc::Controller *cntl = static_cast<brpc::Controller *>(controller);
+
+        std::stringstream ss;
+        ss << cntl->remote_side() << " tx: " << request->txid().ShortDebugString() << " is going to conditional write intent"
+           << " key: " << request->key() << " value: " << request->value().ShortDebugString()
+           << " expected: " << request->expected().ShortDebugString();
+        LOG(INFO) << ss.str();
+
+        auto v = TakeIntentValue(*request, request->value(), cntl->request_attachment());
+        if (!v) {
+            cntl->SetFailed(brpc::EREQUEST, "attachment is shorter than the value");
+            return;
+        }
+        TxOpStatus* sts = new TxOpStatus(_index->ConditionalWriteIntent(request->key(), v,
+                                                                        request->expected(), request->txid()));
         response->set_allocated_tx_op_status(sts);
+        fillContention(request->key(), response->mutable_contention());
+    }
+
+    void TxOpServiceImpl::BatchWriteIntent(::google::protobuf::RpcController* controller,
+                                  const ::azino::txindex::BatchWriteIntentRequest* request,
+                                  ::azino::txindex::BatchWriteIntentResponse* response,
+                                  ::google::protobuf::Closure* done) {
+        brpc::ClosureGuard done_guard(done);
+        brpc::Controller *cntl = static_cast<brpc::Controller *>(controller);
+
+        std::stringstream ss;
+        ss << cntl->remote_side() << " tx: " << request->txid().ShortDebugString() << " is going to batch write intent"
+           << " key num: " << request->datas_size();
+        LOG(INFO) << ss.str();
+
+        if (!batchWriteIntent(*request, cntl->request_attachment(), response)) {
+            cntl->SetFailed(brpc::EREQUEST, "attachment is shorter than the values of datas");
+        }
+    }
+
+    void TxOpServiceImpl::OnePhaseCommit(::google::protobuf::RpcController* controller,
+                                const ::azino::txindex::OnePhaseCommitRequest* request,
+                                ::azino::txindex::OnePhaseCommitResponse* response,
+                                ::google::protobuf::Closure* done) {
+        brpc::ClosureGuard done_guard(done);
+        brpc::Controller *cntl = static_cast<brpc::Controller *>(controller);
+
+        std::stringstream ss;
+        ss << cntl->remote_side() << " tx: " << request->txid().ShortDebugString() << " is going to one phase commit"
+           << " key num: " << request->datas_size();
+        LOG(INFO) << ss.str();
+
+        if (!onePhaseCommit(*request, cntl->request_attachment(), response)) {
+            cntl->SetFailed(brpc::EREQUEST, "attachment is shorter than the values of datas");
+        }
     }
 
     void TxOpServiceImpl::WriteLock(::google::protobuf::RpcController* controller,
@@ -44,6 +131,7 @@ namespace txindex {
             delete sts;
         } else {
             response->set_allocated_tx_op_status(sts);
+            fillContention(request->key(), response->mutable_contention());
         }
     }
 
@@ -91,17 +179,291 @@ namespace txindex {
            << " key: " << request->key();
         LOG(INFO) << ss.str();
 
-        Value* v = new Value();
-        TxOpStatus* sts = new TxOpStatus(_index->Read(request->key(), *v, request->txid(),
-                                                           std::bind(&TxOpServiceImpl::Read, this, controller, request, response, done)));
+        // taken before reading, so that changes racing with the read are seen by Cacheable
+        uint64_t since = request->cache() ? _index->LatestChange() : 0;
+        std::shared_ptr<const Value> v;
+        TxOpStatus* sts = nullptr;
+        if (request->resolve_async_commit()) {
+            AsyncIntent intent;
+            sts = new TxOpStatus(_index->Read(request->key(), v, request->txid(),
+                                              std::bind(&TxOpServiceImpl::Read, this, controller, request, response, done), intent));
+            if (sts->error_code() == TxOpStatus_Code_ReadAsyncIntent) {
+                response->mutable_holder()->Swap(&intent.holder);
+                response->mutable_async_commit()->Swap(&intent.info);
+            }
+        } else {
+            sts = new TxOpStatus(_index->Read(request->key(), v, request->txid(),
+                                              std::bind(&TxOpServiceImpl::Read, this, controller, request, response, done)));
+        }
         if (sts->error_code() == TxOpStatus_Code_ReadBlock) {
             done_guard.release();
             delete sts;
-            delete v;
         } else {
             response->set_allocated_tx_op_status(sts);
-            response->set_allocated_value(v);
+            // copied once into the response, out of the latch
+            if (v) {
+                response->mutable_value()->CopyFrom(*v);
+            }
+            fillContention(request->key(), response->mutable_contention());
+            auto code = response->tx_op_status().error_code();
+            if (request->cache() && (code == TxOpStatus_Code_Ok || code == TxOpStatus_Code_ReadNotExist)
+                && _index->Cacheable(request->key(), request->txid().start_ts(), since)) {
+                response->set_cache_since(since);
+            }
+            if (request->cache() && FLAGS_change_log_size <= 0) {
+                response->set_no_change_log(true);
+            }
         }
     }
+
+    void TxOpServiceImpl::BatchRead(::google::protobuf::RpcController* controller,
+                           const ::azino::txindex::BatchReadRequest* request,
+                           ::azino::txindex::BatchReadResponse* response,
+                           ::google::protobuf::Closure* done) {
+        brpc::ClosureGuard done_guard(done);
+        brpc::Controller *cntl = static_cast<brpc::Controller *>(controller);
+
+        std::stringstream ss;
+        ss << cntl->remote_side() << " tx: " << request->txid().ShortDebugString() << " is going to batch read"
+           << " key num: " << request->keys_size();
+        LOG(INFO) << ss.str();
+
+        std::vector<std::string> keys(request->keys().begin(), request->keys().end());
+        std::vector<std::shared_ptr<const Value>> vs;
+        std::vector<TxOpStatus> stss;
+        TxOpStatus* sts = new TxOpStatus(_index->BatchRead(keys, vs, request->txid(), stss));
+        response->set_allocated_tx_op_status(sts);
+        for (size_t i = 0; i < keys.size(); i++) {
+            response->add_tx_op_statuses()->Swap(&stss[i]);
+            auto* value = response->add_values();
+            if (vs[i]) {
+                value->CopyFrom(*vs[i]);
+            }
+        }
+    }
+
+    void TxOpServiceImpl::Scan(::google::protobuf::RpcController* controller,
+                      const ::azino::txindex::ScanRequest* request,
+                      ::azino::txindex::ScanResponse* response,
+                      ::google::protobuf::Closure* done) {
+        brpc::ClosureGuard done_guard(done);
+        brpc::Controller *cntl = static_cast<brpc::Controller *>(controller);
+
+        std::stringstream ss;
+        ss << cntl->remote_side() << " tx: " << request->txid().ShortDebugString() << " is going to scan"
+           << " from: " << request->start() << " to: " << request->end() << " limit: " << request->limit();
+        LOG(INFO) << ss.str();
+
+        std::vector<txindex::ScannedData> datas;
+        TxOpStatus* sts = new TxOpStatus(_index->Scan(request->start(), request->end(), request->limit(), request->txid(), datas));
+        response->set_allocated_tx_op_status(sts);
+        for (auto& data : datas) {
+            auto* d = response->add_datas();
+            d->set_key(data.key);
+            d->mutable_tx_op_status()->Swap(&data.status);
+            if (data.value) {
+                d->mutable_value()->CopyFrom(*data.value);
+            }
+        }
+        std::vector<txindex::DeletedRange> ranges;
+        _index->DeletedRanges(request->start(), request->end(), request->txid().start_ts(), ranges);
+        for (auto& range : ranges) {
+            auto* r = response->add_deleted_ranges();
+            r->set_start(range.start);
+            r->set_end(range.end);
+            r->set_ts(range.ts);
+        }
+    }
+
+    void TxOpServiceImpl::QueryIntent(::google::protobuf::RpcController* controller,
+                             const ::azino::txindex::QueryIntentRequest* request,
+                             ::azino::txindex::QueryIntentResponse* response,
+                             ::google::protobuf::Closure* done) {
+        brpc::ClosureGuard done_guard(done);
+        brpc::Controller *cntl = static_cast<brpc::Controller *>(controller);
+
+        std::stringstream ss;
+        ss << cntl->remote_side() << " tx: " << request->txid().ShortDebugString() << " is going to be queried intent"
+           << " key num: " << request->keys_size();
+        LOG(INFO) << ss.str();
+
+        for (auto& key : request->keys()) {
+            auto* info = response->add_async_commits();
+            auto* sts = response->add_tx_op_statuses();
+            *sts = _index->QueryIntent(key, request->txid(), *info);
+        }
+    }
+
+    void TxOpServiceImpl::ForgetAsyncCommit(::google::protobuf::RpcController* controller,
+                                            const ::azino::txindex::ForgetAsyncCommitRequest* request,
+                                            ::azino::txindex::ForgetAsyncCommitResponse* response,
+                                            ::google::protobuf::Closure* done) {
+        brpc::ClosureGuard done_guard(done);
+        brpc::Controller *cntl = static_cast<brpc::Controller *>(controller);
+
+        std::stringstream ss;
+        ss << cntl->remote_side() << " tx: " << request->txid().ShortDebugString() << " is going to forget async commit"
+           << " key: " << request->key();
+        LOG(INFO) << ss.str();
+
+        TxOpStatus* sts = new TxOpStatus(_index->ForgetAsyncCommit(request->key(), request->txid()));
+        response->set_allocated_tx_op_status(sts);
+    }
+
+    void TxOpServiceImpl::Changes(::google::protobuf::RpcController* controller,
+                                  const ::azino::txindex::ChangesRequest* request,
+                                  ::azino::txindex::ChangesResponse* response,
+                                  ::google::protobuf::Closure* done) {
+        brpc::ClosureGuard done_guard(done);
+        brpc::Controller *cntl = static_cast<brpc::Controller *>(controller);
+
+        std::vector<std::string> keys;
+        uint64_t latest = 0;
+        bool complete = _index->ChangesSince(request->since(), keys, latest);
+        response->set_latest(latest);
+        response->set_truncated(!complete);
+        if (FLAGS_change_log_size <= 0) {
+            response->set_no_change_log(true);
+        }
+        for (auto& key : keys) {
+            response->add_keys()->swap(key);
+        }
+
+        std::stringstream ss;
+        ss << cntl->remote_side() << " is going to get changes since: " << request->since()
+           << " latest: " << latest << " key num: " << keys.size() << (complete ? "" : " truncated");
+        LOG(INFO) << ss.str();
+    }
+
+    void TxOpServiceImpl::MultiTxWrite(::google::protobuf::RpcController* controller,
+                                       const ::azino::txindex::MultiTxWriteRequest* request,
+                                       ::azino::txindex::MultiTxWriteResponse* response,
+                                       ::google::protobuf::Closure* done) {
+        brpc::ClosureGuard done_guard(done);
+        brpc::Controller *cntl = static_cast<brpc::Controller *>(controller);
+
+        std::stringstream ss;
+        ss << cntl->remote_side() << " is going to multi tx write"
+           << " one phase tx num: " << request->one_phase_size() << " intent tx num: " << request->intents_size();
+        LOG(INFO) << ss.str();
+
+        for (auto& tx : request->one_phase()) {
+            if (!onePhaseCommit(tx, cntl->request_attachment(), response->add_one_phase())) {
+                cntl->SetFailed(brpc::EREQUEST, "attachment is shorter than the values of datas");
+                return;
+            }
+        }
+        for (auto& tx : request->intents()) {
+            if (!batchWriteIntent(tx, cntl->request_attachment(), response->add_intents())) {
+                cntl->SetFailed(brpc::EREQUEST, "attachment is shorter than the values of datas");
+                return;
+            }
+        }
+    }
+
+    void TxOpServiceImpl::MultiTxFinish(::google::protobuf::RpcController* controller,
+                                        const ::azino::txindex::MultiTxFinishRequest* request,
+                                        ::azino::txindex::MultiTxFinishResponse* response,
+                                        ::google::protobuf::Closure* done) {
+        brpc::ClosureGuard done_guard(done);
+        brpc::Controller *cntl = static_cast<brpc::Controller *>(controller);
+
+        std::stringstream ss;
+        ss << cntl->remote_side() << " is going to multi tx finish"
+           << " commit num: " << request->commits_size() << " clean num: " << request->cleans_size();
+        LOG(INFO) << ss.str();
+
+        for (auto& c : request->commits()) {
+            response->add_commits()->set_allocated_tx_op_status(new TxOpStatus(_index->Commit(c.key(), c.txid())));
+        }
+        for (auto& c : request->cleans()) {
+            response->add_cleans()->set_allocated_tx_op_status(new TxOpStatus(_index->Clean(c.key(), c.txid())));
+        }
+    }
+
+    void TxOpServiceImpl::DeleteRange(::google::protobuf::RpcController* controller,
+                                      const ::azino::txindex::DeleteRangeRequest* request,
+                                      ::azino::txindex::DeleteRangeResponse* response,
+                                      ::google::protobuf::Closure* done) {
+        brpc::ClosureGuard done_guard(done);
+        brpc::Controller *cntl = static_cast<brpc::Controller *>(controller);
+
+        std::stringstream ss;
+        ss << cntl->remote_side() << " tx: " << request->txid().ShortDebugString() << " is going to delete range"
+           << " from: " << request->start() << " to: " << request->end();
+        LOG(INFO) << ss.str();
+
+        TxOpStatus* sts = new TxOpStatus(_index->DeleteRange(request->start(), request->end(), request->txid()));
+        response->set_allocated_tx_op_status(sts);
+    }
+
+    void TxOpServiceImpl::fillContention(const std::string& key, KeyContention* contention) {
+        Contention c;
+        _index->GetContention(key, c);
+        contention->set_key(key);
+        contention->set_conflicts(c.conflicts);
+        contention->set_waiters(c.waiters);
+    }
+
+    bool TxOpServiceImpl::batchWriteIntent(const BatchWriteIntentRequest& request, butil::IOBuf& attachment,
+                                           BatchWriteIntentResponse* response) {
+        // only the primary intent records all the keys of an async-commit tx
+        const AsyncCommitInfo* primary_info = nullptr;
+        AsyncCommitInfo secondary_info;
+        if (request.has_async_commit()) {
+            primary_info = &request.async_commit();
+            secondary_info.set_primary_key(primary_info->primary_key());
+        }
+        std::vector<DataToWrite> datas;
+        datas.reserve(request.datas_size());
+        for (auto& d : request.datas()) {
+            const AsyncCommitInfo* info = nullptr;
+            if (primary_info) {
+                info = d.key() == primary_info->primary_key() ? primary_info : &secondary_info;
+            }
+            if (d.stamp()) {
+                datas.push_back({&d.key(), nullptr, info, request.streamed()});
+                continue;
+            }
+            auto v = TakeIntentValue(d, d.value(), attachment);
+            if (!v) {
+                return false;
+            }
+            datas.push_back({&d.key(), std::move(v), info, request.streamed()});
+        }
+        std::vector<TxOpStatus> stss;
+        TxOpStatus* sts = new TxOpStatus(_index->BatchWriteIntent(datas, request.txid(), stss));
+        response->set_allocated_tx_op_status(sts);
+        for (size_t i = 0; i < stss.size(); i++) {
+            if (stss[i].error_code() != TxOpStatus_Code_Ok) {
+                fillContention(*datas[i].key, response->add_contentions());
+            }
+            response->add_tx_op_statuses()->Swap(&stss[i]);
+        }
+        return true;
+    }
+
+    bool TxOpServiceImpl::onePhaseCommit(const OnePhaseCommitRequest& request, butil::IOBuf& attachment,
+                                         OnePhaseCommitResponse* response) {
+        std::vector<DataToWrite> datas;
+        datas.reserve(request.datas_size());
+        for (auto& d : request.datas()) {
+            auto v = TakeIntentValue(d, d.value(), attachment);
+            if (!v) {
+                return false;
+            }
+            datas.push_back({&d.key(), std::move(v), nullptr, false});
+        }
+        std::vector<TxOpStatus> stss;
+        TxOpStatus* sts = new TxOpStatus(_index->OnePhaseCommit(datas, request.txid(), stss));
+        response->set_allocated_tx_op_status(sts);
+        for (size_t i = 0; i < stss.size(); i++) {
+            if (stss[i].error_code() != TxOpStatus_Code_Ok) {
+                fillContention(*datas[i].key, response->add_contentions());
+            }
+            response->add_tx_op_statuses()->Swap(&stss[i]);
+        }
+        return true;
+    }
+}
 }
-}
\ No newline at end of file
@@ -1,17 +1,27 @@
 #include <bthread/mutex.h>
 #include <gflags/gflags.h>
 #include <butil/hash.h>
+#include <butil/time.h>
 #include <butil/containers/flat_map.h>
 #include <functional>
 #include <memory>
 #include <unordered_map>
+#include <map>
+#include <algorithm>
+#include <deque>
+#include <atomic>
+#include <queue>
 #include <bthread/bthread.h>
 #include "persistor.h"
+#include "azino/merge.h"
 
 #include "index.h"
 
 DEFINE_int32(latch_bucket_num, 1024, "latch buckets number");
 DEFINE_bool(enable_persistor, false, "If enable persistor to persist data to storage server.");
+DEFINE_int32(contention_halflife_ms, 1000, "Write conflicts counted on a key are halved once every this milliseconds");
+DEFINE_int32(change_log_size, 0, "Recent key changes kept for clients caching reads, 0 disables caching");
+DEFINE_int32(clean_fence_ms, 60000, "A key cleaned of a tx having nothing there refuses the delayed intents of the tx for this long");
 
 extern "C" void* CallbackWrapper(void* arg) {
     auto* func = reinterpret_cast<std::function<void()>*>(arg);
@@ -23,12 +33,155 @@ extern "C" void* CallbackWrapper(void* arg) {
 namespace azino {
 namespace {
 
+// A merge operand written by a tx in flight.
+struct MergeIntent {
+    TxIdentifier holder;
+    std::shared_ptr<Value> value;
+    bool streamed = false; // see MVCCValue::_streamed
+    TimeStamp passed_ts = MIN_TIMESTAMP;
+};
+
+// Numbers the changes of keys, and keeps the recent ones. Thread safe.
+class ChangeLog {
+public:
+    // numbered from the start time in the high bits, so that the numbers keep growing across restarts
+    ChangeLog() : _latest((uint64_t)(butil::gettimeofday_us() / 1000000) << 32) {}
+    DISALLOW_COPY_AND_ASSIGN(ChangeLog);
+    ~ChangeLog() = default;
+
+    uint64_t Latest() {
+        return _latest.load(std::memory_order_acquire);
+    }
+
+    // Returns the number of this change.
+    uint64_t Append(const std::string& key) {
+        std::lock_guard<bthread::Mutex> lck(_mutex);
+        _keys.push_back(key);
+        while (_keys.size() > (size_t)FLAGS_change_log_size) {
+            _keys.pop_front();
+        }
+        return ++_latest;
+    }
+
+    // Returns the number of a change of keys not known one by one, readers should drop every key they cache.
+    uint64_t AppendAll() {
+        std::lock_guard<bthread::Mutex> lck(_mutex);
+        _keys.clear();
+        return ++_latest;
+    }
+
+    bool Since(uint64_t since, std::vector<std::string>& keys, uint64_t& latest) {
+        std::lock_guard<bthread::Mutex> lck(_mutex);
+        latest = _latest;
+        if (since > _latest || _latest - since > _keys.size()) {
+            return false;
+        }
+        keys.assign(_keys.end() - (_latest - since), _keys.end());
+        return true;
+    }
+
+private:
+    bthread::Mutex _mutex; // guards _keys, and the writes of _latest
+    std::atomic<uint64_t> _latest;
+    std::deque<std::string> _keys; // the keys of the latest changes, the last one is _latest
+};
+
+bool InRange(const std::string& key, const std::string& start, const std::string& end) {
+    return key >= start && (end.empty() || key < end);
+}
+
+// Ranges deleted at once, kept till the persistor applies them to storage. Thread safe.
+class RangeTombstones {
+public:
+    RangeTombstones() : _count(0) {}
+    DISALLOW_COPY_AND_ASSIGN(RangeTombstones);
+    ~RangeTombstones() = default;
+
+    void Add(const txindex::DeletedRange& range) {
+        std::lock_guard<bthread::Mutex> lck(_mutex);
+        for (auto& r : _ranges) {
+            if (r.ts == range.ts) {
+                return;
+            }
+        }
+        _ranges.push_back(range);
+        _count.store(_ranges.size(), std::memory_order_release);
+    }
+
+    // Returns the ts of the ranges covering key.
+    std::vector<TimeStamp> Covering(const std::string& key) {
+        std::vector<TimeStamp> tss;
+        // there is no range most of the time, which every access of a key should not lock for
+        if (_count.load(std::memory_order_acquire) == 0) {
+            return tss;
+        }
+        std::lock_guard<bthread::Mutex> lck(_mutex);
+        for (auto& r : _ranges) {
+            if (InRange(key, r.start, r.end)) {
+                tss.push_back(r.ts);
+            }
+        }
+        return tss;
+    }
+
+    void Overlapping(const std::string& start, const std::string& end, TimeStamp ts, std::vector<txindex::DeletedRange>& ranges) {
+        if (_count.load(std::memory_order_acquire) == 0) {
+            return;
+        }
+        std::lock_guard<bthread::Mutex> lck(_mutex);
+        for (auto& r : _ranges) {
+            if (r.ts <= ts && (end.empty() || r.start < end) && (r.end.empty() || start < r.end)) {
+                ranges.push_back(r);
+            }
+        }
+    }
+
+    bool Oldest(txindex::DeletedRange& range) {
+        std::lock_guard<bthread::Mutex> lck(_mutex);
+        auto oldest = std::min_element(_ranges.begin(), _ranges.end(),
+                                       [](const txindex::DeletedRange& a, const txindex::DeletedRange& b) {
+            return a.ts < b.ts;
+        });
+        if (oldest == _ranges.end()) {
+            return false;
+        }
+        range = *oldest;
+        return true;
+    }
+
+    void Remove(TimeStamp ts) {
+        std::lock_guard<bthread::Mutex> lck(_mutex);
+        _ranges.erase(std::remove_if(_ranges.begin(), _ranges.end(), [ts](const txindex::DeletedRange& r) {
+            return r.ts == ts;
+        }), _ranges.end());
+        _count.store(_ranges.size(), std::memory_order_release);
+    }
+
+private:
+    bthread::Mutex _mutex; // guards _ranges, and the writes of _count
+    std::atomic<size_t> _count;
+    std::vector<txindex::DeletedRange> _ranges; // few, as each deletes many keys
+};
+
+// The value read of a key only in storage that a range tombstone deletes.
+const std::shared_ptr<const Value>& RangeDeleted() {
+    static const std::shared_ptr<const Value> deleted = []() {
+        auto v = std::make_shared<Value>();
+        v->set_is_delete(true);
+        return v;
+    }();
+    return deleted;
+}
+
 class MVCCValue {
 public:
     MVCCValue() :
     _has_lock(false),
     _has_intent(false),
-    _holder(), _t2v() {}
+    _holder(), _t2v(),
+    _streamed(false), _passed_ts(MIN_TIMESTAMP),
+    _conflicts(0), _conflict_ms(0),
+    _changed(0), _persisted_ts(MIN_TIMESTAMP) {}
     DISALLOW_COPY_AND_ASSIGN(MVCCValue);
     ~MVCCValue() = default;
     bool HasLock() const { return _has_lock; }
@@ -44,18 +197,41 @@ public:
     Value* IntentValue() const {
         return _intent_value.get();
     }
-    // Finds committed values whose timestamp is smaller or equal than "ts"
-    std::pair<TimeStamp, Value*> Seek(TimeStamp ts) {
+    // Not null if the intent belongs to an async-commit tx
+    AsyncCommitInfo* AsyncCommit() const {
+        return _async_commit.get();
+    }
+    // Finds committed values whose timestamp is smaller or equal than "ts", shared rather than copied
+    std::pair<TimeStamp, std::shared_ptr<Value>> Seek(TimeStamp ts) {
         auto iter = _t2v.lower_bound(ts);
         if (iter == _t2v.end()) {
             return std::make_pair(MAX_TIMESTAMP, nullptr);
         }
-        return std::make_pair(iter->first, iter->second.get());
+        return std::make_pair(iter->first, iter->second);
+    }
+
+    // Whether txs other than the one started at "start_ts" hold merge intents
+    bool OthersMerging(TimeStamp start_ts) const {
+        return _merge_intents.size() > _merge_intents.count(start_ts);
+    }
+
+    // Write conflicts met on this key recently
+    uint32_t Conflicts(int64_t now_ms) {
+        decay(now_ms);
+        return _conflicts;
+    }
+
+    void AddConflict(int64_t now_ms) {
+        decay(now_ms);
+        _conflicts++;
     }
 
     // Truncate committed values whose timestamp is smaller or equal than "ts", return the number of values truncated
     unsigned Truncate(TimeStamp ts) {
         auto iter = _t2v.lower_bound(ts);
+        if (iter != _t2v.end()) {
+            _persisted_ts = std::max(_persisted_ts, iter->first);
+        }
         auto ans = _t2v.size();
         _t2v.erase(iter, _t2v.end());
         return ans - _t2v.size();
@@ -63,16 +239,54 @@ public:
 
 private:
     friend class KVBucket;
+    void decay(int64_t now_ms) {
+        if (FLAGS_contention_halflife_ms <= 0) {
+            return;
+        }
+        auto halves = (now_ms - _conflict_ms) / FLAGS_contention_halflife_ms;
+        if (halves > 0) {
+            _conflicts = halves >= 32 ? 0 : _conflicts >> halves;
+            _conflict_ms += halves * FLAGS_contention_halflife_ms;
+        }
+    }
+
     bool _has_lock;
     bool _has_intent;
-    std::unique_ptr<Value> _intent_value;
+    std::shared_ptr<Value> _intent_value; // may be shared with the request it comes from
+    std::unique_ptr<AsyncCommitInfo> _async_commit;
     TxIdentifier _holder;
     txindex::MultiVersionValue _t2v;
+    std::map<TimeStamp, MergeIntent> _merge_intents; // by the start_ts of their holders
+    // The intent is streamed before its tx takes a commit_ts, readers pass it rather than wait for the whole tx,
+    // and the tx should commit after the largest start_ts of them.
+    bool _streamed;
+    TimeStamp _passed_ts;
+    // Outcomes of the async-commit txs whose primary intent was on this key, kept till ForgetAsyncCommit
+    // or of the txs fenced by a Clean finding nothing of them, kept for FLAGS_clean_fence_ms
+    struct AsyncOutcome {
+        bool committed;
+        AsyncCommitInfo info;
+        int64_t fenced_ms; // when fenced, 0 if it is the outcome of a primary intent
+    };
+    std::map<TimeStamp, AsyncOutcome> _async_outcomes; // by the start_ts of their txs
+    uint32_t _conflicts;
+    int64_t _conflict_ms; // when _conflicts was last halved
+    uint64_t _changed; // the number of the latest change, see ChangeLog
+    TimeStamp _persisted_ts; // the largest ts truncated after persisted
+};
+
+// Orders the keys of a bucket by their content rather than where they are.
+struct KeyLess {
+    bool operator()(const std::string* a, const std::string* b) const {
+        return *a < *b;
+    }
 };
 
+class TxIndexImpl;
+
 class KVBucket : public txindex::TxIndex {
 public:
-    KVBucket() = default;
+    KVBucket(ChangeLog* changes, RangeTombstones* ranges) : _changes(changes), _ranges(ranges) {}
     DISALLOW_COPY_AND_ASSIGN(KVBucket);
     ~KVBucket() = default;
 
@@ -81,10 +295,8 @@ public:
 
         TxOpStatus sts;
         std::stringstream ss;
-        if (_kvs.find(key) == _kvs.end()) {
-           _kvs.insert(std::make_pair(key, new MVCCValue()));
-        }
-        MVCCValue* mv = _kvs[key].get();
+        materialize(key);
+        MVCCValue* mv = findOrAdd(key);
         auto ltv = mv->LargestTSValue();
 
         if (ltv.first >= txid.start_ts()) {
@@ -92,6 +304,7 @@ public:
                << "Find " << "largest ts: " << ltv.first << " value: "
                << ltv.second->ShortDebugString();
             sts.set_error_code(TxOpStatus_Code_WriteTooLate);
+            mv->AddConflict(butil::gettimeofday_ms());
             sts.set_error_message(ss.str());
             LOG(INFO) << ss.str();
             return sts;
@@ -104,6 +317,7 @@ public:
                    << "Find " << (mv->HasLock() ? "lock" : "intent") << " Tx(" << mv->Holder().ShortDebugString() << ") value: "
                    << (mv->HasLock() ? "" : mv->IntentValue()->ShortDebugString());
                 sts.set_error_code(TxOpStatus_Code_WriteBlock);
+                mv->AddConflict(butil::gettimeofday_ms());
                 sts.set_error_message(ss.str());
                 LOG(INFO) << ss.str();
                 if (_blocked_ops.find(key) == _blocked_ops.end()) {
@@ -121,6 +335,17 @@ public:
             return sts;
         }
 
+        if (mv->OthersMerging(txid.start_ts())) {
+            ss << "Tx(" << txid.ShortDebugString() << ") write lock on " << "key: "<< key << " blocked. "
+               << "Find " << mv->_merge_intents.size() << " merge intents";
+            sts.set_error_code(TxOpStatus_Code_WriteBlock);
+            mv->AddConflict(butil::gettimeofday_ms());
+            sts.set_error_message(ss.str());
+            LOG(INFO) << ss.str();
+            _blocked_ops[key].push_back(callback);
+            return sts;
+        }
+
         mv->_has_lock = true;
         mv->_holder = txid;
         ss << "Tx(" << txid.ShortDebugString() << ") write lock on " << "key: "<< key << " successes. ";
@@ -130,67 +355,93 @@ public:
         return sts;
     }
 
-    virtual TxOpStatus WriteIntent(const std::string& key, const Value& v, const TxIdentifier& txid) override {
+    virtual TxOpStatus WriteIntent(const std::string& key, const std::shared_ptr<Value>& v, const TxIdentifier& txid) override {
         std::lock_guard<bthread::Mutex> lck(_latch);
+        return writeIntent(key, v, txid, nullptr, false);
+    }
 
+    virtual TxOpStatus ConditionalWriteIntent(const std::string& key, const std::shared_ptr<Value>& v, const Value& expected, const TxIdentifier& txid) override {
+        std::lock_guard<bthread::Mutex> lck(_latch);
         TxOpStatus sts;
         std::stringstream ss;
-        if (_kvs.find(key) == _kvs.end()) {
-            _kvs.insert(std::make_pair(key, new MVCCValue()));
+        const Value* current = nullptr;
+        materialize(key);
+        auto iter = _kvs.find(key);
+        if (iter != _kvs.end()) {
+            MVCCValue* mv = iter->second.get();
+            bool others = ((mv->HasIntent() || mv->HasLock()) && mv->Holder().start_ts() != txid.start_ts())
+                    || mv->OthersMerging(txid.start_ts());
+            if (others || mv->LargestTSValue().first >= txid.start_ts()) {
+                // fails as WriteIntent does
+                return writeIntent(key, v, txid, nullptr, false);
+            }
+            if (mv->HasIntent()) {
+                current = mv->IntentValue();
+            } else if (mv->_merge_intents.empty()) {
+                current = mv->LargestTSValue().second;
+            }
+            // an operand tells nothing without the value it folds onto
+            if (current != nullptr && current->has_merge_op()) {
+                current = nullptr;
+            }
         }
-        MVCCValue* mv = _kvs[key].get();
-        auto ltv = mv->LargestTSValue();
 
-        if (ltv.first >= txid.start_ts()) {
-            ss << "Tx(" << txid.ShortDebugString() << ") write intent on " << "key: "<< key << " too late. "
-               << "Find " << "largest ts: " << ltv.first << " value: "
-               << ltv.second->ShortDebugString();
-            sts.set_error_code(TxOpStatus_Code_WriteTooLate);
+        if (current == nullptr) {
+            ss << "Tx(" << txid.ShortDebugString() << ") conditional write intent on " << "key: "<< key << " unknown. "
+               << "Find no value in txindex. ";
+            sts.set_error_code(TxOpStatus_Code_ConditionUnknown);
             sts.set_error_message(ss.str());
             LOG(INFO) << ss.str();
             return sts;
         }
-
-        if (mv->HasIntent() || mv->HasLock()) {
-            assert(!(mv->HasIntent() && mv->HasLock()));
-            if (txid.start_ts() != mv->Holder().start_ts()) {
-                ss << "Tx(" << txid.ShortDebugString() << ") write intent on " << "key: "<< key << " conflicts. "
-                   << "Find " << (mv->HasLock() ? "lock" : "intent") << " Tx(" << mv->Holder().ShortDebugString() << ") value: "
-                   << (mv->HasLock() ? "" : mv->IntentValue()->ShortDebugString());
-                sts.set_error_code(TxOpStatus_Code_WriteConflicts);
-                sts.set_error_message(ss.str());
-                LOG(INFO) << ss.str();
-                return sts;
-            }
-            if (mv->HasIntent()) {
-                ss << "Tx(" << txid.ShortDebugString() << ") write intent on " << "key: "<< key << " repeated. "
-                   << "Find "<< "intent" << " Tx(" << mv->Holder().ShortDebugString() << ") value: "
-                   << mv->IntentValue()->ShortDebugString();
-                sts.set_error_code(TxOpStatus_Code_Ok);
-                sts.set_error_message(ss.str());
-                LOG(NOTICE) << ss.str();
-                return sts;
-            }
-
-            mv->_has_lock = false;
-            mv->_has_intent = true;
-            mv->_holder = txid;
-            mv->_intent_value.reset(new Value(v));
-            ss << "Tx(" << txid.ShortDebugString() << ") write intent on " << "key: "<< key << " successes. "
-               << "Find "<< "lock" << " Tx(" << mv->Holder().ShortDebugString() << ") value: ";
-            sts.set_error_code(TxOpStatus_Code_Ok);
+        bool matched = expected.is_delete() ? current->is_delete()
+                : !current->is_delete() && current->content() == expected.content();
+        if (!matched) {
+            ss << "Tx(" << txid.ShortDebugString() << ") conditional write intent on " << "key: "<< key << " failed. "
+               << "Find value: " << current->ShortDebugString() << " expected: " << expected.ShortDebugString();
+            sts.set_error_code(TxOpStatus_Code_ConditionFailed);
             sts.set_error_message(ss.str());
             LOG(INFO) << ss.str();
             return sts;
         }
+        return writeIntent(key, v, txid, nullptr, false);
+    }
 
-        mv->_has_intent = true;
-        mv->_holder = txid;
-        mv->_intent_value.reset(new Value(v));
-        ss << "Tx(" << txid.ShortDebugString() << ") write intent on " << "key: "<< key << " successes. ";
-        sts.set_error_code(TxOpStatus_Code_Ok);
-        sts.set_error_message(ss.str());
-        LOG(INFO) << ss.str();
+    // All the datas should belong to this bucket.
+    virtual TxOpStatus BatchWriteIntent(const std::vector<txindex::DataToWrite>& datas, const TxIdentifier& txid, std::vector<TxOpStatus>& stss) override {
+        std::lock_guard<bthread::Mutex> lck(_latch);
+
+        TxOpStatus sts;
+        stss.clear();
+        stss.reserve(datas.size());
+        for (auto& d : datas) {
+            stss.push_back(d.value ? writeIntent(*d.key, d.value, txid, d.async_commit, d.streamed)
+                                   : stampIntent(*d.key, txid, d.async_commit));
+            if (sts.error_code() == TxOpStatus_Code_Ok && stss.back().error_code() != TxOpStatus_Code_Ok) {
+                sts = stss.back();
+            }
+        }
+        return sts;
+    }
+
+    // All the datas should belong to this bucket.
+    virtual TxOpStatus OnePhaseCommit(const std::vector<txindex::DataToWrite>& datas, const TxIdentifier& txid, std::vector<TxOpStatus>& stss) override {
+        std::lock_guard<bthread::Mutex> lck(_latch);
+
+        TxOpStatus sts;
+        stss.clear();
+        stss.reserve(datas.size());
+        for (auto& d : datas) {
+            stss.push_back(checkWrite(*d.key, *d.value, txid));
+            if (sts.error_code() == TxOpStatus_Code_Ok && stss.back().error_code() != TxOpStatus_Code_Ok) {
+                sts = stss.back();
+            }
+        }
+        if (sts.error_code() == TxOpStatus_Code_Ok) {
+            for (auto& d : datas) {
+                commitWrite(*d.key, d.value, txid);
+            }
+        }
         return sts;
     }
 
@@ -200,11 +451,31 @@ public:
         TxOpStatus sts;
         std::stringstream ss;
         auto iter = _kvs.find(key);
+        bool owned = iter != _kvs.end() && (iter->second->HasLock() || iter->second->HasIntent())
+                && iter->second->Holder().start_ts() == txid.start_ts();
+        if (!owned && iter != _kvs.end() && iter->second->_merge_intents.erase(txid.start_ts()) > 0) {
+            ss << "Tx(" << txid.ShortDebugString() << ") clean on " << "key: "<< key << " success. "
+               << "Find its merge intent. ";
+            sts.set_error_code(TxOpStatus_Code_Ok);
+            sts.set_error_message(ss.str());
+            LOG(INFO) << ss.str();
+            notifyBlocked(key);
+            return sts;
+        }
+        auto outcome = iter == _kvs.end() ? nullptr : findOutcome(iter->second.get(), txid);
+        if (!owned && outcome != nullptr && outcome->fenced_ms == 0) {
+            ss << "Tx(" << txid.ShortDebugString() << ") clean on " << "key: "<< key
+               << (outcome->committed ? " fail. Find the tx committed. " : " success. Find the tx aborted. ");
+            sts.set_error_code(outcome->committed ? TxOpStatus_Code_TxCommitted : TxOpStatus_Code_Ok);
+            sts.set_error_message(ss.str());
+            LOG(INFO) << ss.str();
+            return sts;
+        }
         if (iter == _kvs.end()
             || (!iter->second->HasLock() && !iter->second->HasIntent())
             || iter->second->Holder().start_ts() != txid.start_ts()) {
             ss << "Tx(" << txid.ShortDebugString() << ") clean on " << "key: "<< key << " not exist. ";
-            if (iter != _kvs.end()) {
+            if (iter != _kvs.end() && (iter->second->HasLock() || iter->second->HasIntent())) {
                 assert(!(iter->second->HasIntent() && iter->second->HasLock()));
                 ss << "Find " << (iter->second->HasLock() ? "lock" : "intent") << " Tx(" << iter->second->Holder().ShortDebugString() << ") value: "
                    << (iter->second->HasLock() ? "" : iter->second->IntentValue()->ShortDebugString());
@@ -212,6 +483,7 @@ public:
             sts.set_error_code(TxOpStatus_Code_CleanNotExist);
             sts.set_error_message(ss.str());
             LOG(WARNING) << ss.str();
+            fence(key, txid);
             return sts;
         }
 
@@ -222,22 +494,15 @@ public:
         sts.set_error_message(ss.str());
         LOG(INFO) << ss.str();
 
+        recordOutcome(iter->second.get(), txid, false);
         iter->second->_holder.Clear();
-        iter->second->_intent_value.reset(nullptr);
+        iter->second->_intent_value.reset();
+        iter->second->_async_commit.reset(nullptr);
+        iter->second->_merge_intents.erase(txid.start_ts());
         iter->second->_has_intent = false;
         iter->second->_has_lock = false;
 
-        if (_blocked_ops.find(key) != _blocked_ops.end()) {
-            auto iter = _blocked_ops.find(key);
-            for (auto& func : iter->second) {
-                bthread_t bid;
-                auto* arg = new std::function<void()>(func);
-                if (bthread_start_background(&bid, nullptr, CallbackWrapper, arg) != 0) {
-                    LOG(ERROR) << "Failed to start callback.";
-                }
-            }
-            iter->second.clear();
-        }
+        notifyBlocked(key);
 
         return sts;
     }
@@ -248,11 +513,39 @@ public:
         TxOpStatus sts;
         std::stringstream ss;
         auto iter = _kvs.find(key);
-        if (iter == _kvs.end()
-            || !iter->second->HasIntent()
-            || iter->second->Holder().start_ts() != txid.start_ts()) {
+        if (iter != _kvs.end()) {
+            auto merge = iter->second->_merge_intents.find(txid.start_ts());
+            if (merge != iter->second->_merge_intents.end()) {
+                // the operand is kept as a version, and folded by readers and the persistor
+                ss << "Tx(" << txid.ShortDebugString() << ") commit on " << "key: "<< key << " success. "
+                   << "Find " << "merge intent" << " value: " << merge->second.value->ShortDebugString();
+                sts.set_error_code(TxOpStatus_Code_Ok);
+                sts.set_error_message(ss.str());
+                LOG(INFO) << ss.str();
+                markChanged(key, iter->second.get());
+                iter->second->_t2v.insert(std::make_pair(txid.commit_ts(), std::move(merge->second.value)));
+                iter->second->_merge_intents.erase(merge);
+                if (iter->second->HasLock() && iter->second->Holder().start_ts() == txid.start_ts()) {
+                    iter->second->_holder.Clear();
+                    iter->second->_has_lock = false;
+                }
+                notifyBlocked(key);
+                return sts;
+            }
+        }
+        bool owned = iter != _kvs.end() && iter->second->HasIntent() && iter->second->Holder().start_ts() == txid.start_ts();
+        auto outcome = iter == _kvs.end() ? nullptr : findOutcome(iter->second.get(), txid);
+        if (!owned && outcome != nullptr) {
+            ss << "Tx(" << txid.ShortDebugString() << ") commit on " << "key: "<< key
+               << (outcome->committed ? " success. Find the tx committed. " : " fail. Find the tx aborted. ");
+            sts.set_error_code(outcome->committed ? TxOpStatus_Code_Ok : TxOpStatus_Code_TxAborted);
+            sts.set_error_message(ss.str());
+            LOG(INFO) << ss.str();
+            return sts;
+        }
+        if (!owned) {
             ss << "Tx(" << txid.ShortDebugString() << ") commit on " << "key: "<< key << " not exist. ";
-            if (iter != _kvs.end()) {
+            if (iter != _kvs.end() && (iter->second->HasLock() || iter->second->HasIntent())) {
                 assert(!(iter->second->HasIntent() && iter->second->HasLock()));
                 ss << "Find " << (iter->second->HasLock() ? "lock" : "intent") << " Tx(" << iter->second->Holder().ShortDebugString() << ") value: "
                    << (iter->second->HasLock() ? "" : iter->second->IntentValue()->ShortDebugString());
@@ -270,100 +563,217 @@ public:
         sts.set_error_message(ss.str());
         LOG(INFO) << ss.str();
 
+        markChanged(key, iter->second.get());
+        recordOutcome(iter->second.get(), txid, true);
         iter->second->_holder.Clear();
         iter->second->_t2v.insert(std::make_pair(txid.commit_ts(), std::move(iter->second->_intent_value)));
+        iter->second->_async_commit.reset(nullptr);
         iter->second->_has_intent = false;
         iter->second->_has_lock = false;
 
-        if (_blocked_ops.find(key) != _blocked_ops.end()) {
-            auto iter = _blocked_ops.find(key);
-            for (auto& func : iter->second) {
-                bthread_t bid;
-                auto* arg = new std::function<void()>(func);
-                if (bthread_start_background(&bid, nullptr, CallbackWrapper, arg) != 0) {
-                    LOG(ERROR) << "Failed to start callback.";
-                }
+        notifyBlocked(key);
+
+        return sts;
+    }
+
+    virtual TxOpStatus Read(const std::string& key, std::shared_ptr<const Value>& v, const TxIdentifier& txid, std::function<void()> callback) override {
+        std::lock_guard<bthread::Mutex> lck(_latch);
+        return read(key, v, txid, callback, nullptr);
+    }
+
+    virtual TxOpStatus Read(const std::string& key, std::shared_ptr<const Value>& v, const TxIdentifier& txid, std::function<void()> callback, txindex::AsyncIntent& intent) override {
+        std::lock_guard<bthread::Mutex> lck(_latch);
+        return read(key, v, txid, callback, &intent);
+    }
+
+    // All the keys should belong to this bucket.
+    virtual TxOpStatus BatchRead(const std::vector<std::string>& keys, std::vector<std::shared_ptr<const Value>>& vs, const TxIdentifier& txid, std::vector<TxOpStatus>& stss) override {
+        std::lock_guard<bthread::Mutex> lck(_latch);
+
+        TxOpStatus sts;
+        vs.assign(keys.size(), nullptr);
+        stss.clear();
+        stss.reserve(keys.size());
+        for (size_t i = 0; i < keys.size(); i++) {
+            stss.push_back(read(keys[i], vs[i], txid, nullptr, nullptr));
+            auto code = stss.back().error_code();
+            if (sts.error_code() == TxOpStatus_Code_Ok && code != TxOpStatus_Code_Ok
+                && code != TxOpStatus_Code_ReadNotExist && code != TxOpStatus_Code_ReadBlock
+                && code != TxOpStatus_Code_ReadNeedBase) {
+                sts = stss.back();
             }
-            iter->second.clear();
         }
+        return sts;
+    }
+
+    virtual TxOpStatus Scan(const std::string& start, const std::string& end, uint32_t limit, const TxIdentifier& txid, std::vector<txindex::ScannedData>& datas) override {
+        std::lock_guard<bthread::Mutex> lck(_latch);
 
+        TxOpStatus sts;
+        uint32_t found = 0;
+        for (auto iter = _ordered.lower_bound(&start); iter != _ordered.end() && (end.empty() || *iter->first < end); iter++) {
+            if (limit != 0 && found == limit) {
+                break;
+            }
+            txindex::ScannedData data;
+            data.key = *iter->first;
+            if (scanned(data, txid, sts)) {
+                datas.push_back(std::move(data));
+                found++;
+            }
+        }
         return sts;
     }
 
-    virtual TxOpStatus Read(const std::string& key, Value& v, const TxIdentifier& txid, std::function<void()> callback) override {
+    // Finds the first key of this bucket in ["start", "end"), returns false if there is none.
+    bool FirstKey(const std::string& start, const std::string& end, std::string& key) {
+        std::lock_guard<bthread::Mutex> lck(_latch);
+
+        auto iter = _ordered.lower_bound(&start);
+        if (iter == _ordered.end() || (!end.empty() && *iter->first >= end)) {
+            return false;
+        }
+        key = *iter->first;
+        return true;
+    }
+
+    // Reads "key" as Scan does into "data", returning whether it is filled, and finds the key after it
+    // in this bucket before "end" into "next", which is left empty if there is none. A failure is kept in "sts".
+    bool ScanKey(const std::string& key, const std::string& end, const TxIdentifier& txid,
+                 txindex::ScannedData& data, std::string& next, TxOpStatus& sts) {
+        std::lock_guard<bthread::Mutex> lck(_latch);
+
+        data.key = key;
+        bool found = scanned(data, txid, sts);
+        next.clear();
+        auto iter = _ordered.upper_bound(&key);
+        if (iter != _ordered.end() && (end.empty() || *iter->first < end)) {
+            next = *iter->first;
+        }
+        return found;
+    }
+
+    virtual TxOpStatus GetContention(const std::string& key, txindex::Contention& contention) override {
         std::lock_guard<bthread::Mutex> lck(_latch);
 
         TxOpStatus sts;
-        std::stringstream ss;
+        auto iter = _kvs.find(key);
+        contention.conflicts = iter == _kvs.end() ? 0 : iter->second->Conflicts(butil::gettimeofday_ms());
+        auto blocked = _blocked_ops.find(key);
+        contention.waiters = blocked == _blocked_ops.end() ? 0 : blocked->second.size();
+        return sts;
+    }
+
+    virtual uint64_t LatestChange() override {
+        return _changes->Latest();
+    }
+
+    virtual bool ChangesSince(uint64_t since, std::vector<std::string>& keys, uint64_t& latest) override {
+        return _changes->Since(since, keys, latest);
+    }
+
+    virtual bool Cacheable(const std::string& key, TimeStamp ts, uint64_t since) override {
+        std::lock_guard<bthread::Mutex> lck(_latch);
+
+        if (FLAGS_change_log_size <= 0) {
+            return false;
+        }
         auto iter = _kvs.find(key);
         if (iter == _kvs.end()) {
-            ss << "Tx(" << txid.ShortDebugString() << ") read on " << "key: "<< key << " not exist. ";
-            sts.set_error_code(TxOpStatus_Code_ReadNotExist);
-            sts.set_error_message(ss.str());
-            LOG(INFO) << ss.str();
-            return sts;
+            auto tss = _ranges->Covering(key);
+            return std::all_of(tss.begin(), tss.end(), [ts](TimeStamp deleted_ts) { return deleted_ts <= ts; });
         }
+        // a lock changes nothing before its holder writes an intent
+        MVCCValue* mv = iter->second.get();
+        return !mv->HasIntent() && mv->_merge_intents.empty()
+               && mv->LargestTSValue().first <= ts && mv->_persisted_ts <= ts
+               && mv->_changed <= since;
+    }
 
-        if ((iter->second->HasIntent() || iter->second->HasLock())
-            && iter->second->Holder().start_ts() == txid.start_ts()) {
-            assert(!(iter->second->HasIntent() && iter->second->HasLock()));
-            ss << "Tx(" << txid.ShortDebugString() << ") read on " << "key: "<< key << " not exist. "
-               << "Find its own "<< (iter->second->HasLock() ? "lock" : "intent") << " Tx(" << iter->second->Holder().ShortDebugString() << ") value: "
-               << (iter->second->HasLock() ? "" : iter->second->IntentValue()->ShortDebugString());
-            sts.set_error_code(TxOpStatus_Code_ReadNotExist);
-            sts.set_error_message(ss.str());
-            LOG(ERROR) << ss.str();
-            return sts;
-        }
+    virtual TxOpStatus QueryIntent(const std::string& key, const TxIdentifier& txid, AsyncCommitInfo& info) override {
+        std::lock_guard<bthread::Mutex> lck(_latch);
 
-        if (iter->second->HasIntent() && iter->second->Holder().start_ts() < txid.start_ts()) {
-            assert(!iter->second->HasLock());
-            ss << "Tx(" << txid.ShortDebugString() << ") read on " << "key: "<< key << " blocked. "
-               << "Find "<< "intent" << " Tx(" << iter->second->Holder().ShortDebugString() << ") value: "
-               << iter->second->IntentValue()->ShortDebugString();
-            sts.set_error_code(TxOpStatus_Code_ReadBlock);
-            sts.set_error_message(ss.str());
-            LOG(INFO) << ss.str();
-            if (_blocked_ops.find(key) == _blocked_ops.end()) {
-                _blocked_ops.insert(std::make_pair(key, std::vector<std::function<void()>>()));
+        TxOpStatus sts;
+        std::stringstream ss;
+        auto iter = _kvs.find(key);
+        if (iter != _kvs.end()) {
+            if (iter->second->HasIntent() && iter->second->Holder().start_ts() == txid.start_ts()) {
+                ss << "Tx(" << txid.ShortDebugString() << ") query intent on " << "key: "<< key << " success. "
+                   << "Find "<< "intent" << " Tx(" << iter->second->Holder().ShortDebugString() << ") value: "
+                   << iter->second->IntentValue()->ShortDebugString();
+                sts.set_error_code(TxOpStatus_Code_Ok);
+                sts.set_error_message(ss.str());
+                LOG(INFO) << ss.str();
+                info.Clear();
+                if (iter->second->AsyncCommit() != nullptr) {
+                    info.CopyFrom(*iter->second->AsyncCommit());
+                }
+                return sts;
+            }
+            auto outcome = findOutcome(iter->second.get(), txid);
+            if (outcome != nullptr) {
+                ss << "Tx(" << txid.ShortDebugString() << ") query intent on " << "key: "<< key << " finished. "
+                   << "Find the tx " << (outcome->committed ? "committed" : "aborted");
+                sts.set_error_code(outcome->committed ? TxOpStatus_Code_TxCommitted : TxOpStatus_Code_TxAborted);
+                sts.set_error_message(ss.str());
+                LOG(INFO) << ss.str();
+                info.CopyFrom(outcome->info);
+                return sts;
             }
-            _blocked_ops[key].push_back(callback);
-            return sts;
-        }
-
-        auto sv = iter->second->Seek(txid.start_ts());
-        if (sv.first <= txid.start_ts()) {
-            ss << "Tx(" << txid.ShortDebugString() << ") read on " << "key: "<< key << " success. "
-               << "Find " << "ts: " << sv.first << " value: "
-               << sv.second->ShortDebugString();
-            sts.set_error_code(TxOpStatus_Code_Ok);
-            sts.set_error_message(ss.str());
-            LOG(INFO) << ss.str();
-            v.CopyFrom(*(sv.second));
-            return sts;
         }
 
-        ss << "Tx(" << txid.ShortDebugString() << ") read on " << "key: "<< key << " not exist. ";
-        sts.set_error_code(TxOpStatus_Code_ReadNotExist);
+        ss << "Tx(" << txid.ShortDebugString() << ") query intent on " << "key: "<< key << " not exist. ";
+        sts.set_error_code(TxOpStatus_Code_QueryNotExist);
         sts.set_error_message(ss.str());
         LOG(INFO) << ss.str();
         return sts;
     }
 
-    virtual TxOpStatus GetPersisting(std::vector<txindex::DataToPersist> &datas) override {
+    virtual TxOpStatus ForgetAsyncCommit(const std::string& key, const TxIdentifier& txid) override {
         std::lock_guard<bthread::Mutex> lck(_latch);
 
         TxOpStatus sts;
         std::stringstream ss;
-        unsigned long cnt = 0;
-        for (auto &it: _kvs) {
-            if (it.second->_t2v.empty()) {
-                continue;
+        auto iter = _kvs.find(key);
+        size_t erased = 0;
+        if (iter != _kvs.end()) {
+            // a fence is kept for its time, the tx may still have intents on the way
+            auto outcome = iter->second->_async_outcomes.find(txid.start_ts());
+            if (outcome != iter->second->_async_outcomes.end() && outcome->second.fenced_ms == 0) {
+                iter->second->_async_outcomes.erase(outcome);
+                erased = 1;
+            }
+        }
+        ss << "Tx(" << txid.ShortDebugString() << ") forget async commit on " << "key: "<< key
+           << (erased > 0 ? " success. " : " not exist. ");
+        sts.set_error_code(TxOpStatus_Code_Ok);
+        sts.set_error_message(ss.str());
+        LOG(INFO) << ss.str();
+        return sts;
+    }
+
+    virtual TxOpStatus GetPersisting(std::vector<txindex::DataToPersist> &datas) override {
+        std::lock_guard<bthread::Mutex> lck(_latch);
+
+        TxOpStatus sts;
+        std::stringstream ss;
+        unsigned long cnt = 0;
+        for (auto &it: _kvs) {
+            // An operand yet to commit may land below the versions after its ts, which are kept till it commits,
+            // as it would be lost once they are persisted and truncated.
+            TimeStamp bound = MAX_TIMESTAMP;
+            for (auto& merge : it.second->_merge_intents) {
+                auto& holder = merge.second.holder;
+                bound = std::min(bound, holder.has_commit_ts() ? holder.commit_ts() : holder.start_ts());
+            }
+            auto persisting = it.second->_t2v.upper_bound(bound);
+            if (persisting == it.second->_t2v.end()) {
+                continue;
             }
             txindex::DataToPersist d;
             d.key = it.first;
-            d.t2vs = it.second->_t2v;
-            cnt += it.second->_t2v.size();
+            d.t2vs.insert(persisting, it.second->_t2v.end());
+            cnt += d.t2vs.size();
             datas.push_back(d);
         }
         if (cnt == 0) {
@@ -420,20 +830,772 @@ public:
         return sts;
     }
 
+    // Only marks the keys of this bucket in ["start", "end") deleted, TxIndexImpl adds the range tombstone
+    // and marks every bucket at once. Fails with WriteBlock, marking nothing, if a tx is writing some of them.
+    virtual TxOpStatus DeleteRange(const std::string& start, const std::string& end, const TxIdentifier& txid) override {
+        std::lock_guard<bthread::Mutex> lck(_latch);
+
+        TxOpStatus sts = checkDeleteRange(start, end, txid);
+        if (sts.error_code() == TxOpStatus_Code_Ok) {
+            markDeleted(start, end, txid);
+        }
+        return sts;
+    }
+
+    virtual void DeletedRanges(const std::string& start, const std::string& end, TimeStamp ts, std::vector<txindex::DeletedRange>& ranges) override {
+        _ranges->Overlapping(start, end, ts, ranges);
+    }
+
+    virtual bool GetPersistingRange(txindex::DeletedRange& range) override {
+        return _ranges->Oldest(range);
+    }
+
+    virtual void ClearPersistedRange(const txindex::DeletedRange& range) override {
+        _ranges->Remove(range.ts);
+    }
+
 private:
+    friend class TxIndexImpl;
+
+    // Need hold _latch before call this func.
+    // Fails with WriteBlock if a tx holds a lock, an intent or a merge intent on some key of this bucket
+    // in ["start", "end"), as it may commit above the deletion without seeing it.
+    TxOpStatus checkDeleteRange(const std::string& start, const std::string& end, const TxIdentifier& txid) {
+        TxOpStatus sts;
+        for (auto iter = _ordered.lower_bound(&start); iter != _ordered.end() && (end.empty() || *iter->first < end); iter++) {
+            MVCCValue* mv = iter->second;
+            if (!mv->HasIntent() && !mv->HasLock() && mv->_merge_intents.empty()) {
+                continue;
+            }
+            std::stringstream ss;
+            ss << "Tx(" << txid.ShortDebugString() << ") delete range on " << "key: "<< *iter->first << " blocked. "
+               << "Find " << (mv->HasLock() ? "lock" : mv->HasIntent() ? "intent" : "merge intents");
+            if (mv->HasLock() || mv->HasIntent()) {
+                ss << " Tx(" << mv->Holder().ShortDebugString() << ")";
+            }
+            sts.set_error_code(TxOpStatus_Code_WriteBlock);
+            sts.set_error_message(ss.str());
+            LOG(INFO) << ss.str();
+            return sts;
+        }
+        return sts;
+    }
+
+    // Need hold _latch before call this func, and checkDeleteRange should have succeeded.
+    // Gives the keys of this bucket in ["start", "end") a deleted version at txid's commit_ts.
+    void markDeleted(const std::string& start, const std::string& end, const TxIdentifier& txid) {
+        auto deleted = std::make_shared<Value>();
+        deleted->set_is_delete(true);
+        for (auto iter = _ordered.lower_bound(&start); iter != _ordered.end() && (end.empty() || *iter->first < end); iter++) {
+            markChanged(*iter->first, iter->second);
+            iter->second->_t2v.insert(std::make_pair(txid.commit_ts(), deleted));
+        }
+    }
+
+    // Need hold _latch before call this func.
+    // A key covered by range tombstones gets its MVCCValue here before it is written, carrying their deletions,
+    // so that it is checked like any other key the index holds. Reads look at the tombstones instead,
+    // so that keys only in storage are not added by them.
+    void materialize(const std::string& key) {
+        if (_kvs.find(key) != _kvs.end()) {
+            return;
+        }
+        auto tss = _ranges->Covering(key);
+        if (tss.empty()) {
+            return;
+        }
+        MVCCValue* mv = findOrAdd(key);
+        for (auto ts : tss) {
+            auto deleted = std::make_shared<Value>();
+            deleted->set_is_delete(true);
+            mv->_t2v.insert(std::make_pair(ts, std::move(deleted)));
+        }
+    }
+
+    // Need hold _latch before call this func.
+    // Returns the MVCCValue of key, adding an empty one if there is none.
+    MVCCValue* findOrAdd(const std::string& key) {
+        auto iter = _kvs.find(key);
+        if (iter == _kvs.end()) {
+            iter = _kvs.insert(std::make_pair(key, std::unique_ptr<MVCCValue>(new MVCCValue()))).first;
+            _ordered.insert(std::make_pair(&iter->first, iter->second.get()));
+        }
+        return iter->second.get();
+    }
+
+    // Need hold _latch before call this func.
+    // Reads data.key for a scan, returns whether it should be filled. A failure is kept in "sts" if it has none.
+    bool scanned(txindex::ScannedData& data, const TxIdentifier& txid, TxOpStatus& sts) {
+        data.status = read(data.key, data.value, txid, nullptr, nullptr);
+        auto code = data.status.error_code();
+        if (code == TxOpStatus_Code_Ok || code == TxOpStatus_Code_ReadBlock || code == TxOpStatus_Code_ReadNeedBase) {
+            return true;
+        }
+        if (code != TxOpStatus_Code_ReadNotExist && sts.error_code() == TxOpStatus_Code_Ok) {
+            sts = data.status;
+        }
+        return false;
+    }
+
+    // Need hold _latch before call this func.
+    // Wakes up the ops blocked on key, they will try again.
+    void notifyBlocked(const std::string& key) {
+        auto iter = _blocked_ops.find(key);
+        if (iter == _blocked_ops.end()) {
+            return;
+        }
+        for (auto& func : iter->second) {
+            bthread_t bid;
+            auto* arg = new std::function<void()>(func);
+            if (bthread_start_background(&bid, nullptr, CallbackWrapper, arg) != 0) {
+                LOG(ERROR) << "Failed to start callback.";
+            }
+        }
+        iter->second.clear();
+    }
+
+    // Need hold _latch before call this func.
+    // Logs a change of key, which readers caching it should drop.
+    // Nothing is logged when caching is disabled, so that writes do not contend on the change log.
+    void markChanged(const std::string& key, MVCCValue* mv) {
+        if (FLAGS_change_log_size > 0) {
+            mv->_changed = _changes->Append(key);
+        }
+    }
+
+    // Need hold _latch before call this func.
+    // Checks whether txid could write v to key and commit it right now, nothing is changed.
+    TxOpStatus checkWrite(const std::string& key, const Value& v, const TxIdentifier& txid) {
+        TxOpStatus sts;
+        std::stringstream ss;
+        materialize(key);
+        auto iter = _kvs.find(key);
+        if (iter != _kvs.end()) {
+            MVCCValue* mv = iter->second.get();
+            auto ltv = mv->LargestTSValue();
+            // an operand only has to land above the versions there and those persisted, as it folds onto any of them
+            if (ltv.first >= (v.has_merge_op() ? txid.commit_ts() : txid.start_ts())
+                || (v.has_merge_op() && mv->_persisted_ts >= txid.commit_ts())) {
+                ss << "Tx(" << txid.ShortDebugString() << ") one phase commit on " << "key: "<< key << " too late. "
+                   << "Find " << "largest ts: " << std::max(ltv.first, mv->_persisted_ts) << " value: "
+                   << (ltv.second ? ltv.second->ShortDebugString() : "persisted");
+                sts.set_error_code(TxOpStatus_Code_WriteTooLate);
+                mv->AddConflict(butil::gettimeofday_ms());
+                sts.set_error_message(ss.str());
+                LOG(INFO) << ss.str();
+                return sts;
+            }
+
+            if ((mv->HasIntent() || mv->HasLock()) && txid.start_ts() != mv->Holder().start_ts()) {
+                assert(!(mv->HasIntent() && mv->HasLock()));
+                ss << "Tx(" << txid.ShortDebugString() << ") one phase commit on " << "key: "<< key << " conflicts. "
+                   << "Find " << (mv->HasLock() ? "lock" : "intent") << " Tx(" << mv->Holder().ShortDebugString() << ") value: "
+                   << (mv->HasLock() ? "" : mv->IntentValue()->ShortDebugString());
+                sts.set_error_code(TxOpStatus_Code_WriteConflicts);
+                mv->AddConflict(butil::gettimeofday_ms());
+                sts.set_error_message(ss.str());
+                LOG(INFO) << ss.str();
+                return sts;
+            }
+
+            if (!v.has_merge_op() && mv->OthersMerging(txid.start_ts())) {
+                ss << "Tx(" << txid.ShortDebugString() << ") one phase commit on " << "key: "<< key << " conflicts. "
+                   << "Find " << mv->_merge_intents.size() << " merge intents";
+                sts.set_error_code(TxOpStatus_Code_WriteConflicts);
+                mv->AddConflict(butil::gettimeofday_ms());
+                sts.set_error_message(ss.str());
+                LOG(INFO) << ss.str();
+                return sts;
+            }
+        }
+
+        if (v.has_merge_op() && (!ValidOperand(v.merge_op(), v.content())
+                                 || (iter != _kvs.end() && !mergeable(iter->second.get(), v)))) {
+            ss << "Tx(" << txid.ShortDebugString() << ") one phase commit on " << "key: "<< key << " failed. "
+               << "Could not merge by: " << v.merge_op();
+            sts.set_error_code(TxOpStatus_Code_MergeFailed);
+            sts.set_error_message(ss.str());
+            LOG(WARNING) << ss.str();
+            return sts;
+        }
+
+        ss << "Tx(" << txid.ShortDebugString() << ") one phase commit on " << "key: "<< key << " successes. ";
+        sts.set_error_code(TxOpStatus_Code_Ok);
+        sts.set_error_message(ss.str());
+        return sts;
+    }
+
+    // Need hold _latch before call this func.
+    // Keeps the outcome of txid if it is finishing its primary intent on mv.
+    void recordOutcome(MVCCValue* mv, const TxIdentifier& txid, bool committed) {
+        auto* info = mv->AsyncCommit();
+        if (mv->HasIntent() && info != nullptr && info->keys_size() > 0) {
+            auto& outcome = mv->_async_outcomes[txid.start_ts()];
+            outcome.committed = committed;
+            outcome.info.Swap(info);
+            outcome.fenced_ms = 0;
+        }
+    }
+
+    // Need hold _latch before call this func.
+    // Records txid aborted on key, which txid has nothing on, dropping the fences there that are out of time.
+    void fence(const std::string& key, const TxIdentifier& txid) {
+        if (FLAGS_clean_fence_ms <= 0) {
+            return;
+        }
+        MVCCValue* mv = findOrAdd(key);
+        int64_t now = butil::gettimeofday_ms();
+        for (auto iter = mv->_async_outcomes.begin(); iter != mv->_async_outcomes.end();) {
+            if (iter->second.fenced_ms > 0 && iter->second.fenced_ms + FLAGS_clean_fence_ms < now) {
+                iter = mv->_async_outcomes.erase(iter);
+            } else {
+                iter++;
+            }
+        }
+        auto& outcome = mv->_async_outcomes[txid.start_ts()];
+        outcome.committed = false;
+        outcome.info.Clear();
+        outcome.fenced_ms = now;
+    }
+
+    // Need hold _latch before call this func.
+    const MVCCValue::AsyncOutcome* findOutcome(MVCCValue* mv, const TxIdentifier& txid) {
+        auto iter = mv->_async_outcomes.find(txid.start_ts());
+        return iter == mv->_async_outcomes.end() ? nullptr : &iter->second;
+    }
+
+    // Need hold _latch before call this func, and checkWrite on key should have succeeded.
+    // Commits v at txid's commit_ts directly, releasing txid's lock on key if any.
+    void commitWrite(const std::string& key, const std::shared_ptr<Value>& v, const TxIdentifier& txid) {
+        materialize(key);
+        MVCCValue* mv = findOrAdd(key);
+        markChanged(key, mv);
+        mv->_holder.Clear();
+        mv->_t2v.insert(std::make_pair(txid.commit_ts(), v));
+        mv->_intent_value.reset();
+        mv->_async_commit.reset(nullptr);
+        mv->_merge_intents.erase(txid.start_ts());
+        mv->_has_intent = false;
+        mv->_has_lock = false;
+        LOG(INFO) << "Tx(" << txid.ShortDebugString() << ") one phase commit on " << "key: "<< key << " successes. "
+                  << "value: " << v->ShortDebugString();
+
+        notifyBlocked(key);
+    }
+
+    // Need hold _latch before call this func.
+    // "streamed" tells whether the intent is written before txid takes a commit_ts, see BatchWriteIntent.
+    TxOpStatus writeIntent(const std::string& key, const std::shared_ptr<Value>& v, const TxIdentifier& txid, const AsyncCommitInfo* async_commit, bool streamed) {
+        if (v->has_merge_op()) {
+            return writeMergeIntent(key, v, txid, streamed);
+        }
+        TxOpStatus sts;
+        std::stringstream ss;
+        materialize(key);
+        MVCCValue* mv = findOrAdd(key);
+        auto outcome = findOutcome(mv, txid);
+        if (outcome != nullptr) {
+            // a delayed intent of a tx which a reader has decided already
+            ss << "Tx(" << txid.ShortDebugString() << ") write intent on " << "key: "<< key << " fail. "
+               << "Find the tx " << (outcome->committed ? "committed" : "aborted");
+            sts.set_error_code(outcome->committed ? TxOpStatus_Code_TxCommitted : TxOpStatus_Code_TxAborted);
+            sts.set_error_message(ss.str());
+            LOG(WARNING) << ss.str();
+            return sts;
+        }
+        auto ltv = mv->LargestTSValue();
+
+        if (ltv.first >= txid.start_ts()) {
+            ss << "Tx(" << txid.ShortDebugString() << ") write intent on " << "key: "<< key << " too late. "
+               << "Find " << "largest ts: " << ltv.first << " value: "
+               << ltv.second->ShortDebugString();
+            sts.set_error_code(TxOpStatus_Code_WriteTooLate);
+            mv->AddConflict(butil::gettimeofday_ms());
+            sts.set_error_message(ss.str());
+            LOG(INFO) << ss.str();
+            return sts;
+        }
+
+        if (mv->OthersMerging(txid.start_ts())) {
+            ss << "Tx(" << txid.ShortDebugString() << ") write intent on " << "key: "<< key << " conflicts. "
+               << "Find " << mv->_merge_intents.size() << " merge intents";
+            sts.set_error_code(TxOpStatus_Code_WriteConflicts);
+            mv->AddConflict(butil::gettimeofday_ms());
+            sts.set_error_message(ss.str());
+            LOG(INFO) << ss.str();
+            return sts;
+        }
+
+        if ((mv->HasIntent() || mv->HasLock()) && txid.start_ts() != mv->Holder().start_ts()) {
+            assert(!(mv->HasIntent() && mv->HasLock()));
+            ss << "Tx(" << txid.ShortDebugString() << ") write intent on " << "key: "<< key << " conflicts. "
+               << "Find " << (mv->HasLock() ? "lock" : "intent") << " Tx(" << mv->Holder().ShortDebugString() << ") value: "
+               << (mv->HasLock() ? "" : mv->IntentValue()->ShortDebugString());
+            sts.set_error_code(TxOpStatus_Code_WriteConflicts);
+            mv->AddConflict(butil::gettimeofday_ms());
+            sts.set_error_message(ss.str());
+            LOG(INFO) << ss.str();
+            return sts;
+        }
+
+        // readers passing the streamed intents of this tx before should not see the ones replacing them either
+        TimeStamp passed_ts = mv->HasIntent() ? mv->_passed_ts : MIN_TIMESTAMP;
+        auto own_merge = mv->_merge_intents.find(txid.start_ts());
+        if (own_merge != mv->_merge_intents.end()) {
+            passed_ts = std::max(passed_ts, own_merge->second.passed_ts);
+        }
+        if (passedBy(passed_ts, key, txid, mv, sts)) {
+            return sts;
+        }
+
+        // the intent is written from here on
+        markChanged(key, mv);
+        // the whole value replaces what this tx merged before
+        mv->_merge_intents.erase(txid.start_ts());
+
+        if (mv->HasIntent() || mv->HasLock()) {
+            assert(!(mv->HasIntent() && mv->HasLock()));
+            if (mv->HasIntent()) {
+                // the tx may write the key again after streaming its intent, the latest value wins
+                ss << "Tx(" << txid.ShortDebugString() << ") write intent on " << "key: "<< key << " repeated. "
+                   << "Find "<< "intent" << " Tx(" << mv->Holder().ShortDebugString() << ") value: "
+                   << mv->IntentValue()->ShortDebugString();
+                mv->_holder = txid;
+                mv->_intent_value = v;
+                mv->_streamed = mv->_streamed || streamed;
+                mv->_passed_ts = passed_ts;
+                mv->_async_commit.reset(async_commit ? new AsyncCommitInfo(*async_commit) : nullptr);
+                sts.set_error_code(TxOpStatus_Code_Ok);
+                sts.set_error_message(ss.str());
+                LOG(NOTICE) << ss.str();
+                return sts;
+            }
+
+            mv->_has_lock = false;
+            mv->_has_intent = true;
+            mv->_holder = txid;
+            mv->_intent_value = v;
+            mv->_async_commit.reset(async_commit ? new AsyncCommitInfo(*async_commit) : nullptr);
+            mv->_streamed = streamed;
+            mv->_passed_ts = passed_ts;
+            ss << "Tx(" << txid.ShortDebugString() << ") write intent on " << "key: "<< key << " successes. "
+               << "Find "<< "lock" << " Tx(" << mv->Holder().ShortDebugString() << ") value: ";
+            sts.set_error_code(TxOpStatus_Code_Ok);
+            sts.set_error_message(ss.str());
+            LOG(INFO) << ss.str();
+            return sts;
+        }
+
+        mv->_has_intent = true;
+        mv->_holder = txid;
+        mv->_intent_value = v;
+        mv->_async_commit.reset(async_commit ? new AsyncCommitInfo(*async_commit) : nullptr);
+        mv->_streamed = streamed;
+        mv->_passed_ts = passed_ts;
+        ss << "Tx(" << txid.ShortDebugString() << ") write intent on " << "key: "<< key << " successes. ";
+        sts.set_error_code(TxOpStatus_Code_Ok);
+        sts.set_error_message(ss.str());
+        LOG(INFO) << ss.str();
+        return sts;
+    }
+
+    // Need hold _latch before call this func, and v should be a merge operand.
+    TxOpStatus writeMergeIntent(const std::string& key, const std::shared_ptr<Value>& v, const TxIdentifier& txid, bool streamed) {
+        TxOpStatus sts;
+        std::stringstream ss;
+        if (!ValidOperand(v->merge_op(), v->content())) {
+            ss << "Tx(" << txid.ShortDebugString() << ") write merge intent on " << "key: "<< key << " failed. "
+               << "Unknown merge operator: " << v->merge_op() << " or invalid operand: " << v->content();
+            sts.set_error_code(TxOpStatus_Code_MergeFailed);
+            sts.set_error_message(ss.str());
+            LOG(WARNING) << ss.str();
+            return sts;
+        }
+        materialize(key);
+        MVCCValue* mv = findOrAdd(key);
+        auto ltv = mv->LargestTSValue();
+
+        // An operand folds onto whatever version is before it, so only versions it could not land above are too late,
+        // including those persisted and truncated, which it could not fold into any more.
+        // An intent streamed before the tx gets its commit_ts is checked against its start_ts instead.
+        auto ts = txid.has_commit_ts() ? txid.commit_ts() : txid.start_ts();
+        if (ltv.first >= ts || mv->_persisted_ts >= ts) {
+            ss << "Tx(" << txid.ShortDebugString() << ") write merge intent on " << "key: "<< key << " too late. "
+               << "Find " << "largest ts: " << std::max(ltv.first, mv->_persisted_ts) << " value: "
+               << (ltv.second ? ltv.second->ShortDebugString() : "persisted");
+            sts.set_error_code(TxOpStatus_Code_WriteTooLate);
+            mv->AddConflict(butil::gettimeofday_ms());
+            sts.set_error_message(ss.str());
+            LOG(INFO) << ss.str();
+            return sts;
+        }
+
+        if ((mv->HasIntent() || mv->HasLock()) && txid.start_ts() != mv->Holder().start_ts()) {
+            assert(!(mv->HasIntent() && mv->HasLock()));
+            ss << "Tx(" << txid.ShortDebugString() << ") write merge intent on " << "key: "<< key << " conflicts. "
+               << "Find " << (mv->HasLock() ? "lock" : "intent") << " Tx(" << mv->Holder().ShortDebugString() << ") value: "
+               << (mv->HasLock() ? "" : mv->IntentValue()->ShortDebugString());
+            sts.set_error_code(TxOpStatus_Code_WriteConflicts);
+            mv->AddConflict(butil::gettimeofday_ms());
+            sts.set_error_message(ss.str());
+            LOG(INFO) << ss.str();
+            return sts;
+        }
+
+        if (mv->HasIntent()) {
+            // folded into the whole value this tx wrote before
+            if (passedBy(mv->_passed_ts, key, txid, mv, sts)) {
+                return sts;
+            }
+            auto folded = std::make_shared<Value>(*mv->IntentValue());
+            if (!FoldMerge(*folded, *v)) {
+                return mergeFailed(key, txid, *folded, *v);
+            }
+            markChanged(key, mv);
+            mv->_holder = txid;
+            ss << "Tx(" << txid.ShortDebugString() << ") write merge intent on " << "key: "<< key << " successes. "
+               << "Folded into its intent value: " << folded->ShortDebugString();
+            mv->_intent_value = std::move(folded);
+            sts.set_error_code(TxOpStatus_Code_Ok);
+            sts.set_error_message(ss.str());
+            LOG(INFO) << ss.str();
+            return sts;
+        }
+
+        if (!mergeable(mv, *v)) {
+            ss << "Tx(" << txid.ShortDebugString() << ") write merge intent on " << "key: "<< key << " failed. "
+               << "Find operands not using: " << v->merge_op();
+            sts.set_error_code(TxOpStatus_Code_MergeFailed);
+            sts.set_error_message(ss.str());
+            LOG(WARNING) << ss.str();
+            return sts;
+        }
+
+        auto own = mv->_merge_intents.find(txid.start_ts());
+        std::shared_ptr<Value> combined;
+        if (own != mv->_merge_intents.end()) {
+            if (passedBy(own->second.passed_ts, key, txid, mv, sts)) {
+                return sts;
+            }
+            combined = std::make_shared<Value>(*own->second.value);
+            if (!FoldMerge(*combined, *v)) {
+                return mergeFailed(key, txid, *combined, *v);
+            }
+        }
+
+        markChanged(key, mv);
+        // the lock is not needed any more, operands do not conflict with each other
+        if (mv->HasLock()) {
+            mv->_holder.Clear();
+            mv->_has_lock = false;
+        }
+        auto& merge = mv->_merge_intents[txid.start_ts()];
+        if (combined) {
+            merge.value = std::move(combined);
+        } else {
+            merge.value = v;
+            merge.streamed = streamed;
+        }
+        merge.holder = txid;
+        ss << "Tx(" << txid.ShortDebugString() << ") write merge intent on " << "key: "<< key << " successes. "
+           << "Find " << mv->_merge_intents.size() << " merge intents";
+        sts.set_error_code(TxOpStatus_Code_Ok);
+        sts.set_error_message(ss.str());
+        LOG(INFO) << ss.str();
+        return sts;
+    }
+
+    TxOpStatus mergeFailed(const std::string& key, const TxIdentifier& txid, const Value& value, const Value& operand) {
+        TxOpStatus sts;
+        std::stringstream ss;
+        ss << "Tx(" << txid.ShortDebugString() << ") write merge intent on " << "key: "<< key << " failed. "
+           << "Could not fold value: " << value.ShortDebugString() << " with operand: " << operand.ShortDebugString();
+        sts.set_error_code(TxOpStatus_Code_MergeFailed);
+        sts.set_error_message(ss.str());
+        LOG(WARNING) << ss.str();
+        return sts;
+    }
+
+    // Need hold _latch before call this func.
+    // Gives txid, along with its commit_ts, to the intent or merge intent it streamed on key before.
+    TxOpStatus stampIntent(const std::string& key, const TxIdentifier& txid, const AsyncCommitInfo* async_commit) {
+        TxOpStatus sts;
+        std::stringstream ss;
+        auto iter = _kvs.find(key);
+        MVCCValue* mv = iter == _kvs.end() ? nullptr : iter->second.get();
+        if (mv != nullptr && mv->HasIntent() && mv->Holder().start_ts() == txid.start_ts()) {
+            if (passedBy(mv->_passed_ts, key, txid, mv, sts)) {
+                return sts;
+            }
+            mv->_holder = txid;
+            mv->_async_commit.reset(async_commit ? new AsyncCommitInfo(*async_commit) : nullptr);
+        } else if (mv != nullptr && mv->_merge_intents.count(txid.start_ts()) > 0) {
+            auto& merge = mv->_merge_intents[txid.start_ts()];
+            if (passedBy(merge.passed_ts, key, txid, mv, sts)) {
+                return sts;
+            }
+            merge.holder = txid;
+        } else {
+            ss << "Tx(" << txid.ShortDebugString() << ") stamp intent on " << "key: "<< key << " not exist. ";
+            sts.set_error_code(TxOpStatus_Code_CommitNotExist);
+            sts.set_error_message(ss.str());
+            LOG(WARNING) << ss.str();
+            return sts;
+        }
+        ss << "Tx(" << txid.ShortDebugString() << ") stamp intent on " << "key: "<< key << " successes. ";
+        sts.set_error_code(TxOpStatus_Code_Ok);
+        sts.set_error_message(ss.str());
+        LOG(INFO) << ss.str();
+        return sts;
+    }
+
+    // Need hold _latch before call this func.
+    // Fails with WriteTooLate if a reader at or after txid's commit_ts has passed the streamed intent of txid,
+    // which it would miss if the tx committed.
+    bool passedBy(TimeStamp passed_ts, const std::string& key, const TxIdentifier& txid, MVCCValue* mv, TxOpStatus& sts) {
+        if (!txid.has_commit_ts() || passed_ts < txid.commit_ts()) {
+            return false;
+        }
+        std::stringstream ss;
+        ss << "Tx(" << txid.ShortDebugString() << ") write intent on " << "key: "<< key << " too late. "
+           << "Find " << "its streamed intent passed by reader ts: " << passed_ts;
+        sts.set_error_code(TxOpStatus_Code_WriteTooLate);
+        mv->AddConflict(butil::gettimeofday_ms());
+        sts.set_error_message(ss.str());
+        LOG(INFO) << ss.str();
+        return true;
+    }
+
+    // Need hold _latch before call this func.
+    // Operands are folded together before the value they fold onto is known, so an operand could only follow
+    // the ones using the same operator, back to the latest whole value.
+    bool mergeable(MVCCValue* mv, const Value& v) {
+        for (auto& it : mv->_merge_intents) {
+            if (it.second.value->merge_op() != v.merge_op()) {
+                return false;
+            }
+        }
+        for (auto& it : mv->_t2v) {
+            if (!it.second->has_merge_op()) {
+                break;
+            }
+            if (it.second->merge_op() != v.merge_op()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Need hold _latch before call this func.
+    // "intent" is nullptr if the read should be blocked by async commit intents as well.
+    // "callback" is empty if the caller does not wait for the blocking intent.
+    TxOpStatus read(const std::string& key, std::shared_ptr<const Value>& v, const TxIdentifier& txid, std::function<void()> callback, txindex::AsyncIntent* intent) {
+        TxOpStatus sts;
+        std::stringstream ss;
+        auto iter = _kvs.find(key);
+        if (iter == _kvs.end()) {
+            // a key only in storage is not added for reads, the range tombstones covering it are looked up instead
+            TimeStamp deleted_ts = MIN_TIMESTAMP;
+            for (auto ts : _ranges->Covering(key)) {
+                if (ts <= txid.start_ts()) {
+                    deleted_ts = std::max(deleted_ts, ts);
+                }
+            }
+            if (deleted_ts != MIN_TIMESTAMP) {
+                ss << "Tx(" << txid.ShortDebugString() << ") read on " << "key: "<< key << " success. "
+                   << "Find " << "range deleted at ts: " << deleted_ts;
+                sts.set_error_code(TxOpStatus_Code_Ok);
+                sts.set_error_message(ss.str());
+                LOG(INFO) << ss.str();
+                v = RangeDeleted();
+                return sts;
+            }
+            ss << "Tx(" << txid.ShortDebugString() << ") read on " << "key: "<< key << " not exist. ";
+            sts.set_error_code(TxOpStatus_Code_ReadNotExist);
+            sts.set_error_message(ss.str());
+            LOG(INFO) << ss.str();
+            return sts;
+        }
+
+        // a tx streaming its intents reads them back here
+        if (iter->second->HasIntent() && iter->second->Holder().start_ts() == txid.start_ts()) {
+            ss << "Tx(" << txid.ShortDebugString() << ") read on " << "key: "<< key << " success. "
+               << "Find its own intent value: " << iter->second->IntentValue()->ShortDebugString();
+            sts.set_error_code(TxOpStatus_Code_Ok);
+            sts.set_error_message(ss.str());
+            LOG(INFO) << ss.str();
+            v = iter->second->_intent_value;
+            return sts;
+        }
+
+        if (iter->second->HasLock() && iter->second->Holder().start_ts() == txid.start_ts()) {
+            ss << "Tx(" << txid.ShortDebugString() << ") read on " << "key: "<< key << " not exist. "
+               << "Find its own lock Tx(" << iter->second->Holder().ShortDebugString() << ")";
+            sts.set_error_code(TxOpStatus_Code_ReadNotExist);
+            sts.set_error_message(ss.str());
+            LOG(ERROR) << ss.str();
+            return sts;
+        }
+
+        // An intent whose commit_ts is larger than txid's start_ts will not be seen by txid even if it commits,
+        // so only the others block the read.
+        if (iter->second->HasIntent() && iter->second->Holder().start_ts() < txid.start_ts()
+            && !iter->second->Holder().has_commit_ts() && iter->second->_streamed) {
+            // the tx has not taken its commit_ts yet, and will commit after txid instead, see BatchWriteIntent
+            iter->second->_passed_ts = std::max(iter->second->_passed_ts, txid.start_ts());
+        } else if (iter->second->HasIntent() && iter->second->Holder().start_ts() < txid.start_ts()
+            && !(iter->second->Holder().has_commit_ts() && iter->second->Holder().commit_ts() > txid.start_ts())) {
+            assert(!iter->second->HasLock());
+            if (intent != nullptr && iter->second->AsyncCommit() != nullptr) {
+                ss << "Tx(" << txid.ShortDebugString() << ") read on " << "key: "<< key << " meets async commit intent. "
+                   << "Find "<< "intent" << " Tx(" << iter->second->Holder().ShortDebugString() << ") value: "
+                   << iter->second->IntentValue()->ShortDebugString()
+                   << " async commit: " << iter->second->AsyncCommit()->ShortDebugString();
+                sts.set_error_code(TxOpStatus_Code_ReadAsyncIntent);
+                sts.set_error_message(ss.str());
+                LOG(INFO) << ss.str();
+                intent->holder = iter->second->Holder();
+                intent->info = *iter->second->AsyncCommit();
+                return sts;
+            }
+            ss << "Tx(" << txid.ShortDebugString() << ") read on " << "key: "<< key << " blocked. "
+               << "Find "<< "intent" << " Tx(" << iter->second->Holder().ShortDebugString() << ") value: "
+               << iter->second->IntentValue()->ShortDebugString();
+            sts.set_error_code(TxOpStatus_Code_ReadBlock);
+            sts.set_error_message(ss.str());
+            LOG(INFO) << ss.str();
+            if (!callback) {
+                return sts;
+            }
+            if (_blocked_ops.find(key) == _blocked_ops.end()) {
+                _blocked_ops.insert(std::make_pair(key, std::vector<std::function<void()>>()));
+            }
+            _blocked_ops[key].push_back(callback);
+            return sts;
+        }
+
+        // merge intents block the read as intents do
+        for (auto& it : iter->second->_merge_intents) {
+            auto& holder = it.second.holder;
+            if (holder.start_ts() >= txid.start_ts()
+                || (holder.has_commit_ts() && holder.commit_ts() > txid.start_ts())) {
+                continue;
+            }
+            if (!holder.has_commit_ts() && it.second.streamed) {
+                it.second.passed_ts = std::max(it.second.passed_ts, txid.start_ts());
+                continue;
+            }
+            ss << "Tx(" << txid.ShortDebugString() << ") read on " << "key: "<< key << " blocked. "
+               << "Find "<< "merge intent" << " Tx(" << holder.ShortDebugString() << ") value: "
+               << it.second.value->ShortDebugString();
+            sts.set_error_code(TxOpStatus_Code_ReadBlock);
+            sts.set_error_message(ss.str());
+            LOG(INFO) << ss.str();
+            if (!callback) {
+                return sts;
+            }
+            _blocked_ops[key].push_back(callback);
+            return sts;
+        }
+
+        auto own_merge = iter->second->_merge_intents.find(txid.start_ts());
+        auto sv = iter->second->Seek(txid.start_ts());
+        if (sv.first <= txid.start_ts() && !sv.second->has_merge_op() && own_merge == iter->second->_merge_intents.end()) {
+            ss << "Tx(" << txid.ShortDebugString() << ") read on " << "key: "<< key << " success. "
+               << "Find " << "ts: " << sv.first << " value: "
+               << sv.second->ShortDebugString();
+            sts.set_error_code(TxOpStatus_Code_Ok);
+            sts.set_error_message(ss.str());
+            LOG(INFO) << ss.str();
+            v = std::move(sv.second);
+            return sts;
+        }
+
+        if (sv.first <= txid.start_ts() || own_merge != iter->second->_merge_intents.end()) {
+            return readMerged(key, v, txid);
+        }
+
+        ss << "Tx(" << txid.ShortDebugString() << ") read on " << "key: "<< key << " not exist. ";
+        sts.set_error_code(TxOpStatus_Code_ReadNotExist);
+        sts.set_error_message(ss.str());
+        LOG(INFO) << ss.str();
+        return sts;
+    }
+
+    // Need hold _latch before call this func, and key should have merge operands visible to txid.
+    // Folds the operands onto the latest whole value before them, along with txid's own merge intent.
+    TxOpStatus readMerged(const std::string& key, std::shared_ptr<const Value>& v, const TxIdentifier& txid) {
+        TxOpStatus sts;
+        std::stringstream ss;
+        MVCCValue* mv = _kvs[key].get();
+        std::vector<const Value*> operands; // newest first
+        auto base = mv->_t2v.lower_bound(txid.start_ts());
+        auto base_ts = txid.start_ts(); // where storage has the value to fold onto
+        for (; base != mv->_t2v.end() && base->second->has_merge_op(); base++) {
+            operands.push_back(base->second.get());
+            base_ts = base->first - 1;
+        }
+        std::reverse(operands.begin(), operands.end());
+        auto own_merge = mv->_merge_intents.find(txid.start_ts());
+        if (own_merge != mv->_merge_intents.end()) {
+            operands.push_back(own_merge->second.value.get());
+        }
+
+        auto result = std::make_shared<Value>();
+        auto& folded = *result;
+        size_t i = 0;
+        if (base != mv->_t2v.end()) {
+            folded.CopyFrom(*base->second);
+        } else {
+            folded.CopyFrom(*operands[i++]);
+        }
+        for (; i < operands.size(); i++) {
+            if (!FoldMerge(folded, *operands[i])) {
+                ss << "Tx(" << txid.ShortDebugString() << ") read on " << "key: "<< key << " failed. "
+                   << "Could not fold value: " << folded.ShortDebugString() << " with operand: " << operands[i]->ShortDebugString();
+                sts.set_error_code(TxOpStatus_Code_MergeFailed);
+                sts.set_error_message(ss.str());
+                LOG(ERROR) << ss.str();
+                return sts;
+            }
+        }
+
+        if (base == mv->_t2v.end()) {
+            folded.set_merge_base_ts(base_ts);
+            ss << "Tx(" << txid.ShortDebugString() << ") read on " << "key: "<< key << " needs base. "
+               << "Find " << operands.size() << " operands folded into: " << folded.ShortDebugString();
+            sts.set_error_code(TxOpStatus_Code_ReadNeedBase);
+        } else {
+            ss << "Tx(" << txid.ShortDebugString() << ") read on " << "key: "<< key << " success. "
+               << "Find " << operands.size() << " operands folded onto ts: " << base->first
+               << " into: " << folded.ShortDebugString();
+            sts.set_error_code(TxOpStatus_Code_Ok);
+        }
+        sts.set_error_message(ss.str());
+        LOG(INFO) << ss.str();
+        v = std::move(result);
+        return sts;
+    }
+
     std::unordered_map<std::string, std::unique_ptr<MVCCValue>> _kvs;
+    // the keys of _kvs in order, so that a range of them can be scanned without slowing down the point ops
+    std::map<const std::string*, MVCCValue*, KeyLess> _ordered;
     std::unordered_map<std::string, std::vector<std::function<void()>>> _blocked_ops;
     bthread::Mutex _latch;
+    ChangeLog* _changes; // shared by all the buckets
+    RangeTombstones* _ranges; // shared by all the buckets
 };
 
 class TxIndexImpl : public txindex::TxIndex {
 public:
     TxIndexImpl(const std::string& storage_addr) :
+    _changes(),
+    _ranges(),
     _kvbs(FLAGS_latch_bucket_num),
     _persistor(this, storage_addr),
     _last_persist_bucket_num(0) {
         for (auto &it: _kvbs) {
-            it.reset(new KVBucket());
+            it.reset(new KVBucket(&_changes, &_ranges));
         }
         if(FLAGS_enable_persistor){
             _persistor.Start();
@@ -451,11 +1613,81 @@ public:
         return _kvbs[bucket_num]->WriteLock(key, txid, callback);
     }
 
-    virtual TxOpStatus WriteIntent(const std::string& key, const Value& v, const TxIdentifier& txid) override {
+    virtual TxOpStatus WriteIntent(const std::string& key, const std::shared_ptr<Value>& v, const TxIdentifier& txid) override {
         auto bucket_num = butil::Hash(key) % FLAGS_latch_bucket_num;
         return _kvbs[bucket_num]->WriteIntent(key, v, txid);
     }
 
+    virtual TxOpStatus ConditionalWriteIntent(const std::string& key, const std::shared_ptr<Value>& v, const Value& expected, const TxIdentifier& txid) override {
+        auto bucket_num = butil::Hash(key) % FLAGS_latch_bucket_num;
+        return _kvbs[bucket_num]->ConditionalWriteIntent(key, v, expected, txid);
+    }
+
+    virtual TxOpStatus BatchWriteIntent(const std::vector<txindex::DataToWrite>& datas, const TxIdentifier& txid, std::vector<TxOpStatus>& stss) override {
+        // group datas by latch bucket, so that every bucket's latch is taken once
+        std::map<uint32_t, std::vector<size_t>> bucket2idxs;
+        for (size_t i = 0; i < datas.size(); i++) {
+            bucket2idxs[butil::Hash(*datas[i].key) % FLAGS_latch_bucket_num].push_back(i);
+        }
+
+        TxOpStatus sts;
+        stss.assign(datas.size(), TxOpStatus());
+        std::vector<txindex::DataToWrite> bucket_datas;
+        std::vector<TxOpStatus> bucket_stss;
+        for (auto& it : bucket2idxs) {
+            bucket_datas.clear();
+            for (auto i : it.second) {
+                bucket_datas.push_back(datas[i]);
+            }
+            _kvbs[it.first]->BatchWriteIntent(bucket_datas, txid, bucket_stss);
+            for (size_t j = 0; j < it.second.size(); j++) {
+                stss[it.second[j]].Swap(&bucket_stss[j]);
+            }
+        }
+        for (auto& s : stss) {
+            if (s.error_code() != TxOpStatus_Code_Ok) {
+                sts = s;
+                break;
+            }
+        }
+        return sts;
+    }
+
+    virtual TxOpStatus OnePhaseCommit(const std::vector<txindex::DataToWrite>& datas, const TxIdentifier& txid, std::vector<TxOpStatus>& stss) override {
+        std::map<uint32_t, std::vector<size_t>> bucket2idxs;
+        for (size_t i = 0; i < datas.size(); i++) {
+            bucket2idxs[butil::Hash(*datas[i].key) % FLAGS_latch_bucket_num].push_back(i);
+        }
+
+        // Hold the latches of all the buckets involved till the end, so that no one sees part of this tx.
+        // Latches are taken in ascending bucket order to avoid deadlocks between one phase commits.
+        std::vector<std::unique_lock<bthread::Mutex>> lcks;
+        lcks.reserve(bucket2idxs.size());
+        for (auto& it : bucket2idxs) {
+            lcks.emplace_back(_kvbs[it.first]->_latch);
+        }
+
+        TxOpStatus sts;
+        stss.assign(datas.size(), TxOpStatus());
+        for (auto& it : bucket2idxs) {
+            for (auto i : it.second) {
+                stss[i] = _kvbs[it.first]->checkWrite(*datas[i].key, *datas[i].value, txid);
+            }
+        }
+        for (auto& s : stss) {
+            if (s.error_code() != TxOpStatus_Code_Ok) {
+                sts = s;
+                return sts;
+            }
+        }
+        for (auto& it : bucket2idxs) {
+            for (auto i : it.second) {
+                _kvbs[it.first]->commitWrite(*datas[i].key, datas[i].value, txid);
+            }
+        }
+        return sts;
+    }
+
     virtual TxOpStatus Clean(const std::string& key, const TxIdentifier& txid) override {
         auto bucket_num = butil::Hash(key) % FLAGS_latch_bucket_num;
         return _kvbs[bucket_num]->Clean(key, txid);
@@ -466,11 +1698,103 @@ public:
         return _kvbs[bucket_num]->Commit(key, txid);
     }
 
-    virtual TxOpStatus Read(const std::string& key, Value& v, const TxIdentifier& txid, std::function<void()> callback) override {
+    virtual TxOpStatus Read(const std::string& key, std::shared_ptr<const Value>& v, const TxIdentifier& txid, std::function<void()> callback) override {
         auto bucket_num = butil::Hash(key) % FLAGS_latch_bucket_num;
         return _kvbs[bucket_num]->Read(key, v, txid, callback);
     }
 
+    virtual TxOpStatus Read(const std::string& key, std::shared_ptr<const Value>& v, const TxIdentifier& txid, std::function<void()> callback, txindex::AsyncIntent& intent) override {
+        auto bucket_num = butil::Hash(key) % FLAGS_latch_bucket_num;
+        return _kvbs[bucket_num]->Read(key, v, txid, callback, intent);
+    }
+
+    virtual TxOpStatus BatchRead(const std::vector<std::string>& keys, std::vector<std::shared_ptr<const Value>>& vs, const TxIdentifier& txid, std::vector<TxOpStatus>& stss) override {
+        // group keys by latch bucket, so that every bucket's latch is taken once
+        std::map<uint32_t, std::vector<size_t>> bucket2idxs;
+        for (size_t i = 0; i < keys.size(); i++) {
+            bucket2idxs[butil::Hash(keys[i]) % FLAGS_latch_bucket_num].push_back(i);
+        }
+
+        TxOpStatus sts;
+        vs.assign(keys.size(), nullptr);
+        stss.assign(keys.size(), TxOpStatus());
+        std::vector<std::string> bucket_keys;
+        std::vector<std::shared_ptr<const Value>> bucket_vs;
+        std::vector<TxOpStatus> bucket_stss;
+        for (auto& it : bucket2idxs) {
+            bucket_keys.clear();
+            for (auto i : it.second) {
+                bucket_keys.push_back(keys[i]);
+            }
+            auto bucket_sts = _kvbs[it.first]->BatchRead(bucket_keys, bucket_vs, txid, bucket_stss);
+            if (sts.error_code() == TxOpStatus_Code_Ok && bucket_sts.error_code() != TxOpStatus_Code_Ok) {
+                sts = bucket_sts;
+            }
+            for (size_t j = 0; j < it.second.size(); j++) {
+                vs[it.second[j]] = std::move(bucket_vs[j]);
+                stss[it.second[j]].Swap(&bucket_stss[j]);
+            }
+        }
+        return sts;
+    }
+
+    virtual TxOpStatus Scan(const std::string& start, const std::string& end, uint32_t limit, const TxIdentifier& txid, std::vector<txindex::ScannedData>& datas) override {
+        // keys are hashed into buckets, each keeping them in order, so the buckets are merged lazily:
+        // the smallest next key among them is read and only its bucket moves on, till "limit" keys are found.
+        TxOpStatus sts;
+        typedef std::pair<std::string, size_t> Next; // the next key of a bucket, and the bucket
+        std::priority_queue<Next, std::vector<Next>, std::greater<Next>> nexts;
+        for (size_t i = 0; i < _kvbs.size(); i++) {
+            std::string key;
+            if (_kvbs[i]->FirstKey(start, end, key)) {
+                nexts.push(std::make_pair(std::move(key), i));
+            }
+        }
+        uint32_t found = 0;
+        while (!nexts.empty() && (limit == 0 || found < limit)) {
+            auto bucket_num = nexts.top().second;
+            txindex::ScannedData data;
+            std::string next;
+            if (_kvbs[bucket_num]->ScanKey(nexts.top().first, end, txid, data, next, sts)) {
+                datas.push_back(std::move(data));
+                found++;
+            }
+            nexts.pop();
+            if (!next.empty()) {
+                nexts.push(std::make_pair(std::move(next), bucket_num));
+            }
+        }
+        return sts;
+    }
+
+    virtual TxOpStatus GetContention(const std::string& key, txindex::Contention& contention) override {
+        auto bucket_num = butil::Hash(key) % FLAGS_latch_bucket_num;
+        return _kvbs[bucket_num]->GetContention(key, contention);
+    }
+
+    virtual TxOpStatus QueryIntent(const std::string& key, const TxIdentifier& txid, AsyncCommitInfo& info) override {
+        auto bucket_num = butil::Hash(key) % FLAGS_latch_bucket_num;
+        return _kvbs[bucket_num]->QueryIntent(key, txid, info);
+    }
+
+    virtual TxOpStatus ForgetAsyncCommit(const std::string& key, const TxIdentifier& txid) override {
+        auto bucket_num = butil::Hash(key) % FLAGS_latch_bucket_num;
+        return _kvbs[bucket_num]->ForgetAsyncCommit(key, txid);
+    }
+
+    virtual uint64_t LatestChange() override {
+        return _changes.Latest();
+    }
+
+    virtual bool ChangesSince(uint64_t since, std::vector<std::string>& keys, uint64_t& latest) override {
+        return _changes.Since(since, keys, latest);
+    }
+
+    virtual bool Cacheable(const std::string& key, TimeStamp ts, uint64_t since) override {
+        auto bucket_num = butil::Hash(key) % FLAGS_latch_bucket_num;
+        return _kvbs[bucket_num]->Cacheable(key, ts, since);
+    }
+
     virtual TxOpStatus GetPersisting(std::vector<txindex::DataToPersist> &datas) override {
         TxOpStatus res;
         for (int i = 0; i < FLAGS_latch_bucket_num; i++) {
@@ -487,7 +1811,60 @@ public:
     virtual TxOpStatus ClearPersisted(const std::vector<txindex::DataToPersist> &datas) override {
         return _kvbs[_last_persist_bucket_num % FLAGS_latch_bucket_num]->ClearPersisted(datas);
     }
+
+    virtual TxOpStatus DeleteRange(const std::string& start, const std::string& end, const TxIdentifier& txid) override {
+        // A blocked range is found bucket by bucket first, without stopping the whole index.
+        for (auto& kvb : _kvbs) {
+            std::lock_guard<bthread::Mutex> lck(kvb->_latch);
+            TxOpStatus sts = kvb->checkDeleteRange(start, end, txid);
+            if (sts.error_code() != TxOpStatus_Code_Ok) {
+                return sts;
+            }
+        }
+        // The latches of all the buckets are held while the range is checked again and marked, so that no one sees part of it.
+        // Latches are taken in ascending bucket order to avoid deadlocks with one phase commits.
+        std::vector<std::unique_lock<bthread::Mutex>> lcks;
+        lcks.reserve(_kvbs.size());
+        for (auto& kvb : _kvbs) {
+            lcks.emplace_back(kvb->_latch);
+        }
+        for (auto& kvb : _kvbs) {
+            TxOpStatus sts = kvb->checkDeleteRange(start, end, txid);
+            if (sts.error_code() != TxOpStatus_Code_Ok) {
+                return sts;
+            }
+        }
+        // keys written from now on carry the deletion, the keys only in storage are read as deleted by the tombstone
+        _ranges.Add(txindex::DeletedRange{start, end, txid.commit_ts()});
+        // and are not known one by one
+        _changes.AppendAll();
+        for (auto& kvb : _kvbs) {
+            kvb->markDeleted(start, end, txid);
+        }
+
+        TxOpStatus sts;
+        std::stringstream ss;
+        ss << "Tx(" << txid.ShortDebugString() << ") delete range from: " << start << " to: " << end << " successes. ";
+        sts.set_error_message(ss.str());
+        LOG(INFO) << ss.str();
+        return sts;
+    }
+
+    virtual void DeletedRanges(const std::string& start, const std::string& end, TimeStamp ts, std::vector<txindex::DeletedRange>& ranges) override {
+        _ranges.Overlapping(start, end, ts, ranges);
+    }
+
+    virtual bool GetPersistingRange(txindex::DeletedRange& range) override {
+        return _ranges.Oldest(range);
+    }
+
+    virtual void ClearPersistedRange(const txindex::DeletedRange& range) override {
+        _ranges.Remove(range.ts);
+        LOG(INFO) << "Clear persisted range from: " << range.start << " to: " << range.end << " ts: " << range.ts;
+    }
 private:
+    ChangeLog _changes; // before _kvbs, which refer to it
+    RangeTombstones _ranges; // before _kvbs, which refer to it
     std::vector<std::unique_ptr<KVBucket>> _kvbs;
     txindex::Persistor _persistor;
     uint32_t _last_persist_bucket_num;
@@ -76,42 +76,245 @@ TEST_F(TxIndexImplTest, dummy) {
 }
 
 TEST_F(TxIndexImplTest, write_intent_ok) {
-    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, v1, t1).error_code());
-    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, v1, t1).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, std::make_shared<azino::Value>(v1), t1).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, std::make_shared<azino::Value>(v1), t1).error_code());
 
     ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteLock(k2, t1, std::bind(&TxIndexImplTest::dummyCallback, this)).error_code());
-    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k2, v1, t1).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k2, std::make_shared<azino::Value>(v1), t1).error_code());
 }
 
 TEST_F(TxIndexImplTest, write_intent_conflicts) {
-    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, v1, t1).error_code());
-    ASSERT_EQ(azino::TxOpStatus_Code_WriteConflicts, ti->WriteIntent(k1, v2, t2).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, std::make_shared<azino::Value>(v1), t1).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_WriteConflicts, ti->WriteIntent(k1, std::make_shared<azino::Value>(v2), t2).error_code());
     ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Clean(k1, t1).error_code());
-    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, v2, t2).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, std::make_shared<azino::Value>(v2), t2).error_code());
 
     ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteLock(k2, t1, std::bind(&TxIndexImplTest::dummyCallback, this)).error_code());
-    ASSERT_EQ(azino::TxOpStatus_Code_WriteConflicts, ti->WriteIntent(k2, v2, t2).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_WriteConflicts, ti->WriteIntent(k2, std::make_shared<azino::Value>(v2), t2).error_code());
     ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Clean(k2, t1).error_code());
-    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k2, v2, t2).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k2, std::make_shared<azino::Value>(v2), t2).error_code());
 }
 
 TEST_F(TxIndexImplTest, write_intent_too_late) {
-    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, v2, t2).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, std::make_shared<azino::Value>(v2), t2).error_code());
     t2.set_commit_ts(4);
     ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Commit(k1, t2).error_code());
-    ASSERT_EQ(azino::TxOpStatus_Code_WriteTooLate, ti->WriteIntent(k1, v1, t1).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_WriteTooLate, ti->WriteIntent(k1, std::make_shared<azino::Value>(v1), t1).error_code());
+}
+
+TEST_F(TxIndexImplTest, batch_write_intent) {
+    std::vector<std::string> keys;
+    for (int i = 0; i < 100; i++) {
+        keys.push_back("batch" + std::to_string(i));
+    }
+    std::vector<azino::txindex::DataToWrite> datas;
+    for (auto& k : keys) {
+        datas.push_back({&k, std::make_shared<azino::Value>(v1), nullptr, false});
+    }
+    std::vector<azino::TxOpStatus> stss;
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->BatchWriteIntent(datas, t1, stss).error_code());
+    ASSERT_EQ(keys.size(), stss.size());
+    for (auto& s : stss) {
+        ASSERT_EQ(azino::TxOpStatus_Code_Ok, s.error_code());
+    }
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->BatchWriteIntent(datas, t1, stss).error_code());
+
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Clean(keys[10], t1).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, std::make_shared<azino::Value>(v2), t2).error_code());
+    datas = {{&keys[10], std::make_shared<azino::Value>(v2), nullptr, false}, {&k1, std::make_shared<azino::Value>(v2), nullptr, false}, {&keys[20], std::make_shared<azino::Value>(v2), nullptr, false}, {&k2, std::make_shared<azino::Value>(v2), nullptr, false}};
+    ASSERT_EQ(azino::TxOpStatus_Code_WriteConflicts, ti->BatchWriteIntent(datas, t2, stss).error_code());
+    ASSERT_EQ(4, stss.size());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, stss[0].error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, stss[1].error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_WriteConflicts, stss[2].error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, stss[3].error_code());
+}
+
+TEST_F(TxIndexImplTest, streamed_intent) {
+    std::vector<azino::txindex::DataToWrite> datas = {{&k1, std::make_shared<azino::Value>(v1), nullptr, true},
+                                                      {&k2, std::make_shared<azino::Value>(v1), nullptr, true}};
+    std::vector<azino::TxOpStatus> stss;
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->BatchWriteIntent(datas, t1, stss).error_code());
+
+    // passed rather than waited before the tx takes its commit_ts
+    std::shared_ptr<const azino::Value> v;
+    azino::TxIdentifier t5;
+    t5.set_start_ts(5);
+    ASSERT_EQ(azino::TxOpStatus_Code_ReadNotExist, ti->Read(k1, v, t5, std::bind(&TxIndexImplTest::dummyCallback, this)).error_code());
+    ASSERT_FALSE(Called());
+
+    // the tx has to commit after the reader
+    t1.set_commit_ts(4);
+    datas = {{&k1, nullptr, nullptr, false}};
+    ASSERT_EQ(azino::TxOpStatus_Code_WriteTooLate, ti->BatchWriteIntent(datas, t1, stss).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_WriteTooLate, ti->WriteIntent(k1, std::make_shared<azino::Value>(v2), t1).error_code());
+
+    // a stamped or rewritten intent takes the commit_ts, readers after it wait again
+    t1.set_commit_ts(6);
+    datas = {{&k1, nullptr, nullptr, false}};
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->BatchWriteIntent(datas, t1, stss).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k2, std::make_shared<azino::Value>(v2), t1).error_code());
+    azino::TxIdentifier t7;
+    t7.set_start_ts(7);
+    ASSERT_EQ(azino::TxOpStatus_Code_ReadBlock, ti->Read(k1, v, t7, std::bind(&TxIndexImplTest::dummyCallback, this)).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_ReadBlock, ti->Read(k2, v, t7, nullptr).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_ReadNotExist, ti->Read(k2, v, t5, nullptr).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Commit(k1, t1).error_code());
+    waitDummyCallback();
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Read(k1, v, t7, nullptr).error_code());
+    ASSERT_EQ(v1.content(), v->content());
+
+    // nothing to stamp without a streamed intent
+    std::string k3 = "key3";
+    datas = {{&k3, nullptr, nullptr, false}};
+    ASSERT_EQ(azino::TxOpStatus_Code_CommitNotExist, ti->BatchWriteIntent(datas, t1, stss).error_code());
+}
+
+TEST_F(TxIndexImplTest, one_phase_commit) {
+    std::vector<std::string> keys;
+    for (int i = 0; i < 100; i++) {
+        keys.push_back("onephase" + std::to_string(i));
+    }
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteLock(keys[0], t2, std::bind(&TxIndexImplTest::dummyCallback, this)).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(keys[50], std::make_shared<azino::Value>(v1), t1).error_code());
+
+    // one conflicting key fails the whole tx, and nothing is left behind
+    std::vector<azino::txindex::DataToWrite> datas;
+    for (auto& k : keys) {
+        datas.push_back({&k, std::make_shared<azino::Value>(v2), nullptr, false});
+    }
+    std::vector<azino::TxOpStatus> stss;
+    t2.set_commit_ts(4);
+    ASSERT_EQ(azino::TxOpStatus_Code_WriteConflicts, ti->OnePhaseCommit(datas, t2, stss).error_code());
+    ASSERT_EQ(keys.size(), stss.size());
+    ASSERT_EQ(azino::TxOpStatus_Code_WriteConflicts, stss[50].error_code());
+    std::shared_ptr<const azino::Value> v;
+    azino::TxIdentifier t5;
+    t5.set_start_ts(5);
+    ASSERT_EQ(azino::TxOpStatus_Code_ReadNotExist, ti->Read(keys[1], v, t5, std::bind(&TxIndexImplTest::dummyCallback, this)).error_code());
+
+    // committed directly, and the lock held by the tx itself is released
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Clean(keys[50], t1).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->OnePhaseCommit(datas, t2, stss).error_code());
+    for (auto& k : keys) {
+        ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Read(k, v, t5, std::bind(&TxIndexImplTest::dummyCallback, this)).error_code());
+        ASSERT_EQ(v2.content(), v->content());
+    }
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteLock(keys[0], t5, std::bind(&TxIndexImplTest::dummyCallback, this)).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_WriteTooLate, ti->OnePhaseCommit(datas, t1, stss).error_code());
+}
+
+TEST_F(TxIndexImplTest, batch_read) {
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, std::make_shared<azino::Value>(v1), t1).error_code());
+    t1.set_commit_ts(3);
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Commit(k1, t1).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k2, std::make_shared<azino::Value>(v2), t2).error_code());
+
+    azino::TxIdentifier t5;
+    t5.set_start_ts(5);
+    std::vector<std::string> keys = {k1, k2, "key3"};
+    std::vector<std::shared_ptr<const azino::Value>> vs;
+    std::vector<azino::TxOpStatus> stss;
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->BatchRead(keys, vs, t5, stss).error_code());
+    ASSERT_EQ(3, stss.size());
+    ASSERT_EQ(3, vs.size());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, stss[0].error_code());
+    ASSERT_EQ(v1.content(), vs[0]->content());
+    ASSERT_EQ(azino::TxOpStatus_Code_ReadBlock, stss[1].error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_ReadNotExist, stss[2].error_code());
+
+    // the blocked key is not waited
+    t2.set_commit_ts(4);
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Commit(k2, t2).error_code());
+    ASSERT_FALSE(Called());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->BatchRead(keys, vs, t5, stss).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, stss[1].error_code());
+    ASSERT_EQ(v2.content(), vs[1]->content());
+}
+
+TEST_F(TxIndexImplTest, scan) {
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, std::make_shared<azino::Value>(v1), t1).error_code());
+    t1.set_commit_ts(3);
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Commit(k1, t1).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k2, std::make_shared<azino::Value>(v2), t2).error_code());
+    azino::TxIdentifier t6;
+    t6.set_start_ts(6);
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent("key3", std::make_shared<azino::Value>(v1), t6).error_code());
+
+    azino::TxIdentifier t5;
+    t5.set_start_ts(5);
+    std::vector<azino::txindex::ScannedData> datas;
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Scan("", "", 0, t5, datas).error_code());
+    ASSERT_EQ(2, datas.size());
+    ASSERT_EQ(k1, datas[0].key);
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, datas[0].status.error_code());
+    ASSERT_EQ(v1.content(), datas[0].value->content());
+    ASSERT_EQ(k2, datas[1].key);
+    ASSERT_EQ(azino::TxOpStatus_Code_ReadBlock, datas[1].status.error_code());
+
+    datas.clear();
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Scan("", "", 1, t5, datas).error_code());
+    ASSERT_EQ(1, datas.size());
+    ASSERT_EQ(k1, datas[0].key);
+
+    datas.clear();
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Scan(k2, "", 0, t5, datas).error_code());
+    ASSERT_EQ(1, datas.size());
+    ASSERT_EQ(k2, datas[0].key);
+    ASSERT_FALSE(Called());
+
+    // keys of many buckets are merged in order, and the scan stops at the limit
+    for (int i = 0; i < 50; i++) {
+        azino::TxIdentifier t;
+        t.set_start_ts(10 + i);
+        t.set_commit_ts(100);
+        std::string key = "scan" + std::to_string(100 + i);
+        ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(key, std::make_shared<azino::Value>(v1), t).error_code());
+        ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Commit(key, t).error_code());
+    }
+    azino::TxIdentifier t200;
+    t200.set_start_ts(200);
+    datas.clear();
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Scan("scan110", "scan140", 20, t200, datas).error_code());
+    ASSERT_EQ(20, datas.size());
+    for (int i = 0; i < 20; i++) {
+        ASSERT_EQ("scan" + std::to_string(110 + i), datas[i].key);
+    }
+    datas.clear();
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Scan("scan140", "scan145", 0, t200, datas).error_code());
+    ASSERT_EQ(5, datas.size());
+    ASSERT_EQ("scan144", datas[4].key);
+}
+
+TEST_F(TxIndexImplTest, contention) {
+    azino::txindex::Contention c;
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->GetContention(k1, c).error_code());
+    ASSERT_EQ(0, c.conflicts);
+    ASSERT_EQ(0, c.waiters);
+
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, std::make_shared<azino::Value>(v1), t1).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_WriteConflicts, ti->WriteIntent(k1, std::make_shared<azino::Value>(v2), t2).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_WriteBlock, ti->WriteLock(k1, t2, std::bind(&TxIndexImplTest::dummyCallback, this)).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->GetContention(k1, c).error_code());
+    ASSERT_EQ(2, c.conflicts);
+    ASSERT_EQ(1, c.waiters);
+
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Clean(k1, t1).error_code());
+    waitDummyCallback();
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->GetContention(k1, c).error_code());
+    ASSERT_EQ(0, c.waiters);
 }
 
 TEST_F(TxIndexImplTest, write_lock_ok) {
     ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteLock(k1, t1, std::bind(&TxIndexImplTest::dummyCallback, this)).error_code());
     ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteLock(k1, t1, std::bind(&TxIndexImplTest::dummyCallback, this)).error_code());
 
-    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k2, v1, t1).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k2, std::make_shared<azino::Value>(v1), t1).error_code());
     ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteLock(k2, t1, std::bind(&TxIndexImplTest::dummyCallback, this)).error_code());
 }
 
 TEST_F(TxIndexImplTest, write_lock_block) {
-    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, v1, t1).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, std::make_shared<azino::Value>(v1), t1).error_code());
     ASSERT_EQ(azino::TxOpStatus_Code_WriteBlock, ti->WriteLock(k1, t2, std::bind(&TxIndexImplTest::dummyCallback, this)).error_code());
     ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Clean(k1, t1).error_code());
     waitDummyCallback();
@@ -126,7 +329,7 @@ TEST_F(TxIndexImplTest, write_lock_block) {
 }
 
 TEST_F(TxIndexImplTest, write_lock_too_late) {
-    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, v2, t2).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, std::make_shared<azino::Value>(v2), t2).error_code());
     t2.set_commit_ts(4);
     ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Commit(k1, t2).error_code());
     ASSERT_EQ(azino::TxOpStatus_Code_WriteTooLate, ti->WriteLock(k1, t1, std::bind(&TxIndexImplTest::dummyCallback, this)).error_code());
@@ -136,7 +339,7 @@ TEST_F(TxIndexImplTest, clean_not_exist) {
     ASSERT_EQ(azino::TxOpStatus_Code_CleanNotExist, ti->Clean(k1, t1).error_code());
     ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteLock(k1, t2, std::bind(&TxIndexImplTest::dummyCallback, this)).error_code());
     ASSERT_EQ(azino::TxOpStatus_Code_CleanNotExist, ti->Clean(k1, t1).error_code());
-    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, v2, t2).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, std::make_shared<azino::Value>(v2), t2).error_code());
     ASSERT_EQ(azino::TxOpStatus_Code_CleanNotExist, ti->Clean(k1, t1).error_code());
 }
 
@@ -145,7 +348,7 @@ TEST_F(TxIndexImplTest, clean_ok) {
     ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Clean(k1, t1).error_code());
 
     ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteLock(k2, t1, std::bind(&TxIndexImplTest::dummyCallback, this)).error_code());
-    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k2, v1, t1).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k2, std::make_shared<azino::Value>(v1), t1).error_code());
     ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Clean(k2, t1).error_code());
 }
 
@@ -154,45 +357,49 @@ TEST_F(TxIndexImplTest, commit_not_exist) {
     ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteLock(k1, t2, std::bind(&TxIndexImplTest::dummyCallback, this)).error_code());
     ASSERT_EQ(azino::TxOpStatus_Code_CommitNotExist, ti->Commit(k1, t1).error_code());
     ASSERT_EQ(azino::TxOpStatus_Code_CommitNotExist, ti->Commit(k1, t2).error_code());
-    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, v2, t2).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, std::make_shared<azino::Value>(v2), t2).error_code());
     ASSERT_EQ(azino::TxOpStatus_Code_CommitNotExist, ti->Commit(k1, t1).error_code());
 }
 
 TEST_F(TxIndexImplTest, commit_ok) {
-    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, v1, t1).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, std::make_shared<azino::Value>(v1), t1).error_code());
     t1.set_commit_ts(3);
     ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Commit(k1, t1).error_code());
 
     ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteLock(k2, t2, std::bind(&TxIndexImplTest::dummyCallback, this)).error_code());
-    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k2, v2, t2).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k2, std::make_shared<azino::Value>(v2), t2).error_code());
     t2.set_commit_ts(4);
     ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Commit(k2, t2).error_code());
+
+    // committed keys hold neither intent nor lock
+    ASSERT_EQ(azino::TxOpStatus_Code_CommitNotExist, ti->Commit(k1, t1).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_CleanNotExist, ti->Clean(k1, t1).error_code());
 }
 
 TEST_F(TxIndexImplTest, read_ok) {
-    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, v1, t1).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, std::make_shared<azino::Value>(v1), t1).error_code());
     t1.set_commit_ts(3);
     ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Commit(k1, t1).error_code());
-    azino::Value read_value;
+    std::shared_ptr<const azino::Value> read_value;
     azino::TxIdentifier read_tx;
     read_tx.set_start_ts(4);
     ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Read(k1, read_value, read_tx, std::bind(&TxIndexImplTest::dummyCallback, this)).error_code());
-    ASSERT_EQ(v1.content(), read_value.content());
+    ASSERT_EQ(v1.content(), read_value->content());
 
     azino::TxIdentifier t3;
     t3.set_start_ts(4);
-    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, v2, t3).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, std::make_shared<azino::Value>(v2), t3).error_code());
     t3.set_commit_ts(5);
     ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Commit(k1, t3).error_code());
     ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Read(k1, read_value, read_tx, std::bind(&TxIndexImplTest::dummyCallback, this)).error_code());
-    ASSERT_EQ(v1.content(), read_value.content());
+    ASSERT_EQ(v1.content(), read_value->content());
     read_tx.set_start_ts(5);
     ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Read(k1, read_value, read_tx, std::bind(&TxIndexImplTest::dummyCallback, this)).error_code());
-    ASSERT_EQ(v2.content(), read_value.content());
+    ASSERT_EQ(v2.content(), read_value->content());
 }
 
 TEST_F(TxIndexImplTest, read_block) {
-    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, v1, t1).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, std::make_shared<azino::Value>(v1), t1).error_code());
     t1.set_commit_ts(2);
     ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Commit(k1, t1).error_code());
     azino::TxIdentifier read_tx_3;
@@ -202,32 +409,133 @@ TEST_F(TxIndexImplTest, read_block) {
     azino::TxIdentifier t3;
     t3.set_start_ts(4);
     ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteLock(k1, t3, std::bind(&TxIndexImplTest::dummyCallback, this)).error_code());
-    azino::Value read_value;
+    std::shared_ptr<const azino::Value> read_value;
     ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Read(k1, read_value, read_tx_3, std::bind(&TxIndexImplTest::dummyCallback, this)).error_code());
-    ASSERT_EQ(v1.content(), read_value.content());
+    ASSERT_EQ(v1.content(), read_value->content());
     ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Read(k1, read_value, read_tx_6, std::bind(&TxIndexImplTest::dummyCallback, this)).error_code());
-    ASSERT_EQ(v1.content(), read_value.content());
-    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, v2, t3).error_code());
+    ASSERT_EQ(v1.content(), read_value->content());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, std::make_shared<azino::Value>(v2), t3).error_code());
     ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Read(k1, read_value, read_tx_3, std::bind(&TxIndexImplTest::dummyCallback, this)).error_code());
-    ASSERT_EQ(v1.content(), read_value.content());
+    ASSERT_EQ(v1.content(), read_value->content());
     ASSERT_EQ(azino::TxOpStatus_Code_ReadBlock, ti->Read(k1, read_value, read_tx_6, std::bind(&TxIndexImplTest::dummyCallback, this)).error_code());
     t3.set_commit_ts(5);
     ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Commit(k1, t3).error_code());
     waitDummyCallback();
     ASSERT_TRUE(Called());
     ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Read(k1, read_value, read_tx_3, std::bind(&TxIndexImplTest::dummyCallback, this)).error_code());
-    ASSERT_EQ(v1.content(), read_value.content());
+    ASSERT_EQ(v1.content(), read_value->content());
     ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Read(k1, read_value, read_tx_6, std::bind(&TxIndexImplTest::dummyCallback, this)).error_code());
-    ASSERT_EQ(v2.content(), read_value.content());
+    ASSERT_EQ(v2.content(), read_value->content());
+}
+
+TEST_F(TxIndexImplTest, read_async_intent) {
+    azino::AsyncCommitInfo primary_info;
+    primary_info.set_primary_key(k1);
+    primary_info.add_keys(k1);
+    primary_info.add_keys(k2);
+    azino::AsyncCommitInfo secondary_info;
+    secondary_info.set_primary_key(k1);
+    t1.set_commit_ts(3);
+    std::vector<azino::txindex::DataToWrite> datas = {{&k1, std::make_shared<azino::Value>(v1), &primary_info, false}, {&k2, std::make_shared<azino::Value>(v1), &secondary_info, false}};
+    std::vector<azino::TxOpStatus> stss;
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->BatchWriteIntent(datas, t1, stss).error_code());
+
+    std::shared_ptr<const azino::Value> read_value;
+    azino::txindex::AsyncIntent intent;
+    azino::TxIdentifier read_tx_2;
+    read_tx_2.set_start_ts(2);
+    ASSERT_EQ(azino::TxOpStatus_Code_ReadNotExist, ti->Read(k1, read_value, read_tx_2, std::bind(&TxIndexImplTest::dummyCallback, this)).error_code());
+    azino::TxIdentifier read_tx_4;
+    read_tx_4.set_start_ts(4);
+    ASSERT_EQ(azino::TxOpStatus_Code_ReadAsyncIntent, ti->Read(k2, read_value, read_tx_4, std::bind(&TxIndexImplTest::dummyCallback, this), intent).error_code());
+    ASSERT_EQ(t1.start_ts(), intent.holder.start_ts());
+    ASSERT_EQ(t1.commit_ts(), intent.holder.commit_ts());
+    ASSERT_EQ(k1, intent.info.primary_key());
+    ASSERT_EQ(0, intent.info.keys_size());
+    ASSERT_EQ(azino::TxOpStatus_Code_ReadAsyncIntent, ti->Read(k1, read_value, read_tx_4, std::bind(&TxIndexImplTest::dummyCallback, this), intent).error_code());
+    ASSERT_EQ(2, intent.info.keys_size());
+
+    azino::AsyncCommitInfo info;
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->QueryIntent(k1, t1, info).error_code());
+    ASSERT_EQ(2, info.keys_size());
+    ASSERT_EQ(azino::TxOpStatus_Code_QueryNotExist, ti->QueryIntent(k1, t2, info).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Commit(k1, t1).error_code());
+    // the primary keeps the outcome and all the keys till the others are resolved
+    ASSERT_EQ(azino::TxOpStatus_Code_TxCommitted, ti->QueryIntent(k1, t1, info).error_code());
+    ASSERT_EQ(2, info.keys_size());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Commit(k1, t1).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_TxCommitted, ti->Clean(k1, t1).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Read(k1, read_value, read_tx_4, std::bind(&TxIndexImplTest::dummyCallback, this), intent).error_code());
+    ASSERT_EQ(v1.content(), read_value->content());
+
+    ASSERT_EQ(azino::TxOpStatus_Code_ReadBlock, ti->Read(k2, read_value, read_tx_4, std::bind(&TxIndexImplTest::dummyCallback, this)).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Commit(k2, t1).error_code());
+    waitDummyCallback();
+    ASSERT_TRUE(Called());
+    ASSERT_EQ(azino::TxOpStatus_Code_CommitNotExist, ti->Commit(k2, t1).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->ForgetAsyncCommit(k1, t1).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_QueryNotExist, ti->QueryIntent(k1, t1, info).error_code());
+}
+
+TEST_F(TxIndexImplTest, abort_async_intent) {
+    azino::AsyncCommitInfo primary_info;
+    primary_info.set_primary_key(k1);
+    primary_info.add_keys(k1);
+    primary_info.add_keys(k2);
+    azino::AsyncCommitInfo secondary_info;
+    secondary_info.set_primary_key(k1);
+    t1.set_commit_ts(3);
+    std::vector<azino::txindex::DataToWrite> datas = {{&k1, std::make_shared<azino::Value>(v1), &primary_info, false}, {&k2, std::make_shared<azino::Value>(v1), &secondary_info, false}};
+    std::vector<azino::TxOpStatus> stss;
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->BatchWriteIntent(datas, t1, stss).error_code());
+
+    // cleaning the primary aborts the tx, so a reader could not commit it any more
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Clean(k1, t1).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_TxAborted, ti->Commit(k1, t1).error_code());
+    azino::AsyncCommitInfo info;
+    ASSERT_EQ(azino::TxOpStatus_Code_TxAborted, ti->QueryIntent(k1, t1, info).error_code());
+    ASSERT_EQ(2, info.keys_size());
+    ASSERT_EQ(azino::TxOpStatus_Code_TxAborted, ti->WriteIntent(k1, std::make_shared<azino::Value>(v2), t1).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Clean(k2, t1).error_code());
+    std::shared_ptr<const azino::Value> read_value;
+    ASSERT_EQ(azino::TxOpStatus_Code_ReadNotExist, ti->Read(k1, read_value, t2, std::bind(&TxIndexImplTest::dummyCallback, this)).error_code());
+}
+
+TEST_F(TxIndexImplTest, fence_absent_primary) {
+    azino::AsyncCommitInfo primary_info;
+    primary_info.set_primary_key(k1);
+    primary_info.add_keys(k1);
+    primary_info.add_keys(k2);
+    t1.set_commit_ts(3);
+
+    // the tx is aborted on its primary before the intent there comes, which is refused then
+    ASSERT_EQ(azino::TxOpStatus_Code_CleanNotExist, ti->Clean(k1, t1).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->ForgetAsyncCommit(k1, t1).error_code());
+    std::vector<azino::txindex::DataToWrite> datas = {{&k1, std::make_shared<azino::Value>(v1), &primary_info, false}};
+    std::vector<azino::TxOpStatus> stss;
+    ASSERT_EQ(azino::TxOpStatus_Code_TxAborted, ti->BatchWriteIntent(datas, t1, stss).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_TxAborted, ti->Commit(k1, t1).error_code());
+    azino::AsyncCommitInfo info;
+    ASSERT_EQ(azino::TxOpStatus_Code_TxAborted, ti->QueryIntent(k1, t1, info).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_CleanNotExist, ti->Clean(k1, t1).error_code());
+
+    // other txs are not fenced
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, std::make_shared<azino::Value>(v2), t2).error_code());
 }
 
 TEST_F(TxIndexImplTest, read_not_exist) {
-    azino::Value read_value;
+    std::shared_ptr<const azino::Value> read_value;
     ASSERT_EQ(azino::TxOpStatus_Code_ReadNotExist, ti->Read(k1, read_value, t1, std::bind(&TxIndexImplTest::dummyCallback, this)).error_code());
     ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteLock(k1, t1, std::bind(&TxIndexImplTest::dummyCallback, this)).error_code());
     ASSERT_EQ(azino::TxOpStatus_Code_ReadNotExist, ti->Read(k1, read_value, t1, std::bind(&TxIndexImplTest::dummyCallback, this)).error_code());
-    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, v1, t1).error_code());
-    ASSERT_EQ(azino::TxOpStatus_Code_ReadNotExist, ti->Read(k1, read_value, t1, std::bind(&TxIndexImplTest::dummyCallback, this)).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, std::make_shared<azino::Value>(v1), t1).error_code());
+    // a tx reads its own intent back
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Read(k1, read_value, t1, std::bind(&TxIndexImplTest::dummyCallback, this)).error_code());
+    ASSERT_EQ(v1.content(), read_value->content());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, std::make_shared<azino::Value>(v2), t1).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Read(k1, read_value, t1, std::bind(&TxIndexImplTest::dummyCallback, this)).error_code());
+    ASSERT_EQ(v2.content(), read_value->content());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, std::make_shared<azino::Value>(v1), t1).error_code());
     t1.set_commit_ts(4);
     ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Commit(k1, t1).error_code());
     ASSERT_EQ(azino::TxOpStatus_Code_ReadNotExist, ti->Read(k1, read_value, t1, std::bind(&TxIndexImplTest::dummyCallback, this)).error_code());
@@ -237,31 +545,31 @@ TEST_F(TxIndexImplTest, read_not_exist) {
     azino::TxIdentifier read_tx_6;
     read_tx_6.set_start_ts(6);
     ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Read(k1, read_value, read_tx_6, std::bind(&TxIndexImplTest::dummyCallback, this)).error_code());
-    ASSERT_EQ(v1.content(), read_value.content());
+    ASSERT_EQ(v1.content(), read_value->content());
 }
 
 
 TEST_F(TxIndexImplTest, persist) {
     std::vector<azino::txindex::DataToPersist> datas;
-    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, v1, t1).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, std::make_shared<azino::Value>(v1), t1).error_code());
     ASSERT_EQ(ti->GetPersisting(datas).error_code(), azino::TxOpStatus_Code_NoneToPersist);
     t1.set_commit_ts(3);
     ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Commit(k1, t1).error_code());
     t2.set_start_ts(4);
     ASSERT_EQ(azino::TxOpStatus_Code_Ok,
               ti->WriteLock(k1, t2, std::bind(&TxIndexImplTest::dummyCallback, this)).error_code());
-    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, v2, t2).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, std::make_shared<azino::Value>(v2), t2).error_code());
     t2.set_commit_ts(5);
     ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Commit(k1, t2).error_code());
-    azino::Value read_value;
+    std::shared_ptr<const azino::Value> read_value;
     azino::TxIdentifier read_tx_3;
     read_tx_3.set_start_ts(3);
     azino::TxIdentifier read_tx_6;
     read_tx_6.set_start_ts(6);
     ASSERT_EQ(ti->Read(k1, read_value, read_tx_3, NULL).error_code(), azino::TxOpStatus_Code_Ok);
-    ASSERT_EQ(v1.content(), read_value.content());
+    ASSERT_EQ(v1.content(), read_value->content());
     ASSERT_EQ(ti->Read(k1, read_value, read_tx_6, NULL).error_code(), azino::TxOpStatus_Code_Ok);
-    ASSERT_EQ(v2.content(), read_value.content());
+    ASSERT_EQ(v2.content(), read_value->content());
     ASSERT_EQ(ti->GetPersisting(datas).error_code(), azino::TxOpStatus_Code_Ok);
     ASSERT_EQ(datas.size(), 1);
     ASSERT_EQ(datas[0].t2vs.size(), 2);
@@ -273,3 +581,267 @@ TEST_F(TxIndexImplTest, persist) {
     ASSERT_EQ(ti->Read(k1, read_value, read_tx_3, NULL).error_code(), azino::TxOpStatus_Code_ReadNotExist);
     ASSERT_EQ(ti->Read(k1, read_value, read_tx_6, NULL).error_code(), azino::TxOpStatus_Code_ReadNotExist);
 }
+
+TEST_F(TxIndexImplTest, persist_merge_intents) {
+    azino::Value add1;
+    add1.set_merge_op("add");
+    add1.set_content("1");
+    std::vector<azino::txindex::DataToPersist> datas;
+    t1.set_commit_ts(4);
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, std::make_shared<azino::Value>(add1), t1).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, std::make_shared<azino::Value>(add1), t2).error_code());
+    t2.set_commit_ts(3);
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Commit(k1, t2).error_code());
+    azino::TxIdentifier t5;
+    t5.set_start_ts(5);
+    t5.set_commit_ts(6);
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, std::make_shared<azino::Value>(add1), t5).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Commit(k1, t5).error_code());
+
+    // the version above the operand of t1 is kept till t1 commits below it
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->GetPersisting(datas).error_code());
+    ASSERT_EQ(1, datas.size());
+    ASSERT_EQ(1, datas[0].t2vs.size());
+    ASSERT_EQ(3, datas[0].t2vs.begin()->first);
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->ClearPersisted(datas).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Commit(k1, t1).error_code());
+    datas.clear();
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->GetPersisting(datas).error_code());
+    ASSERT_EQ(2, datas[0].t2vs.size());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->ClearPersisted(datas).error_code());
+
+    // operands could not land below the versions persisted
+    azino::TxIdentifier t7;
+    t7.set_start_ts(2);
+    t7.set_commit_ts(5);
+    ASSERT_EQ(azino::TxOpStatus_Code_WriteTooLate, ti->WriteIntent(k1, std::make_shared<azino::Value>(add1), t7).error_code());
+
+    // nor could operands "add" does not take
+    azino::TxIdentifier t8;
+    t8.set_start_ts(8);
+    add1.set_content("one");
+    ASSERT_EQ(azino::TxOpStatus_Code_MergeFailed, ti->WriteIntent(k2, std::make_shared<azino::Value>(add1), t8).error_code());
+    add1.set_content("1");
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k2, std::make_shared<azino::Value>(v1), t8).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_MergeFailed, ti->WriteIntent(k2, std::make_shared<azino::Value>(add1), t8).error_code());
+}
+
+TEST_F(TxIndexImplTest, conditional_write_intent) {
+    // nothing in txindex to check against
+    ASSERT_EQ(azino::TxOpStatus_Code_ConditionUnknown, ti->ConditionalWriteIntent(k1, std::make_shared<azino::Value>(v1), v2, t1).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, std::make_shared<azino::Value>(v1), t1).error_code());
+    t1.set_commit_ts(3);
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Commit(k1, t1).error_code());
+
+    azino::TxIdentifier t4, t5;
+    t4.set_start_ts(4);
+    t5.set_start_ts(5);
+    ASSERT_EQ(azino::TxOpStatus_Code_ConditionFailed, ti->ConditionalWriteIntent(k1, std::make_shared<azino::Value>(v2), v2, t4).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->ConditionalWriteIntent(k1, std::make_shared<azino::Value>(v2), v1, t4).error_code());
+    // another tx's intent conflicts whatever it expects
+    ASSERT_EQ(azino::TxOpStatus_Code_WriteConflicts, ti->ConditionalWriteIntent(k1, std::make_shared<azino::Value>(v1), v1, t5).error_code());
+    // the tx sees its own intent
+    ASSERT_EQ(azino::TxOpStatus_Code_ConditionFailed, ti->ConditionalWriteIntent(k1, std::make_shared<azino::Value>(v1), v1, t4).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->ConditionalWriteIntent(k1, std::make_shared<azino::Value>(v1), v2, t4).error_code());
+    t4.set_commit_ts(6);
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Commit(k1, t4).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_WriteTooLate, ti->ConditionalWriteIntent(k1, std::make_shared<azino::Value>(v2), v1, t5).error_code());
+
+    azino::Value deleted;
+    deleted.set_is_delete(true);
+    azino::TxIdentifier t7;
+    t7.set_start_ts(7);
+    ASSERT_EQ(azino::TxOpStatus_Code_ConditionFailed, ti->ConditionalWriteIntent(k1, std::make_shared<azino::Value>(v2), deleted, t7).error_code());
+
+    // a one phase commit replaces the tx's own conditional intent
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->ConditionalWriteIntent(k1, std::make_shared<azino::Value>(v2), v1, t7).error_code());
+    std::vector<azino::txindex::DataToWrite> datas = {{&k1, std::make_shared<azino::Value>(v2), nullptr, false}};
+    std::vector<azino::TxOpStatus> stss;
+    t7.set_commit_ts(8);
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->OnePhaseCommit(datas, t7, stss).error_code());
+    azino::TxIdentifier t9;
+    t9.set_start_ts(9);
+    std::shared_ptr<const azino::Value> v;
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Read(k1, v, t9, std::bind(&TxIndexImplTest::dummyCallback, this)).error_code());
+    ASSERT_EQ(v2.content(), v->content());
+}
+
+TEST_F(TxIndexImplTest, merge_intent) {
+    azino::Value add1, add2;
+    add1.set_merge_op("add");
+    add1.set_content("1");
+    add2.set_merge_op("add");
+    add2.set_content("2");
+    std::shared_ptr<const azino::Value> v;
+    // operands of many txs stack on one key without conflicts
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, std::make_shared<azino::Value>(add1), t1).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, std::make_shared<azino::Value>(add2), t2).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, std::make_shared<azino::Value>(add2), t2).error_code());
+    // but not with a whole value
+    azino::TxIdentifier t3;
+    t3.set_start_ts(3);
+    ASSERT_EQ(azino::TxOpStatus_Code_WriteConflicts, ti->WriteIntent(k1, std::make_shared<azino::Value>(v1), t3).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_ReadBlock, ti->Read(k1, v, t3, nullptr).error_code());
+
+    t1.set_commit_ts(4);
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Commit(k1, t1).error_code());
+    t2.set_commit_ts(5);
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Commit(k1, t2).error_code());
+    // storage has the value they fold onto
+    azino::TxIdentifier t6;
+    t6.set_start_ts(6);
+    ASSERT_EQ(azino::TxOpStatus_Code_ReadNeedBase, ti->Read(k1, v, t6, nullptr).error_code());
+    ASSERT_EQ("5", v->content());
+    ASSERT_EQ(3, v->merge_base_ts());
+
+    azino::Value ten;
+    ten.set_content("10");
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k2, std::make_shared<azino::Value>(ten), t3).error_code());
+    t3.set_commit_ts(7);
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Commit(k2, t3).error_code());
+    azino::TxIdentifier t8, t9;
+    t8.set_start_ts(8);
+    t9.set_start_ts(9);
+    add1.set_content("12");
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k2, std::make_shared<azino::Value>(add1), t8).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k2, std::make_shared<azino::Value>(add1), t8).error_code());
+    // an operand written with another operator can not fold into them
+    azino::Value append;
+    append.set_merge_op("append");
+    append.set_content("x");
+    ASSERT_EQ(azino::TxOpStatus_Code_MergeFailed, ti->WriteIntent(k2, std::make_shared<azino::Value>(append), t8).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Read(k2, v, t8, nullptr).error_code());
+    ASSERT_EQ("34", v->content());
+    t8.set_commit_ts(10);
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Commit(k2, t8).error_code());
+    // versions are folded onto the whole value before them
+    azino::TxIdentifier t11;
+    t11.set_start_ts(11);
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Read(k2, v, t11, nullptr).error_code());
+    ASSERT_EQ("34", v->content());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Read(k2, v, t9, nullptr).error_code());
+    ASSERT_EQ("10", v->content());
+
+    // a cleaned operand is gone, and a whole value could be written again
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k2, std::make_shared<azino::Value>(add1), t11).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Clean(k2, t11).error_code());
+    azino::TxIdentifier t12;
+    t12.set_start_ts(12);
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k2, std::make_shared<azino::Value>(v2), t12).error_code());
+}
+
+TEST_F(TxIndexImplTest, cacheable) {
+    // changes are only logged when caching is enabled
+    ASSERT_FALSE(ti->Cacheable(k1, 1, ti->LatestChange()));
+    FLAGS_change_log_size = 100000;
+    auto since = ti->LatestChange();
+    ASSERT_TRUE(ti->Cacheable(k1, 1, since));
+    std::vector<std::string> keys;
+    uint64_t latest = 0;
+    ASSERT_TRUE(ti->ChangesSince(since, keys, latest));
+    ASSERT_TRUE(keys.empty());
+    ASSERT_EQ(since, latest);
+
+    // a lock changes nothing, an intent does
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteLock(k1, t2, std::bind(&TxIndexImplTest::dummyCallback, this)).error_code());
+    ASSERT_TRUE(ti->Cacheable(k1, 1, since));
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, std::make_shared<azino::Value>(v2), t2).error_code());
+    ASSERT_FALSE(ti->Cacheable(k1, 1, ti->LatestChange()));
+    t2.set_commit_ts(3);
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Commit(k1, t2).error_code());
+    ASSERT_TRUE(ti->ChangesSince(since, keys, latest));
+    ASSERT_EQ(std::vector<std::string>({k1, k1}), keys);
+    ASSERT_EQ(latest, ti->LatestChange());
+
+    // a read that began before the changes, or that misses the latest version, is not cacheable
+    ASSERT_FALSE(ti->Cacheable(k1, 4, since));
+    ASSERT_FALSE(ti->Cacheable(k1, 2, latest));
+    ASSERT_TRUE(ti->Cacheable(k1, 4, latest));
+    ASSERT_TRUE(ti->Cacheable(k2, 1, since));
+
+    // a failed write changes nothing
+    ASSERT_EQ(azino::TxOpStatus_Code_WriteTooLate, ti->WriteIntent(k1, std::make_shared<azino::Value>(v1), t1).error_code());
+    ASSERT_TRUE(ti->Cacheable(k1, 4, latest));
+    FLAGS_change_log_size = 0;
+}
+
+TEST_F(TxIndexImplTest, delete_range) {
+    // k1 is held by the index, k2 only in storage, "key3" is out of the range
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, std::make_shared<azino::Value>(v1), t1).error_code());
+    t1.set_commit_ts(3);
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Commit(k1, t1).error_code());
+    auto since = ti->LatestChange();
+    azino::TxIdentifier del;
+    del.set_start_ts(4);
+    del.set_commit_ts(5);
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->DeleteRange(k1, "key3", del).error_code());
+
+    // the keys only in storage are not known one by one
+    std::vector<std::string> keys;
+    uint64_t latest = 0;
+    ASSERT_FALSE(ti->ChangesSince(since, keys, latest));
+
+    std::shared_ptr<const azino::Value> read_value;
+    azino::TxIdentifier read_tx_4;
+    read_tx_4.set_start_ts(4);
+    azino::TxIdentifier read_tx_6;
+    read_tx_6.set_start_ts(6);
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Read(k1, read_value, read_tx_4, NULL).error_code());
+    ASSERT_EQ(v1.content(), read_value->content());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Read(k1, read_value, read_tx_6, NULL).error_code());
+    ASSERT_TRUE(read_value->is_delete());
+    ASSERT_EQ(azino::TxOpStatus_Code_ReadNotExist, ti->Read(k2, read_value, read_tx_4, NULL).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Read(k2, read_value, read_tx_6, NULL).error_code());
+    ASSERT_TRUE(read_value->is_delete());
+    ASSERT_EQ(azino::TxOpStatus_Code_ReadNotExist, ti->Read("key3", read_value, read_tx_6, NULL).error_code());
+    // reads do not add the keys only in storage
+    std::vector<azino::txindex::ScannedData> datas;
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Scan(k1, "key3", 0, read_tx_6, datas).error_code());
+    ASSERT_EQ(1, datas.size());
+    ASSERT_EQ(k1, datas[0].key);
+
+    // txs started before the deletion fail to write keys in the range
+    ASSERT_EQ(azino::TxOpStatus_Code_WriteTooLate, ti->WriteIntent(k2, std::make_shared<azino::Value>(v2), t2).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k2, std::make_shared<azino::Value>(v2), read_tx_6).error_code());
+
+    std::vector<azino::txindex::DeletedRange> ranges;
+    ti->DeletedRanges("key0", "key2", 4, ranges);
+    ASSERT_TRUE(ranges.empty());
+    ti->DeletedRanges("key0", "key2", 6, ranges);
+    ASSERT_EQ(1, ranges.size());
+    ASSERT_EQ(k1, ranges[0].start);
+    ASSERT_EQ("key3", ranges[0].end);
+    ASSERT_EQ(5, ranges[0].ts);
+    ranges.clear();
+    ti->DeletedRanges("key3", "", 6, ranges);
+    ASSERT_TRUE(ranges.empty());
+
+    azino::txindex::DeletedRange range;
+    ASSERT_TRUE(ti->GetPersistingRange(range));
+    ASSERT_EQ(5, range.ts);
+    ti->ClearPersistedRange(range);
+    ASSERT_FALSE(ti->GetPersistingRange(range));
+}
+
+TEST_F(TxIndexImplTest, delete_range_blocked_by_writers) {
+    // a writer that never finishes blocks the deletion, which returns at once and deletes nothing
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->WriteIntent(k1, std::make_shared<azino::Value>(v1), t1).error_code());
+    azino::TxIdentifier del;
+    del.set_start_ts(4);
+    del.set_commit_ts(5);
+    ASSERT_EQ(azino::TxOpStatus_Code_WriteBlock, ti->DeleteRange(k1, "", del).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_WriteBlock, ti->DeleteRange(k1, "", del).error_code());
+    std::shared_ptr<const azino::Value> v;
+    azino::TxIdentifier t6;
+    t6.set_start_ts(6);
+    ASSERT_EQ(azino::TxOpStatus_Code_ReadNotExist, ti->Read(k2, v, t6, nullptr).error_code());
+    std::vector<azino::txindex::DeletedRange> ranges;
+    ti->DeletedRanges(k1, "", 6, ranges);
+    ASSERT_TRUE(ranges.empty());
+
+    // retried once the writer is gone
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Clean(k1, t1).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->DeleteRange(k1, "", del).error_code());
+    ASSERT_EQ(azino::TxOpStatus_Code_Ok, ti->Read(k2, v, t6, nullptr).error_code());
+    ASSERT_TRUE(v->is_delete());
+}
@@ -20,11 +20,21 @@ namespace txplanner {
                              ::azino::txplanner::BeginTxResponse* response,
                              ::google::protobuf::Closure* done) override;
 
+        virtual void BatchBeginTx(::google::protobuf::RpcController* controller,
+                                  const ::azino::txplanner::BatchBeginTxRequest* request,
+                                  ::azino::txplanner::BatchBeginTxResponse* response,
+                                  ::google::protobuf::Closure* done) override;
+
         virtual void CommitTx(::google::protobuf::RpcController* controller,
                               const ::azino::txplanner::CommitTxRequest* request,
                               ::azino::txplanner::CommitTxResponse* response,
                               ::google::protobuf::Closure* done) override;
 
+        virtual void BatchCommitTx(::google::protobuf::RpcController* controller,
+                                   const ::azino::txplanner::BatchCommitTxRequest* request,
+                                   ::azino::txplanner::BatchCommitTxResponse* response,
+                                   ::google::protobuf::Closure* done) override;
+
     private:
         std::unique_ptr<AscendingTimer> _timer;
         std::vector<std::string> _txindex_addrs; // txindex addresses in form of "0.0.0.0:8000"
@@ -17,6 +17,13 @@ namespace txplanner {
             auto tmp = ++_ts;
             return tmp;
         }
+        // Returns the first of "n" ascending timestamps
+        TimeStamp NewTimes(uint32_t n) {
+            std::lock_guard<bthread::Mutex> lck(_m);
+            auto tmp = _ts + 1;
+            _ts += n;
+            return tmp;
+        }
     private:
         TimeStamp _ts;
         bthread::Mutex _m;
@@ -52,6 +59,26 @@ namespace txplanner {
         response->set_storage_addr(_storage_addr);
     }
 
+    void TxServiceImpl::BatchBeginTx(::google::protobuf::RpcController *controller,
+                                     const ::azino::txplanner::BatchBeginTxRequest *request,
+                                     ::azino::txplanner::BatchBeginTxResponse *response,
+                                     ::google::protobuf::Closure *done) {
+        brpc::ClosureGuard done_guard(done);
+        brpc::Controller *cntl = static_cast<brpc::Controller *>(controller);
+
+        std::stringstream ss;
+        auto count = request->count() > 0 ? request->count() : 1;
+        auto first_start_ts = _timer->NewTimes(count);
+        ss << cntl->remote_side() << " " << count << " txs from start_ts: " << first_start_ts << " are going to begin.";
+        LOG(INFO) << ss.str();
+        response->set_first_start_ts(first_start_ts);
+        response->set_count(count);
+        for (std::string& addr : _txindex_addrs) {
+            response->add_txindex_addrs(addr);
+        }
+        response->set_storage_addr(_storage_addr);
+    }
+
     void TxServiceImpl::CommitTx(::google::protobuf::RpcController *controller,
                                  const ::azino::txplanner::CommitTxRequest *request,
                                  ::azino::txplanner::CommitTxResponse *response,
@@ -75,5 +102,29 @@ namespace txplanner {
         LOG(INFO) << ss.str();
         response->set_allocated_txid(txid);
     }
+
+    void TxServiceImpl::BatchCommitTx(::google::protobuf::RpcController *controller,
+                                      const ::azino::txplanner::BatchCommitTxRequest *request,
+                                      ::azino::txplanner::BatchCommitTxResponse *response,
+                                      ::google::protobuf::Closure *done) {
+        brpc::ClosureGuard done_guard(done);
+        brpc::Controller *cntl = static_cast<brpc::Controller *>(controller);
+
+        std::stringstream ss;
+        auto count = request->count() > 0 ? request->count() : 1;
+        // the start_ts of all the txs come before their commit_ts, taken in one go
+        auto first_start_ts = _timer->NewTimes(2 * count);
+        auto first_commit_ts = first_start_ts + count;
+        ss << cntl->remote_side() << " " << count << " txs from start_ts: " << first_start_ts
+           << " commit_ts: " << first_commit_ts << " are going to commit.";
+        LOG(INFO) << ss.str();
+        response->set_first_start_ts(first_start_ts);
+        response->set_first_commit_ts(first_commit_ts);
+        response->set_count(count);
+        for (std::string& addr : _txindex_addrs) {
+            response->add_txindex_addrs(addr);
+        }
+        response->set_storage_addr(_storage_addr);
+    }
 }
 }
\ No newline at end of file